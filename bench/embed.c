@@ -0,0 +1,66 @@
+/*
+ * Runs a pocode program n times in-process with libpal70 and n times
+ * as a pal70 subprocess, and prints the time per run.
+ *
+ * Usage: embed PAL70 FILE.pocode [N]
+ */
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "libpal70.h"
+
+extern char** environ;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s PAL70 FILE.pocode [N]\n", argv[0]);
+        return 1;
+    }
+    char* pal70 = argv[1];
+    char* file_name = argv[2];
+    int n = argc > 3 ? atoi(argv[3]) : 100000;
+
+    pal_init();
+    double t = now();
+    pal_program* program = pal_load_file(file_name);
+    if (!program) {
+        fprintf(stderr, "%s: error reading %s\n", argv[0], file_name);
+        return 1;
+    }
+    for (int i = 0; i < n; i++) {
+        pal_vm* vm = pal_new_vm(program, stderr);
+        pal_value* res = pal_run(vm);
+        if (pal_typeof(res) != PAL_INTEGER || pal_get_integer(res) != 55) {
+            fprintf(stderr, "%s: unexpected result\n", argv[0]);
+            return 1;
+        }
+        pal_free_vm(vm);
+    }
+    double in_process = now()-t;
+    printf("in-process: %d runs in %.3fs, %.1fus per run\n", n, in_process, in_process/n*1e6);
+
+    char* args[] = { pal70, file_name, 0 };
+    t = now();
+    for (int i = 0; i < n; i++) {
+        pid_t pid;
+        if (posix_spawn(&pid, pal70, 0, 0, args, environ) != 0) {
+            perror(argv[0]);
+            return 1;
+        }
+        waitpid(pid, 0, 0);
+    }
+    double subprocess = now()-t;
+    printf("fork/exec:  %d runs in %.3fs, %.1fus per run\n", n, subprocess, subprocess/n*1e6);
+    return 0;
+}
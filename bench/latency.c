@@ -0,0 +1,65 @@
+/*
+ * Runs a command n times and prints the median and 99th percentile
+ * of its wall clock time. The output of the command is discarded.
+ *
+ * Usage: latency N COMMAND [ARG]...
+ */
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+
+extern char** environ;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static int compare(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s N COMMAND [ARG]...\n", argv[0]);
+        return 1;
+    }
+    int n = atoi(argv[1]);
+    if (n <= 0) n = 1;
+    double* times = malloc(n*sizeof(double));
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+
+    for (int i = 0; i < n; i++) {
+        double t = now();
+        pid_t pid;
+        int status;
+        if (posix_spawn(&pid, argv[2], &actions, 0, argv+2, environ) != 0) {
+            perror(argv[0]);
+            return 1;
+        }
+        waitpid(pid, &status, 0);
+        times[i] = now()-t;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s: %s failed\n", argv[0], argv[2]);
+            return 1;
+        }
+    }
+
+    qsort(times, n, sizeof(double), compare);
+    printf("%d runs: p50 %.1fus, p99 %.1fus\n",
+           n, times[n/2]*1e6, times[(int)(n*0.99)]*1e6);
+    return 0;
+}
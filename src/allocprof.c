@@ -0,0 +1,379 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "allocprof.h"
+#include "gc.h"
+#include "interpreter.h"
+
+/* the mean number of allocations per object tracked */
+#define ALLOCPROF_PERIOD 64
+/* the rows of each table */
+#define ALLOCPROF_ROWS 15
+
+/* the allocations of one kind by one operation, 0 outside the VM */
+typedef struct {
+    operation* op;
+    int kind;
+    long count;
+    long bytes;
+} alloc_site;
+
+/* the sites of one thread, hashed by operation and kind */
+typedef struct _alloc_counts {
+    alloc_site* sites;
+    int len;
+    int cap;
+    struct _alloc_counts* next;
+} alloc_counts;
+
+/* an object tracked until it is finalized */
+typedef struct {
+    operation* op;
+    int kind;
+    int size;
+    /* the collections before it was allocated */
+    long gc_no;
+    /* live, or the next free slot */
+    int live;
+    int next_free;
+} tracked;
+
+int allocprof_on = 0;
+_Thread_local struct _pal_vm* allocprof_vm = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static alloc_counts* all_counts = 0;
+static _Thread_local alloc_counts* counts = 0;
+static pal_program* program = 0;
+
+static int interval = 0;
+static FILE* report = 0;
+static tracked* slots = 0;
+static int slots_len = 0;
+static int slots_max = 0;
+static int free_slot = -1;
+static long reported_gc_no = 0;
+static long next_report = 0;
+static _Thread_local long countdown = 0;
+static _Thread_local unsigned int seed = 0;
+
+static long now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000L + t.tv_nsec;
+}
+
+static alloc_counts* thread_counts()
+{
+    if (!counts) {
+        counts = calloc(1, sizeof(alloc_counts));
+        pthread_mutex_lock(&lock);
+        counts->next = all_counts;
+        all_counts = counts;
+        pthread_mutex_unlock(&lock);
+    }
+    return counts;
+}
+
+static unsigned long hash_site(operation* op, int kind)
+{
+    unsigned long h = ((uintptr_t)op >> 3)*ALLOC_KINDS + kind;
+    h *= 0x9E3779B97F4A7C15UL;
+    return h ^ (h >> 29);
+}
+
+static alloc_site* find_site(alloc_counts* c, operation* op, int kind)
+{
+    if (2*(c->len+1) > c->cap) {
+        alloc_site* old = c->sites;
+        int old_cap = c->cap;
+        c->cap = c->cap ? 2*c->cap : 256;
+        c->sites = calloc(c->cap, sizeof(alloc_site));
+        for (int i = 0; i < old_cap; i++) {
+            if (!old[i].count) continue;
+            unsigned long j = hash_site(old[i].op, old[i].kind) & (c->cap-1);
+            while (c->sites[j].count) j = (j+1) & (c->cap-1);
+            c->sites[j] = old[i];
+        }
+        free(old);
+    }
+    unsigned long j = hash_site(op, kind) & (c->cap-1);
+    while (c->sites[j].count) {
+        alloc_site* s = &c->sites[j];
+        if (s->op == op && s->kind == kind) return s;
+        j = (j+1) & (c->cap-1);
+    }
+    alloc_site* s = &c->sites[j];
+    s->op = op;
+    s->kind = kind;
+    c->len++;
+    return s;
+}
+
+void allocprof_start(int seconds, FILE* file)
+{
+    interval = seconds;
+    report = file;
+    next_report = now()+interval*1000000000L;
+    if (interval > 0) {
+        pthread_mutex_lock(&lock);
+        slots_max = 1024;
+        slots = malloc(slots_max*sizeof(tracked));
+        pthread_mutex_unlock(&lock);
+    }
+    allocprof_on = 1;
+}
+
+void allocprof_run(pal_program* prog)
+{
+    pthread_mutex_lock(&lock);
+    if (!program) {
+        program = prog;
+        retain_program(program);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+typedef struct {
+    operation* op;
+    int kind;
+    long count;
+    long bytes;
+    /* the collections survived */
+    long age;
+} alloc_row;
+
+static int in_program(operation* op)
+{
+    return !op || (program && op >= program->ops && op < program->ops+program->len);
+}
+
+static int compare_sites(const void* a, const void* b)
+{
+    const alloc_row* x = a;
+    const alloc_row* y = b;
+    if (!x->op || !y->op) {
+        if (x->op != y->op) return x->op ? 1 : -1;
+    }
+    else {
+        int c = strcmp(x->op->file, y->op->file);
+        if (c != 0) return c;
+        if (x->op->line != y->op->line) return x->op->line - y->op->line;
+    }
+    return x->kind - y->kind;
+}
+
+static int compare_counts(const void* a, const void* b)
+{
+    const alloc_row* x = a;
+    const alloc_row* y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return compare_sites(a, b);
+}
+
+static int compare_bytes(const void* a, const void* b)
+{
+    const alloc_row* x = a;
+    const alloc_row* y = b;
+    if (x->bytes != y->bytes) return x->bytes < y->bytes ? 1 : -1;
+    return compare_sites(a, b);
+}
+
+/*
+ * Sums the rows of the same line and kind, returns their number.
+ */
+static int merge_rows(alloc_row* rows, int n)
+{
+    qsort(rows, n, sizeof(alloc_row), compare_sites);
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        if (m > 0 && compare_sites(&rows[m-1], &rows[i]) == 0) {
+            rows[m-1].count += rows[i].count;
+            rows[m-1].bytes += rows[i].bytes;
+            rows[m-1].age += rows[i].age;
+        }
+        else {
+            rows[m++] = rows[i];
+        }
+    }
+    return m;
+}
+
+static void print_site(FILE* file, alloc_row* row)
+{
+    char* kind = row->kind == ALLOC_ARRAY ? "tuple array" :
+                 row->kind == ALLOC_STACK ? "stack cell" : value_type_name(row->kind);
+    fprintf(file, "  %-12s ", kind);
+    if (row->op)
+        fprintf(file, "%s:%d\n", row->op->file, row->op->line);
+    else
+        fprintf(file, "[runtime]\n");
+}
+
+/*
+ * Writes the sites of the tracked objects allocated before collection
+ * gc_no that are still live. Called with the lock held.
+ */
+static void write_survivors(FILE* file, long gc_no)
+{
+    alloc_row* rows = malloc((slots_len+1)*sizeof(alloc_row));
+    int n = 0;
+    long live = 0;
+    for (int i = 0; i < slots_len; i++) {
+        tracked* t = &slots[i];
+        if (!t->live || t->gc_no >= gc_no || !in_program(t->op)) continue;
+        alloc_row* row = &rows[n++];
+        row->op = t->op;
+        row->kind = t->kind;
+        row->count = 1;
+        row->bytes = t->size;
+        row->age = gc_no-t->gc_no;
+        live++;
+    }
+    n = merge_rows(rows, n);
+    qsort(rows, n, sizeof(alloc_row), compare_counts);
+    fprintf(file, "after %ld collections, about %ld objects survive (1 in %d tracked)\n",
+            gc_no, live*ALLOCPROF_PERIOD, ALLOCPROF_PERIOD);
+    if (n > 0) fprintf(file, "%8s %10s %6s  %-12s %s\n", "objects", "bytes", "age", "type", "line");
+    for (int i = 0; i < n && i < ALLOCPROF_ROWS; i++) {
+        fprintf(file, "%8ld %10ld %6.1f", rows[i].count*ALLOCPROF_PERIOD,
+                rows[i].bytes*ALLOCPROF_PERIOD, (double)rows[i].age/rows[i].count);
+        print_site(file, &rows[i]);
+    }
+    free(rows);
+}
+
+static void finalized(void* obj, void* data)
+{
+    int i = (intptr_t)data;
+    pthread_mutex_lock(&lock);
+    if (i < slots_len) {
+        slots[i].live = 0;
+        slots[i].next_free = free_slot;
+        free_slot = i;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void track(void* obj, operation* op, int kind, size_t size)
+{
+    long gc_no = GC_get_gc_no();
+    pthread_mutex_lock(&lock);
+    if (!slots) {
+        /* stopped */
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    int i = free_slot;
+    if (i >= 0) {
+        free_slot = slots[i].next_free;
+    }
+    else {
+        if (slots_len == slots_max) {
+            slots_max *= 2;
+            slots = realloc(slots, slots_max*sizeof(tracked));
+        }
+        i = slots_len++;
+    }
+    tracked* t = &slots[i];
+    t->op = op;
+    t->kind = kind;
+    t->size = size;
+    t->gc_no = gc_no;
+    t->live = 1;
+    if (gc_no != reported_gc_no && now() >= next_report) {
+        write_survivors(report, gc_no);
+        fflush(report);
+        reported_gc_no = gc_no;
+        next_report = now()+interval*1000000000L;
+    }
+    pthread_mutex_unlock(&lock);
+    GC_REGISTER_FINALIZER_NO_ORDER(obj, finalized, (void*)(intptr_t)i, 0, 0);
+}
+
+void allocprof_record(void* obj, int kind, size_t size)
+{
+    struct _pal_vm* vm = allocprof_vm;
+    operation* op = vm ? vm->loc : 0;
+    alloc_site* s = find_site(thread_counts(), op, kind);
+    s->count++;
+    s->bytes += size;
+    if (interval > 0 && --countdown <= 0) {
+        if (!seed) seed = (uintptr_t)&seed;
+        countdown = 1+rand_r(&seed)%(2*ALLOCPROF_PERIOD);
+        track(obj, op, kind, size);
+    }
+}
+
+static void write_rows(FILE* file, char* title, alloc_row* rows, int n)
+{
+    if (n == 0) return;
+    fprintf(file, "%s\n%10s %12s  %-12s %s\n", title, "allocs", "bytes", "type", "line");
+    for (int i = 0; i < n && i < ALLOCPROF_ROWS; i++) {
+        fprintf(file, "%10ld %12ld", rows[i].count, rows[i].bytes);
+        print_site(file, &rows[i]);
+    }
+}
+
+static void write_counts(FILE* file)
+{
+    int n = 0;
+    for (alloc_counts* c = all_counts; c; c = c->next) n += c->len;
+    alloc_row* rows = malloc((n+1)*sizeof(alloc_row));
+    n = 0;
+    long count = 0;
+    long bytes = 0;
+    for (alloc_counts* c = all_counts; c; c = c->next) {
+        for (int i = 0; i < c->cap; i++) {
+            alloc_site* s = &c->sites[i];
+            if (!s->count || !in_program(s->op)) continue;
+            alloc_row* row = &rows[n++];
+            row->op = s->op;
+            row->kind = s->kind;
+            row->count = s->count;
+            row->bytes = s->bytes;
+            row->age = 0;
+            count += s->count;
+            bytes += s->bytes;
+        }
+    }
+    n = merge_rows(rows, n);
+
+    fprintf(file, "%ld allocations, %ld bytes\n", count, bytes);
+    qsort(rows, n, sizeof(alloc_row), compare_counts);
+    write_rows(file, "by allocations", rows, n);
+    qsort(rows, n, sizeof(alloc_row), compare_bytes);
+    write_rows(file, "by bytes", rows, n);
+    free(rows);
+}
+
+void allocprof_stop(FILE* file)
+{
+    allocprof_on = 0;
+    if (interval > 0) {
+        GC_gcollect();
+        GC_invoke_finalizers();
+    }
+    pthread_mutex_lock(&lock);
+    if (program) {
+        write_counts(file);
+        if (slots) write_survivors(file, GC_get_gc_no());
+        release_program(program);
+        program = 0;
+    }
+    /* the finalizers of objects still tracked find no slots */
+    free(slots);
+    slots = 0;
+    slots_len = slots_max = 0;
+    free_slot = -1;
+    interval = 0;
+    for (alloc_counts* c = all_counts; c; c = c->next) {
+        free(c->sites);
+        c->sites = 0;
+        c->len = c->cap = 0;
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,54 @@
+#ifndef ALLOCPROF_H
+#define ALLOCPROF_H
+
+#include <stdio.h>
+#include "value.h"
+
+struct _pal_vm;
+struct _pal_program;
+
+/*
+ * The allocation profiler. Every value, tuple array and stack cell
+ * allocated is counted by the operation the VM running on the thread
+ * is executing and by its type. Optionally, one in ALLOCPROF_PERIOD
+ * allocations on average is tracked with a finalizer, to find the
+ * sites whose objects survive collections.
+ */
+
+/* the kinds of allocations besides values, which use their type */
+enum {
+    ALLOC_ARRAY = V_CHANNEL+1,
+    ALLOC_STACK,
+    ALLOC_KINDS
+};
+
+/* set while profiling, checked before each allocation is recorded */
+extern int allocprof_on;
+
+/* the VM running on this thread, whose operation allocates */
+extern _Thread_local struct _pal_vm* allocprof_vm;
+
+/*
+ * Starts counting allocations. If interval is positive, also tracks
+ * sampled objects and writes the sites of those surviving collections
+ * to report every interval seconds, at the first allocation after a
+ * collection.
+ */
+void allocprof_start(int interval, FILE* report);
+
+/*
+ * The program is run. Only allocations by the program run first are
+ * reported.
+ */
+void allocprof_run(struct _pal_program* program);
+
+void allocprof_record(void* obj, int kind, size_t size);
+
+/*
+ * Stops profiling and writes the sites that allocated the most objects
+ * and the most bytes to file, and if objects were tracked, the sites
+ * of those surviving a final collection.
+ */
+void allocprof_stop(FILE* file);
+
+#endif
@@ -1,8 +1,18 @@
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include <gc.h>
+#include "allocprof.h"
 #include "builtins.h"
+#include "coro.h"
 #include "stack.h"
 #include "error.h"
+#include "interpreter.h"
+#include "io.h"
+#include "map.h"
+#include "memo.h"
+#include "metrics.h"
+#include "pool.h"
 #include "strings.h"
 
 #define in(_V) value_rvalue(_V)
@@ -24,7 +34,18 @@ static inline value* is2(value* val, value_type type1, value_type type2)
         return make_value(V_FALSE);
 }
 
-static value* atom(value* val, stack* S, value* E)
+/*
+ * Returns the lvalue of element i (starting at 0) of a tuple or range.
+ */
+static value* element(value* T, int i)
+{
+    if (value_is_type(T, V_RANGE))
+        return range_element(T, i);
+    else
+        return value_tuple_val(T, i);
+}
+
+static value* atom(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     switch (value_type(val)) {
@@ -39,21 +60,46 @@ static value* atom(value* val, stack* S, value* E)
     }
 }
 
-static value* conc(value* val, stack* S, value* E)
+/*
+ * Chan n returns a channel buffering up to n values. Send on a full
+ * and Receive on an empty channel suspend the current coroutine.
+ */
+static value* chan(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_INTEGER) || value_integer(val) < 0) {
+        apply_error(vm, "Chan", val, 0);
+        return out(make_value(V_DUMMY));
+    }
+    value* C = make_value(V_CHANNEL);
+    C->v.channel = make_channel(value_integer(val));
+    return out(C);
+}
+
+static value* close_fn(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_INTEGER) || io_close(vm, value_integer(val)) < 0) {
+        apply_error(vm, "Close", val, 0);
+    }
+    return out(make_value(V_DUMMY));
+}
+
+static value* conc(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
-        apply_error("Conc", val, 0);
+        apply_error(vm, "Conc", val, 0);
         return out(make_string(""));
     }
     value* A = value_rvalue(value_tuple_val(val, 0));
     value* B = value_rvalue(value_tuple_val(val, 1));
     if (!value_is_type(A, V_STRING)) {
-        apply_error("Conc", val, 0);
+        apply_error(vm, "Conc", val, 0);
         return out(make_string(""));
     }
     if (!value_is_type(B, V_STRING)) {
-        apply_error("Conc", val, 0);
+        apply_error(vm, "Conc", val, 0);
         return out(make_string(""));
     }
     char* a = value_string(A);
@@ -67,61 +113,220 @@ static value* conc(value* val, stack* S, value* E)
     return out(make_string(s));
 }
 
-static value* cy(value* val, stack* S, value* E)
+static value* append(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "Append", val, 0);
+        return out(make_tuple(0));
+    }
+    value* A = range_tuple(value_rvalue(value_tuple_val(val, 0)));
+    value* B = range_tuple(value_rvalue(value_tuple_val(val, 1)));
+    if (!value_is_type(A, V_TUPLE) || !value_is_type(B, V_TUPLE)) {
+        apply_error(vm, "Append", val, 0);
+        return out(make_tuple(0));
+    }
+    int alen = value_tuple_size(A);
+    int blen = value_tuple_size(B);
+    value* R = make_tuple(alen+blen);
+    memcpy(&value_tuple_val(R, 0), &value_tuple_val(A, 0), alen*sizeof(value*));
+    memcpy(&value_tuple_val(R, alen), &value_tuple_val(B, 0), blen*sizeof(value*));
+    return out(R);
+}
+
+static value* cy(pal_vm* vm, value* val, stack* S, value* E)
 {
     return copy_value(val);
 }
 
-static value* isdummy(value* val, stack* S, value* E)
+static value* fill(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "Fill", val, 0);
+        return out(make_tuple(0));
+    }
+    value* N = value_rvalue(value_tuple_val(val, 0));
+    value* X = value_rvalue(value_tuple_val(val, 1));
+    if (!value_is_type(N, V_INTEGER)) {
+        apply_error(vm, "Fill", val, 0);
+        return out(make_tuple(0));
+    }
+    INTEGER n = value_integer(N);
+    if (n < 0) n = 0;
+    if (n > INT_MAX) {
+        runtime_error(vm, "%s", "Fill: too many elements");
+        return out(make_tuple(0));
+    }
+    value* R = make_tuple(n);
+    for (int i = 0; i < n; i++) {
+        value_tuple_val(R, i) = make_lvalue(X);
+    }
+    return out(R);
+}
+
+static value* filter(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "Filter", val, 0);
+        return out(make_tuple(0));
+    }
+    value* F = value_rvalue(value_tuple_val(val, 0));
+    value* T = value_rvalue(value_tuple_val(val, 1));
+    if (!value_is_tuple(T)) {
+        apply_error(vm, "Filter", val, 0);
+        return out(make_tuple(0));
+    }
+    int n = value_order(T);
+    value** values = GC_MALLOC((n+1)*sizeof(value*));
+    if (allocprof_on) allocprof_record(values, ALLOC_ARRAY, (n+1)*sizeof(value*));
+    int k = 0;
+    for (int i = 0; i < n; i++) {
+        value* x = element(T, i);
+        value* res = value_rvalue(call_closure(vm, F, x));
+        if (value_is_type(res, V_TRUE)) {
+            values[k++] = x;
+        }
+        else if (!value_is_type(res, V_FALSE)) {
+            runtime_error(vm, "%s", "Filter: predicate must yield a truthvalue");
+            return out(make_tuple(0));
+        }
+    }
+    value* R = make_tuple(k);
+    memcpy(&value_tuple_val(R, 0), values, k*sizeof(value*));
+    return out(R);
+}
+
+static value* fold(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 3) {
+        apply_error(vm, "Fold", val, 0);
+        return out(make_tuple(0));
+    }
+    value* F = value_rvalue(value_tuple_val(val, 0));
+    value* acc = value_tuple_val(val, 1);
+    value* T = value_rvalue(value_tuple_val(val, 2));
+    if (!value_is_tuple(T)) {
+        apply_error(vm, "Fold", val, 0);
+        return out(make_tuple(0));
+    }
+    /* f x1 (f x2 (... (f xn u))) */
+    for (int i = value_order(T)-1; i >= 0; i--) {
+        value* f = value_rvalue(call_closure(vm, F, element(T, i)));
+        acc = call_closure(vm, f, acc);
+    }
+    return out(in(acc));
+}
+
+/*
+ * Go f or Go (f, x) starts a coroutine evaluating f nil or f x. It
+ * runs when the current coroutine yields or blocks.
+ */
+static value* go(pal_vm* vm, value* val, stack* S, value* E)
+{
+    value* T = in(val);
+    value* F = T;
+    value* arg = make_lvalue(make_tuple(0));
+    if (value_is_type(T, V_TUPLE) && value_tuple_size(T) == 2) {
+        F = value_rvalue(value_tuple_val(T, 0));
+        arg = value_tuple_val(T, 1);
+    }
+    if (!value_is_type(F, V_CLOSURE)) {
+        apply_error(vm, "Go", T, 0);
+        return out(make_value(V_DUMMY));
+    }
+    coro_spawn(vm, F, arg);
+    return out(make_value(V_DUMMY));
+}
+
+static value* interval(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "Interval", val, 0);
+        return out(make_tuple(0));
+    }
+    value* A = value_rvalue(value_tuple_val(val, 0));
+    value* B = value_rvalue(value_tuple_val(val, 1));
+    if (!value_is_types(A, B, V_INTEGER)) {
+        apply_error(vm, "Interval", val, 0);
+        return out(make_tuple(0));
+    }
+    INTEGER a = value_integer(A);
+    INTEGER b = value_integer(B);
+    /* b-a may overflow, but not as an unsigned number */
+    if (b >= a && (uint64_t)b-(uint64_t)a >= INT_MAX) {
+        runtime_error(vm, "%s", "Interval: too many elements");
+        return out(make_tuple(0));
+    }
+    INTEGER n = b < a ? 0 : b-a+1;
+    value* R = make_tuple(n);
+    for (int i = 0; i < n; i++) {
+        value_tuple_val(R, i) = make_lvalue(make_integer(a+i));
+    }
+    return out(R);
+}
+
+static value* isdummy(pal_vm* vm, value* val, stack* S, value* E)
 {
     return out(is(in(val), V_DUMMY));
 }
 
-static value* isfunction(value* val, stack* S, value* E)
+static value* isfunction(pal_vm* vm, value* val, stack* S, value* E)
 {
-    return out(is2(in(val), V_CLOSURE, V_BUILTIN));
+    val = in(val);
+    if (value_is_type(val, V_MEMO))
+        return out(make_value(V_TRUE));
+    return out(is2(val, V_CLOSURE, V_BUILTIN));
 }
 
-static value* islabel(value* val, stack* S, value* E)
+static value* islabel(pal_vm* vm, value* val, stack* S, value* E)
 {
     return out(is(in(val), V_LABEL));
 }
 
-static value* isnumber(value* val, stack* S, value* E)
+static value* isnumber(pal_vm* vm, value* val, stack* S, value* E)
 {
     return out(is(in(val), V_INTEGER));
 }
 
-static value* isprogramclosure(value* val, stack* S, value* E)
+static value* isprogramclosure(pal_vm* vm, value* val, stack* S, value* E)
 {
     return out(is(in(val), V_CLOSURE));
 }
 
-static value* isreal(value* val, stack* S, value* E)
+static value* isreal(pal_vm* vm, value* val, stack* S, value* E)
 {
     return out(is(in(val), V_REAL));
 }
 
-static value* isstring(value* val, stack* S, value* E)
+static value* isstring(pal_vm* vm, value* val, stack* S, value* E)
 {
     return out(is(in(val), V_STRING));
 }
 
-static value* istruthvalue(value* val, stack* S, value* E)
+static value* istruthvalue(pal_vm* vm, value* val, stack* S, value* E)
 {
     return out(is2(in(val), V_FALSE, V_TRUE));
 }
 
-static value* istuple(value* val, stack* S, value* E)
+static value* istuple(pal_vm* vm, value* val, stack* S, value* E)
 {
-    return out(is(in(val), V_TUPLE));
+    return out(is2(in(val), V_TUPLE, V_RANGE));
 }
 
-static value* itor(value* val, stack* S, value* E)
+static value* ismap(pal_vm* vm, value* val, stack* S, value* E)
+{
+    return out(is(in(val), V_MAP));
+}
+
+static value* itor(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_INTEGER)) {
-        apply_error("ItoR", val, 0);
+        apply_error(vm, "ItoR", val, 0);
         return out(make_real(0));
     }
     else {
@@ -129,37 +334,37 @@ static value* itor(value* val, stack* S, value* E)
     }
 }
 
-static value* length(value* val, stack* S, value* E)
+static value* length(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     int n = 0;
-    if (value_is_type(val, V_TUPLE)) {
-        n = value_tuple_size(val);
+    if (value_is_tuple(val)) {
+        n = value_order(val);
     }
     else {
-        apply_error("Length", val, 0);
+        apply_error(vm, "Length", val, 0);
     }
     return out(make_integer(n));
 }
 
-static value* lookupinj(value* val, stack* S, value* E)
+static value* lookupinj(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
-        apply_error("LookupinJ", val, 0);
+        apply_error(vm, "LookupinJ", val, 0);
         return out(make_tuple(0));
     }
     value* A = value_rvalue(value_tuple_val(val, 0));
     value* B = value_rvalue(value_tuple_val(val, 1));
     if (!value_is_type(A, V_STRING)) {
-         apply_error("LookupinJ", val, 0);
+         apply_error(vm, "LookupinJ", val, 0);
         return out(make_tuple(0));
     }
     if (!value_is_type(B, V_JJ)) {
-         apply_error("LookupinJ", val, 0);
+         apply_error(vm, "LookupinJ", val, 0);
         return out(make_tuple(0));
     }
-    int n = string_to_ref_if_exists(value_string(A));
+    int n = string_to_ref_if_exists(vm->program->strings, value_string(A));
     if (n >= 0) {
         val = env_lookup(n, B->v.jj.env);
         if (val) return val;
@@ -167,10 +372,145 @@ static value* lookupinj(value* val, stack* S, value* E)
     return out(make_tuple(0));
 }
 
-static value* null(value* val, stack* S, value* E)
+/*
+ * Checks that val is a tuple of n elements with a map first and an
+ * atomic key second. Returns the map or 0.
+ */
+static value* map_args(pal_vm* vm, char* name, value* val, int n)
+{
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != n) {
+        apply_error(vm, name, val, 0);
+        return 0;
+    }
+    value* M = value_rvalue(value_tuple_val(val, 0));
+    value* K = value_rvalue(value_tuple_val(val, 1));
+    if (!value_is_type(M, V_MAP) || !map_keyable(K)) {
+        apply_error(vm, name, val, 0);
+        return 0;
+    }
+    return M;
+}
+
+static value* map_fn(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
-    if (value_is_type(val, V_TUPLE) && value_tuple_size(val) == 0)
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "Map", val, 0);
+        return out(make_tuple(0));
+    }
+    value* F = value_rvalue(value_tuple_val(val, 0));
+    value* T = value_rvalue(value_tuple_val(val, 1));
+    if (!value_is_tuple(T)) {
+        apply_error(vm, "Map", val, 0);
+        return out(make_tuple(0));
+    }
+    int n = value_order(T);
+    value* R = make_tuple(n);
+    for (int i = 0; i < n; i++) {
+        value* res = call_closure(vm, F, element(T, i));
+        value_tuple_val(R, i) = make_lvalue(value_rvalue(res));
+    }
+    return out(R);
+}
+
+static value* memo_fn(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    value* F = val;
+    int max = MEMO_DEFAULT_SIZE;
+    if (value_is_type(val, V_TUPLE) && value_tuple_size(val) == 2) {
+        F = value_rvalue(value_tuple_val(val, 0));
+        value* N = value_rvalue(value_tuple_val(val, 1));
+        if (!value_is_type(N, V_INTEGER)) {
+            apply_error(vm, "Memo", val, 0);
+            return out(make_tuple(0));
+        }
+        max = value_integer(N);
+    }
+    if (!value_is_type(F, V_CLOSURE) && !value_is_type(F, V_BUILTIN)
+        && !value_is_type(F, V_MEMO)) {
+        apply_error(vm, "Memo", val, 0);
+        return out(make_tuple(0));
+    }
+    return out(make_memo(F, max));
+}
+
+static value* newmap(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    int n = 0;
+    if (value_is_type(val, V_INTEGER))
+        n = value_integer(val);
+    else if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 0)
+        apply_error(vm, "NewMap", val, 0);
+    return out(make_map(n));
+}
+
+static value* mapget(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    value* M = map_args(vm, "MapGet", val, 2);
+    if (!M) return out(make_tuple(0));
+    value* res = map_get(M->v.map, value_rvalue(value_tuple_val(val, 1)));
+    if (!res) return out(make_tuple(0));
+    return out(res);
+}
+
+static value* mapput(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    value* M = map_args(vm, "MapPut", val, 3);
+    if (!M) return out(make_value(V_DUMMY));
+    map_put(M->v.map, value_rvalue(value_tuple_val(val, 1)),
+            value_rvalue(value_tuple_val(val, 2)));
+    return out(make_value(V_DUMMY));
+}
+
+static value* maphas(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    value* M = map_args(vm, "MapHas", val, 2);
+    if (!M) return out(make_value(V_FALSE));
+    if (map_get(M->v.map, value_rvalue(value_tuple_val(val, 1))))
+        return out(make_value(V_TRUE));
+    else
+        return out(make_value(V_FALSE));
+}
+
+static value* mapdel(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    value* M = map_args(vm, "MapDel", val, 2);
+    if (!M) return out(make_value(V_FALSE));
+    if (map_delete(M->v.map, value_rvalue(value_tuple_val(val, 1))))
+        return out(make_value(V_TRUE));
+    else
+        return out(make_value(V_FALSE));
+}
+
+static value* mapkeys(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_MAP)) {
+        apply_error(vm, "MapKeys", val, 0);
+        return out(make_tuple(0));
+    }
+    map* m = val->v.map;
+    value* R = make_tuple(m->size);
+    value* key;
+    void* v;
+    int i = 0;
+    int n = 0;
+    while ((i = map_next(m, i, &key, &v)) >= 0) {
+        value_tuple_val(R, n++) = make_lvalue(key);
+    }
+    return out(R);
+}
+
+static value* null(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (value_is_tuple(val) && value_order(val) == 0)
         return out(make_value(V_TRUE));
     else
         return out(make_value(V_FALSE));
@@ -198,8 +538,15 @@ void fprintval(FILE* file, value* val, int level, int quote)
         fprintf(file, "*builtin*");
         break;
     case V_CLOSURE:
+    case V_MEMO:
         fprintf(file, "*closure*");
         break;
+    case V_FUTURE:
+        fprintf(file, "*future*");
+        break;
+    case V_CHANNEL:
+        fprintf(file, "*channel*");
+        break;
     case V_DUMMY:
         fprintf(file, "*dummy*");
         break;
@@ -209,6 +556,42 @@ void fprintval(FILE* file, value* val, int level, int quote)
     case V_TUPLEMAKER:
         fprintf(file, "*tuple*");
         break;
+    case V_MAP: {
+        fprintf(file, "{");
+        if (level < 10) {
+            value* key;
+            void* v;
+            int i = 0;
+            int first = 1;
+            while ((i = map_next(val->v.map, i, &key, &v)) >= 0) {
+                if (!first) fprintf(file, ", ");
+                fprintval(file, key, level+1, quote);
+                fprintf(file, ": ");
+                fprintval(file, v, level+1, quote);
+                first = 0;
+            }
+        }
+        else {
+            fprintf(file, "...");
+        }
+        fprintf(file, "}");
+        break;
+    }
+    case V_RANGE: {
+        int n = value_range_size(val);
+        if (n == 0) {
+            fprintf(file, "nil");
+        }
+        else {
+            fprintf(file, "(");
+            for (int i = 0; i < n; i++) {
+                if (i > 0) fprintf(file, ", ");
+                fprintf(file, "%ld", value_range_val(val, i));
+            }
+            fprintf(file, ")");
+        }
+        break;
+    }
     case V_TUPLE: {
         int n = value_tuple_size(val);
         if (n == 0) {
@@ -269,13 +652,170 @@ void fprintval(FILE* file, value* val, int level, int quote)
     }
 }
 
-static value* print(value* val, stack* S, value* E)
+static value* open_fn(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_STRING)) {
+        apply_error(vm, "Open", val, 0);
+        return out(make_integer(-1));
+    }
+    int fd = io_open(vm, value_string(val));
+    if (fd < 0) runtime_error(vm, "%s %s", "cannot open", value_string(val));
+    return out(make_integer(fd));
+}
+
+typedef struct {
+    pal_vm* vm;
+    value* fn;
+    value* T;
+    value* R;
+    int from;
+    int to;
+} parmap_chunk;
+
+static void parmap_task(void* arg)
+{
+    parmap_chunk* c = arg;
+    for (int i = c->from; i < c->to; i++) {
+        value* res = call_closure(c->vm, c->fn, element(c->T, i));
+        value_tuple_val(c->R, i) = make_lvalue(value_rvalue(res));
+    }
+    metrics_add(c->vm);
+}
+
+/*
+ * Like Map, but the elements are evaluated in chunks on the worker
+ * pool. Side effects of f on shared lvalues are undefined.
+ */
+static value* parmap(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "ParMap", val, 0);
+        return out(make_tuple(0));
+    }
+    value* F = value_rvalue(value_tuple_val(val, 0));
+    value* T = value_rvalue(value_tuple_val(val, 1));
+    if (!value_is_tuple(T)) {
+        apply_error(vm, "ParMap", val, 0);
+        return out(make_tuple(0));
+    }
+    int n = value_order(T);
+    value* R = make_tuple(n);
+    /* a few chunks per thread to even out the load */
+    int chunks = pool_threads()*4;
+    if (chunks > n) chunks = n;
+    void** args = GC_MALLOC(chunks*sizeof(void*));
+    for (int i = 0; i < chunks; i++) {
+        parmap_chunk* c = GC_NEW(parmap_chunk);
+        c->vm = fork_vm(vm);
+        c->fn = F;
+        c->T = T;
+        c->R = R;
+        c->from = (long)n*i/chunks;
+        c->to = (long)n*(i+1)/chunks;
+        args[i] = c;
+    }
+    pool_run(parmap_task, args, chunks);
+    return out(R);
+}
+
+static void spawn_task(void* arg)
+{
+    value* F = arg;
+    value* res = call_closure(F->v.future.vm, F->v.future.fn, F->v.future.arg);
+    F->v.future.result = value_rvalue(res);
+    metrics_add(F->v.future.vm);
+    release_program(F->v.future.vm->program);
+    /* drop the references, the result is all that is needed now */
+    F->v.future.vm = 0;
+    F->v.future.fn = 0;
+    F->v.future.arg = 0;
+}
+
+/*
+ * Spawn (f, x) starts evaluating f x on the worker pool and returns a
+ * future for the result.
+ */
+static value* spawn(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "Spawn", val, 0);
+        return out(make_value(V_DUMMY));
+    }
+    value* F = make_value(V_FUTURE);
+    F->v.future.vm = fork_vm(vm);
+    /* the future may outlive vm */
+    retain_program(vm->program);
+    F->v.future.fn = value_rvalue(value_tuple_val(val, 0));
+    F->v.future.arg = value_tuple_val(val, 1);
+    F->v.future.result = 0;
+    F->v.future.task = pool_spawn(spawn_task, F);
+    return out(F);
+}
+
+/*
+ * Await f returns the result of the future f. While it is not
+ * available the thread runs other tasks instead of blocking.
+ */
+static value* await(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_FUTURE)) {
+        apply_error(vm, "Await", val, 0);
+        return out(make_value(V_DUMMY));
+    }
+    pool_wait(val->v.future.task);
+    return out(val->v.future.result);
+}
+
+/*
+ * Popen cmd runs the shell command cmd and returns a file descriptor
+ * for reading its output with Readln.
+ */
+static value* popen_fn(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_STRING)) {
+        apply_error(vm, "Popen", val, 0);
+        return out(make_integer(-1));
+    }
+    int fd = io_popen(vm, value_string(val));
+    if (fd < 0) runtime_error(vm, "%s %s", "cannot run", value_string(val));
+    return out(make_integer(fd));
+}
+
+static value* print(pal_vm* vm, value* val, stack* S, value* E)
 {
     fprintval(stdout, in(val), 0, 0);
     return out(make_value(V_DUMMY));
 }
 
-static value* readch(value* val, stack* S, value* E)
+static value* range(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "Range", val, 0);
+        return out(make_tuple(0));
+    }
+    value* A = value_rvalue(value_tuple_val(val, 0));
+    value* B = value_rvalue(value_tuple_val(val, 1));
+    if (!value_is_types(A, B, V_INTEGER)) {
+        apply_error(vm, "Range", val, 0);
+        return out(make_tuple(0));
+    }
+    INTEGER a = value_integer(A);
+    INTEGER b = value_integer(B);
+    if (b < a) return out(make_tuple(0));
+    if ((uint64_t)b-(uint64_t)a >= INT_MAX) {
+        runtime_error(vm, "%s", "Range: too many elements");
+        return out(make_tuple(0));
+    }
+    return out(make_range(a, b-a+1));
+}
+
+static value* readch(pal_vm* vm, value* val, stack* S, value* E)
 {
     int ch = fgetc(stdin);
     if (ch == EOF) return out(make_tuple(0));
@@ -284,21 +824,61 @@ static value* readch(value* val, stack* S, value* E)
     return out(make_string(s));
 }
 
-static value* rtoi(value* val, stack* S, value* E)
+/*
+ * Readln fd returns the next line of the file descriptor fd, or nil at
+ * the end. Only the current coroutine waits for the input.
+ */
+static value* readln(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    value* line = 0;
+    if (value_is_type(val, V_INTEGER)) line = io_readln(vm, value_integer(val));
+    if (!line) {
+        apply_error(vm, "Readln", val, 0);
+        return out(make_tuple(0));
+    }
+    return out(line);
+}
+
+static value* receive(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_CHANNEL)) {
+        apply_error(vm, "Receive", val, 0);
+        return out(make_tuple(0));
+    }
+    value* res = channel_receive(vm, val->v.channel);
+    return out(res ? res : make_value(V_DUMMY));
+}
+
+static value* rtoi(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_REAL)) {
-        apply_error("RtoI", val, 0);
+        apply_error(vm, "RtoI", val, 0);
         return out(make_integer(0));
     }
     return out(make_integer((INTEGER)value_real(val)));
 }
 
-static value* share(value* val, stack* S, value* E)
+static value* send(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2
+        || !value_is_type(value_rvalue(value_tuple_val(val, 0)), V_CHANNEL)) {
+        apply_error(vm, "Send", val, 0);
+        return out(make_value(V_DUMMY));
+    }
+    value* C = value_rvalue(value_tuple_val(val, 0));
+    channel_send(vm, C->v.channel, value_rvalue(value_tuple_val(val, 1)));
+    return out(make_value(V_DUMMY));
+}
+
+static value* share(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
-        apply_error("Share", val, 0);
+        apply_error(vm, "Share", val, 0);
         return out(make_value(V_FALSE));
     }
     if (value_tuple_val(val, 0) == value_tuple_val(val, 1))
@@ -307,17 +887,116 @@ static value* share(value* val, stack* S, value* E)
         return out(make_value(V_FALSE));
 }
 
-static value* stem(value* val, stack* S, value* E)
+/*
+ * Stable merge sort of the element lvalues in a[0..n-1] by their
+ * rvalues. less returns a positive number if x must precede y, 0 if
+ * not, and a negative number if x and y cannot be compared.
+ */
+typedef int (*less_fn)(pal_vm* vm, value* x, value* y, value* fn);
+
+static int merge_sort(pal_vm* vm, value** a, value** tmp, int n, less_fn less, value* fn)
+{
+    if (n < 2) return 1;
+    int m = n/2;
+    if (!merge_sort(vm, a, tmp, m, less, fn)) return 0;
+    if (!merge_sort(vm, a+m, tmp, n-m, less, fn)) return 0;
+    int c = less(vm, value_rvalue(a[m]), value_rvalue(a[m-1]), fn);
+    if (c < 0) return 0;
+    /* already in order */
+    if (c == 0) return 1;
+    memcpy(tmp, a, m*sizeof(value*));
+    int i = 0, j = m, k = 0;
+    while (i < m && j < n) {
+        /* take from the right half only if strictly less */
+        c = less(vm, value_rvalue(a[j]), value_rvalue(tmp[i]), fn);
+        if (c < 0) return 0;
+        if (c)
+            a[k++] = a[j++];
+        else
+            a[k++] = tmp[i++];
+    }
+    while (i < m) a[k++] = tmp[i++];
+    return 1;
+}
+
+static value* sort_tuple(pal_vm* vm, value* T, less_fn less, value* fn)
+{
+    int n = value_tuple_size(T);
+    value* R = make_tuple(n);
+    memcpy(&value_tuple_val(R, 0), &value_tuple_val(T, 0), n*sizeof(value*));
+    value** tmp = GC_MALLOC((n/2+1)*sizeof(value*));
+    if (allocprof_on) allocprof_record(tmp, ALLOC_ARRAY, (n/2+1)*sizeof(value*));
+    if (!merge_sort(vm, &value_tuple_val(R, 0), tmp, n, less, fn)) return 0;
+    return R;
+}
+
+static int compare_less(pal_vm* vm, value* x, value* y, value* fn)
+{
+    int c = value_compare(x, y);
+    if (c < -1) return -1;
+    return c < 0;
+}
+
+static int closure_less(pal_vm* vm, value* x, value* y, value* fn)
+{
+    value* f = value_rvalue(call_closure(vm, fn, make_lvalue(x)));
+    value* res = value_rvalue(call_closure(vm, f, make_lvalue(y)));
+    if (value_is_type(res, V_TRUE)) return 1;
+    if (value_is_type(res, V_FALSE)) return 0;
+    return -1;
+}
+
+static value* sort(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = range_tuple(in(val));
+    if (!value_is_type(val, V_TUPLE)) {
+        apply_error(vm, "Sort", val, 0);
+        return out(make_tuple(0));
+    }
+    value* R = sort_tuple(vm, val, compare_less, 0);
+    if (!R) {
+        apply_error(vm, "Sort", val, 0);
+        return out(make_tuple(0));
+    }
+    return out(R);
+}
+
+static value* sortby(pal_vm* vm, value* val, stack* S, value* E)
+{
+    val = in(val);
+    if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 2) {
+        apply_error(vm, "SortBy", val, 0);
+        return out(make_tuple(0));
+    }
+    value* F = value_rvalue(value_tuple_val(val, 0));
+    value* T = range_tuple(value_rvalue(value_tuple_val(val, 1)));
+    if (!value_is_type(F, V_CLOSURE) && !value_is_type(F, V_BUILTIN)) {
+        apply_error(vm, "SortBy", val, 0);
+        return out(make_tuple(0));
+    }
+    if (!value_is_type(T, V_TUPLE)) {
+        apply_error(vm, "SortBy", val, 0);
+        return out(make_tuple(0));
+    }
+    value* R = sort_tuple(vm, T, closure_less, F);
+    if (!R) {
+        runtime_error(vm, "%s", "SortBy: comparison must yield a truthvalue");
+        return out(make_tuple(0));
+    }
+    return out(R);
+}
+
+static value* stem(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_STRING)) {
-        apply_error("Stem", val, 0);
+        apply_error(vm, "Stem", val, 0);
         return out(make_string(""));
     }
     char* string = value_string(val);
     int len = strlen(string);
     if (len == 0) {
-        apply_error("Stem", val, 0);
+        apply_error(vm, "Stem", val, 0);
         return out(make_string(""));
     }
     char* s = GC_MALLOC(sizeof(char)*2);
@@ -326,17 +1005,17 @@ static value* stem(value* val, stack* S, value* E)
     return out(make_string(s));
 }
 
-static value* stern(value* val, stack* S, value* E)
+static value* stern(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_STRING)) {
-        apply_error("Stern", val, 0);
+        apply_error(vm, "Stern", val, 0);
         return out(make_string(""));
     }
     char* string = value_string(val);
     int len = strlen(string);
     if (len == 0) {
-        apply_error("Stern", val, 0);
+        apply_error(vm, "Stern", val, 0);
         return out(make_string(""));
     }
     char* s = GC_MALLOC(sizeof(char)*len);
@@ -344,11 +1023,11 @@ static value* stern(value* val, stack* S, value* E)
     return out(make_string(s));
 }
 
-static value* stoi(value* val, stack* S, value* E)
+static value* stoi(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_STRING)) {
-        apply_error("StoI", val, 0);
+        apply_error(vm, "StoI", val, 0);
         return out(make_integer(0));
     }
     char* s = value_string(val);
@@ -365,11 +1044,11 @@ static value* stoi(value* val, stack* S, value* E)
     return out(make_integer(n*sign));
 }
 
-static value* stor(value* val, stack* S, value* E)
+static value* stor(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_STRING)) {
-        apply_error("StoR", val, 0);
+        apply_error(vm, "StoR", val, 0);
         return out(make_real(0));
     }
     char* s = value_string(val);
@@ -402,15 +1081,15 @@ static value* stor(value* val, stack* S, value* E)
     return out(make_real(n*sign));
 }
 
-static value* swing(value* val, stack* S, value* E)
+static value* swing(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_TUPLE) || value_tuple_size(val) != 3) {
         goto ERROR;
     }
 
-    value* A = value_rvalue(value_tuple_val(val, 0));
-    if (!value_is_type(val, V_TUPLE)) goto ERROR;
+    value* A = range_tuple(value_rvalue(value_tuple_val(val, 0)));
+    if (!value_is_type(A, V_TUPLE)) goto ERROR;
     int size = value_tuple_size(A);
 
     value* N = value_rvalue(value_tuple_val(val, 1));
@@ -429,15 +1108,15 @@ static value* swing(value* val, stack* S, value* E)
     return out(R);
 
     ERROR:
-    apply_error("Swing", val, 0);
+    apply_error(vm, "Swing", val, 0);
     return out(make_tuple(0));
 }
 
-static value* tuple(value* val, stack* S, value* E)
+static value* tuple(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
     if (!value_is_type(val, V_INTEGER)) {
-        apply_error("Tuple", val, 0);
+        apply_error(vm, "Tuple", val, 0);
         return out(make_tuple(0));
     }
     int n = value_integer(val);
@@ -445,18 +1124,21 @@ static value* tuple(value* val, stack* S, value* E)
     if (n == 0) {
         return out(make_tuple(0));
     }
-    val = make_value(V_TUPLEMAKER);
-    val->v.tuplemaker.len = n;
-    val->v.tuplemaker.n = 0;
-    val->v.tuplemaker.values = GC_MALLOC(n*sizeof(value*));
-    return out(val);
+    return out(make_tuplemaker(n));
 }
 
-static value* write(value* val, stack* S, value* E)
+static value* write(pal_vm* vm, value* val, stack* S, value* E)
 {
     val = in(val);
+    if (value_is_type(val, V_RANGE)) {
+        int n = value_range_size(val);
+        for (int i = 0; i < n; i++) {
+            fprintf(stdout, "%ld", value_range_val(val, i));
+        }
+        return out(make_value(V_DUMMY));
+    }
     if (!value_is_type(val, V_TUPLE)) {
-        fprintval(stdout, in(val), 0, 0);
+        fprintval(stdout, val, 0, 0);
         return out(make_value(V_DUMMY));
     }
 
@@ -468,15 +1150,34 @@ static value* write(value* val, stack* S, value* E)
     return out(make_value(V_DUMMY));
 }
 
+/*
+ * Yield lets the other coroutines run. It has no effect within a
+ * function called by a builtin.
+ */
+static value* yield(pal_vm* vm, value* val, stack* S, value* E)
+{
+    if (coro_can_block(vm)) coro_yield(vm);
+    return out(make_value(V_DUMMY));
+}
+
 builtin builtins[] = {
+    { "Append", &append },
     { "Atom", &atom },
+    { "Await", &await },
+    { "Chan", &chan },
+    { "Close", &close_fn },
     { "Conc", &conc },
     { "Cy", &cy },
+    { "Fill", &fill },
+    { "Filter", &filter },
+    { "Fold", &fold },
+    { "Go", &go },
     { "Isboolean", &istruthvalue },
     { "Isdummy", &isdummy },
     { "Isfunction", &isfunction },
     { "Isinteger", &isnumber },
     { "Islabel", &islabel },
+    { "Ismap", &ismap },
     { "Isnumber", &isnumber },
     { "Isprogramclosure", &isprogramclosure },
     { "Isreal", &isreal },
@@ -484,15 +1185,34 @@ builtin builtins[] = {
     { "Istruthvalue", &istruthvalue },
     { "Istuple", &istuple },
     { "ItoR", &itor },
+    { "Interval", &interval },
     { "Length", &length },
     { "LookupinJ", &lookupinj },
+    { "Map", &map_fn },
+    { "MapDel", &mapdel },
+    { "MapGet", &mapget },
+    { "MapHas", &maphas },
+    { "MapKeys", &mapkeys },
+    { "MapPut", &mapput },
+    { "Memo", &memo_fn },
+    { "NewMap", &newmap },
     { "Null", &null },
+    { "Open", &open_fn },
     { "Order", &length },
+    { "ParMap", &parmap },
+    { "Popen", &popen_fn },
     { "Pr", &print },
     { "Print", &print },
+    { "Range", &range },
     { "Readch", &readch },
+    { "Readln", &readln },
+    { "Receive", &receive },
     { "RtoI", &rtoi },
+    { "Send", &send },
     { "Share", &share },
+    { "Sort", &sort },
+    { "SortBy", &sortby },
+    { "Spawn", &spawn },
     { "Stem", &stem },
     { "Stern", &stern },
     { "StoI", &stoi },
@@ -500,5 +1220,25 @@ builtin builtins[] = {
     { "Swing", &swing },
     { "Tuple", &tuple },
     { "Write", &write },
+    { "Yield", &yield },
     { 0, 0 }
 };
+
+static builtin no_builtins[] = { { 0, 0 } };
+
+builtin* extra_builtins = no_builtins;
+
+static int extra_builtins_len = 0;
+
+void register_builtin(char* name, builtin_fn fn)
+{
+    builtin* b = malloc((extra_builtins_len+2)*sizeof(builtin));
+    memcpy(b, extra_builtins, extra_builtins_len*sizeof(builtin));
+    b[extra_builtins_len].name = strdup(name);
+    b[extra_builtins_len].fn = fn;
+    extra_builtins_len++;
+    b[extra_builtins_len].name = 0;
+    b[extra_builtins_len].fn = 0;
+    /* the old table is not freed, a VM may be reading it */
+    extra_builtins = b;
+}
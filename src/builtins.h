@@ -13,4 +13,15 @@ void fprintval(FILE* stderr, value* value, int level, int quote);
 
 extern builtin builtins[];
 
+/*
+ * Builtins added by register_builtin, terminated like builtins.
+ */
+extern builtin* extra_builtins;
+
+/*
+ * Adds a builtin to the environment of VMs created afterwards. A
+ * builtin with the name of an existing one replaces it.
+ */
+void register_builtin(char* name, builtin_fn fn);
+
 #endif
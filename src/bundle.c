@@ -0,0 +1,157 @@
+#define _XOPEN_SOURCE 700
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bundle.h"
+#include "code.h"
+
+#define BUNDLE_MAGIC "PAL70BND"
+
+#define BUNDLE_LAZY 1
+
+/*
+ * The last bytes of a bundle. It is only read by the executable that
+ * wrote it, so it is in the native byte order.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t offset;
+    uint64_t len;
+    uint32_t flags;
+    uint32_t unused;
+} trailer;
+
+/*
+ * Reads the trailer of the executable open as fd. Returns 0 if it is
+ * not a bundle.
+ */
+static int read_trailer(int fd, trailer* t)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(trailer)) return 0;
+    if (pread(fd, t, sizeof(trailer), st.st_size-sizeof(trailer)) != sizeof(trailer))
+        return 0;
+    return memcmp(t->magic, BUNDLE_MAGIC, 8) == 0 &&
+        t->offset+t->len+sizeof(trailer) == st.st_size;
+}
+
+const unsigned char* bundled_pocode(size_t* len, int* lazy)
+{
+    int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0) return 0;
+    trailer t;
+    if (!read_trailer(fd, &t)) {
+        close(fd);
+        return 0;
+    }
+    void* pocode = mmap(0, t.len, PROT_READ, MAP_PRIVATE, fd, t.offset);
+    close(fd);
+    if (pocode == MAP_FAILED) return 0;
+    *len = t.len;
+    *lazy = (t.flags&BUNDLE_LAZY) != 0;
+    return pocode;
+}
+
+static int write_all(int fd, const void* buf, size_t len)
+{
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0) return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/*
+ * Reads a whole file into a malloc'ed buffer.
+ */
+static unsigned char* read_file(char* file_name, size_t* len)
+{
+    FILE* file = fopen(file_name, "r");
+    if (!file) return 0;
+    size_t max = 65536;
+    unsigned char* buf = malloc(max);
+    *len = 0;
+    size_t n;
+    while ((n = fread(buf+*len, 1, max-*len, file)) > 0) {
+        *len += n;
+        if (*len == max) {
+            max *= 2;
+            buf = realloc(buf, max);
+        }
+    }
+    fclose(file);
+    return buf;
+}
+
+int bundle(char* prg, char* pocode_file_name, char* output_file_name, int lazy)
+{
+    size_t pocode_len;
+    unsigned char* pocode = read_file(pocode_file_name, &pocode_len);
+    if (!pocode) {
+        perror(prg);
+        return 1;
+    }
+    int code_len;
+    char** files;
+    int files_len;
+    if (!decode_code(pocode, pocode_len, &code_len, &files, &files_len)) {
+        fprintf(stderr, "%s: error reading %s\n", prg, pocode_file_name);
+        return 1;
+    }
+
+    int exe = open("/proc/self/exe", O_RDONLY);
+    if (exe < 0) {
+        perror(prg);
+        return 1;
+    }
+    /* a bundle is made from the interpreter part of a bundle */
+    struct stat st;
+    fstat(exe, &st);
+    trailer t;
+    off_t exe_len = read_trailer(exe, &t) ? t.offset : st.st_size;
+
+    int out = open(output_file_name, O_WRONLY|O_CREAT|O_TRUNC, 0755);
+    if (out < 0) {
+        perror(prg);
+        return 1;
+    }
+    char buf[65536];
+    off_t done = 0;
+    while (done < exe_len) {
+        size_t want = exe_len-done < sizeof(buf) ? exe_len-done : sizeof(buf);
+        ssize_t n = pread(exe, buf, want, done);
+        if (n <= 0 || !write_all(out, buf, n)) {
+            perror(prg);
+            return 1;
+        }
+        done += n;
+    }
+    close(exe);
+
+    /* the pocode starts at a page boundary, so that it can be mapped */
+    long page = sysconf(_SC_PAGESIZE);
+    off_t offset = (exe_len+page-1)/page*page;
+    memset(buf, 0, sizeof(buf));
+    memset(&t, 0, sizeof(t));
+    memcpy(t.magic, BUNDLE_MAGIC, 8);
+    t.offset = offset;
+    t.len = pocode_len;
+    t.flags = lazy ? BUNDLE_LAZY : 0;
+    if (!write_all(out, buf, offset-exe_len) ||
+        !write_all(out, pocode, pocode_len) ||
+        !write_all(out, &t, sizeof(t)) ||
+        close(out) != 0) {
+        perror(prg);
+        return 1;
+    }
+    free(pocode);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stddef.h>
+
+/*
+ * Standalone executables. A bundle is a copy of the pal70 executable
+ * followed by the pocode of a program, starting at a page boundary,
+ * and a trailer locating it. At startup, the bundle maps the pocode
+ * read-only and runs it in place.
+ */
+
+/*
+ * Writes a bundle of the running executable and the pocode file. If
+ * lazy is set, the bundle decodes function bodies lazily.
+ */
+int bundle(char* prg, char* pocode_file_name, char* output_file_name, int lazy);
+
+/*
+ * The pocode bundled with the running executable, or 0 if it is not a
+ * bundle.
+ */
+const unsigned char* bundled_pocode(size_t* len, int* lazy);
+
+#endif
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+#include "config.h"
+
+/* 64-bit FNV-1a */
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static uint64_t hash_bytes(uint64_t h, const void* buf, size_t len)
+{
+    const unsigned char* p = buf;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+static uint64_t hash_size(uint64_t h, size_t len)
+{
+    uint64_t n = len;
+    return hash_bytes(h, &n, sizeof(n));
+}
+
+static uint64_t hash_file(uint64_t h, FILE* file)
+{
+    char buf[65536];
+    size_t n;
+    size_t len = 0;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        h = hash_bytes(h, buf, n);
+        len += n;
+    }
+    return hash_size(h, len);
+}
+
+typedef struct {
+    uint64_t h;
+    int found;
+    /* the file of the object containing the compiler */
+    const char* file;
+} compiler_id;
+
+/*
+ * Hashes the GNU build id of the object that contains this code, the
+ * executable or libpal70.so, and notes its file.
+ */
+static int hash_build_id(struct dl_phdr_info* info, size_t size, void* data)
+{
+    compiler_id* id = data;
+    uintptr_t self = (uintptr_t)&hash_build_id;
+    int contains = 0;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* p = &info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr+p->p_vaddr;
+        if (p->p_type == PT_LOAD && self >= start && self < start+p->p_memsz) contains = 1;
+    }
+    if (!contains) return 0;
+    id->file = info->dlpi_name[0] ? info->dlpi_name : "/proc/self/exe";
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* p = &info->dlpi_phdr[i];
+        if (p->p_type != PT_NOTE) continue;
+        char* note = (char*)(info->dlpi_addr+p->p_vaddr);
+        char* end = note+p->p_memsz;
+        while (note+sizeof(ElfW(Nhdr)) <= end) {
+            ElfW(Nhdr)* n = (ElfW(Nhdr)*)note;
+            char* name = note+sizeof(ElfW(Nhdr));
+            char* desc = name+((n->n_namesz+3) & ~3);
+            if (n->n_type == NT_GNU_BUILD_ID && n->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+                id->h = hash_bytes(id->h, desc, n->n_descsz);
+                id->found = 1;
+                return 1;
+            }
+            note = desc+((n->n_descsz+3) & ~3);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Hashes the pocode version and the compiler, so that a rebuilt
+ * compiler does not use the pocode of another build. The build id
+ * identifies the compiler; without one its file is hashed instead.
+ */
+static uint64_t hash_compiler(uint64_t h)
+{
+    h = hash_size(h, POCODE_VERSION);
+    compiler_id id = { h, 0, 0 };
+    dl_iterate_phdr(hash_build_id, &id);
+    if (id.found) return id.h;
+    FILE* file = id.file ? fopen(id.file, "r") : 0;
+    if (!file) return h;
+    h = hash_file(h, file);
+    fclose(file);
+    return h;
+}
+
+/*
+ * Creates the directory and its parents.
+ */
+static int make_dir(char* dir)
+{
+    for (char* p = dir+1; *p; p++) {
+        if (*p != '/') continue;
+        *p = 0;
+        int ok = mkdir(dir, 0755) == 0 || errno == EEXIST;
+        *p = '/';
+        if (!ok) return 0;
+    }
+    return mkdir(dir, 0755) == 0 || errno == EEXIST;
+}
+
+char* cache_dir()
+{
+    char* dir;
+    char* env = getenv("PAL70_CACHE");
+    if (env && *env) {
+        dir = strdup(env);
+    }
+    else {
+        char* base = getenv("XDG_CACHE_HOME");
+        char* suffix = "/pal70";
+        if (!base || !*base) {
+            base = getenv("HOME");
+            suffix = "/.cache/pal70";
+        }
+        if (!base || !*base) return 0;
+        dir = malloc(strlen(base)+strlen(suffix)+1);
+        strcpy(dir, base);
+        strcat(dir, suffix);
+    }
+    if (!make_dir(dir)) {
+        free(dir);
+        return 0;
+    }
+    return dir;
+}
+
+char* cache_file_name(char* dir, char** file_names, int n)
+{
+    uint64_t h = FNV_OFFSET;
+    h = hash_compiler(h);
+    for (int i = 0; i < n; i++) {
+        /* the names are part of the pocode, for runtime errors */
+        h = hash_bytes(h, file_names[i], strlen(file_names[i])+1);
+        FILE* file = fopen(file_names[i], "r");
+        if (!file) return 0;
+        h = hash_file(h, file);
+        fclose(file);
+    }
+    char* name = malloc(strlen(dir)+32);
+    sprintf(name, "%s/%016llx.pocode", dir, (unsigned long long)h);
+    return name;
+}
+
+int cache_store(char* file_name, char* pocode, size_t len)
+{
+    char* tmp_name = malloc(strlen(file_name)+8);
+    sprintf(tmp_name, "%s.XXXXXX", file_name);
+    int fd = mkstemp(tmp_name);
+    if (fd < 0) {
+        free(tmp_name);
+        return 0;
+    }
+    FILE* file = fdopen(fd, "w");
+    int ok = fwrite(pocode, 1, len, file) == len;
+    ok = fclose(file) == 0 && ok;
+    /* mkstemp creates the file for the owner only */
+    ok = ok && chmod(tmp_name, 0644) == 0;
+    ok = ok && rename(tmp_name, file_name) == 0;
+    if (!ok) unlink(tmp_name);
+    free(tmp_name);
+    return ok;
+}
@@ -0,0 +1,30 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+
+/*
+ * A directory of compiled pocode, keyed by a hash of the pocode
+ * version, the build of the compiler and the names and contents of
+ * the source files, so that running unchanged sources skips their
+ * compilation.
+ */
+
+/*
+ * The cache directory: $PAL70_CACHE, else pal70 in $XDG_CACHE_HOME or
+ * in ~/.cache. It is created if needed. Returns 0 if there is none.
+ */
+char* cache_dir();
+
+/*
+ * The cache file of the sources. Returns 0 if a source cannot be read.
+ */
+char* cache_file_name(char* dir, char** file_names, int n);
+
+/*
+ * Writes the pocode to the cache file, atomically, so that concurrent
+ * runs never see a partial file. Returns 0 on failure.
+ */
+int cache_store(char* file_name, char* pocode, size_t len);
+
+#endif
@@ -0,0 +1,516 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "callprof.h"
+#include "code.h"
+#include "gc.h"
+#include "interpreter.h"
+#include "profile.h"
+
+/* the rows of the table */
+#define CALLPROF_ROWS 30
+
+typedef enum {
+    CALL_MAIN,
+    CALL_CLOSURE,
+    CALL_BUILTIN,
+    CALL_INDEX
+} call_kind;
+
+/*
+ * A function, keyed by its kind and the pc of its body or the name of
+ * the builtin, or a call, keyed by the caller, the pc of the
+ * application and the callee. Times are in nanoseconds. Only the
+ * outermost activation of a recursive function counts for the
+ * inclusive time.
+ */
+typedef struct {
+    long key[3];
+    char* name;
+    long count;
+    long incl;
+    long self;
+    int active;
+} call_rec;
+
+typedef struct {
+    call_rec* recs;
+    int len;
+    int max;
+    /* the record index+1 of each slot */
+    int* index;
+    int index_cap;
+} call_table;
+
+/* the counts of one thread */
+typedef struct _call_counts {
+    call_table fns;
+    call_table edges;
+    struct _call_counts* next;
+} call_counts;
+
+typedef struct _call_entry {
+    /* the function record, or -1 for a block */
+    int fn;
+    /* the entry of the innermost function, this one for a function */
+    int func;
+    int site;
+    /* the frame saved by the SAVE, 0 for a builtin or the main program */
+    value* frame;
+    long start;
+    /* the inclusive time of the functions called */
+    long child;
+    /* tasks_time at the start, and the part of it within the functions called */
+    long tasks;
+    long child_tasks;
+} call_entry;
+
+int callprof_on = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static call_counts* all_counts = 0;
+static _Thread_local call_counts* counts = 0;
+/*
+ * The time of the tasks run by this thread while it waited for others,
+ * which does not count for the function waiting.
+ */
+static _Thread_local long tasks_time = 0;
+static pal_program* program = 0;
+
+static long now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1000000000L + t.tv_nsec;
+}
+
+static unsigned long hash_key(long a, long b, long c)
+{
+    unsigned long h = 14695981039346656037UL;
+    h = (h ^ (unsigned long)a) * 1099511628211UL;
+    h = (h ^ (unsigned long)b) * 1099511628211UL;
+    h = (h ^ (unsigned long)c) * 1099511628211UL;
+    return h ^ (h >> 29);
+}
+
+static void index_rec(call_table* t, int i)
+{
+    call_rec* r = &t->recs[i];
+    unsigned long j = hash_key(r->key[0], r->key[1], r->key[2]) & (t->index_cap-1);
+    while (t->index[j]) j = (j+1) & (t->index_cap-1);
+    t->index[j] = i+1;
+}
+
+/*
+ * Returns the record with the key, adding it if new.
+ */
+static call_rec* table_find(call_table* t, long a, long b, long c)
+{
+    if (2*(t->len+1) > t->index_cap) {
+        free(t->index);
+        t->index_cap = t->index_cap ? 2*t->index_cap : 256;
+        t->index = calloc(t->index_cap, sizeof(int));
+        for (int i = 0; i < t->len; i++) index_rec(t, i);
+    }
+    unsigned long j = hash_key(a, b, c) & (t->index_cap-1);
+    while (t->index[j]) {
+        call_rec* r = &t->recs[t->index[j]-1];
+        if (r->key[0] == a && r->key[1] == b && r->key[2] == c) return r;
+        j = (j+1) & (t->index_cap-1);
+    }
+    if (t->len == t->max) {
+        t->max = t->max ? 2*t->max : 128;
+        t->recs = realloc(t->recs, t->max*sizeof(call_rec));
+    }
+    call_rec* r = &t->recs[t->len];
+    memset(r, 0, sizeof(call_rec));
+    r->key[0] = a;
+    r->key[1] = b;
+    r->key[2] = c;
+    t->index[j] = ++t->len;
+    return r;
+}
+
+static call_counts* thread_counts()
+{
+    if (!counts) {
+        counts = calloc(1, sizeof(call_counts));
+        pthread_mutex_lock(&lock);
+        counts->next = all_counts;
+        all_counts = counts;
+        pthread_mutex_unlock(&lock);
+    }
+    return counts;
+}
+
+static call_stack* stack_of(pal_vm* vm)
+{
+    /* that of a task is made when it first applies a closure */
+    if (!vm->calls) {
+        vm->calls = GC_NEW(call_stack);
+        vm->calls->pending = -1;
+        vm->calls->task = 1;
+    }
+    return vm->calls;
+}
+
+static call_entry* push_entry(call_stack* cs)
+{
+    if (cs->len == cs->max) {
+        cs->max = cs->max ? 2*cs->max : 64;
+        cs->entries = GC_REALLOC(cs->entries, cs->max*sizeof(call_entry));
+    }
+    call_entry* e = &cs->entries[cs->len];
+    e->func = cs->len > 0 ? cs->entries[cs->len-1].func : -1;
+    cs->len++;
+    return e;
+}
+
+static void enter(call_stack* cs, call_kind kind, long key, char* name, int site, value* frame)
+{
+    call_counts* c = thread_counts();
+    call_rec* f = table_find(&c->fns, kind, key, 0);
+    f->name = name;
+    f->count++;
+    f->active++;
+    int fn = f-c->fns.recs;
+    call_entry* e = push_entry(cs);
+    e->fn = fn;
+    e->func = cs->len-1;
+    e->site = site;
+    e->frame = frame;
+    e->child = 0;
+    e->tasks = tasks_time;
+    e->child_tasks = 0;
+    e->start = now();
+}
+
+/*
+ * The innermost function of the stack, or -1.
+ */
+static int current_fn(call_stack* cs)
+{
+    if (cs->len == 0 || cs->entries[cs->len-1].func < 0) return -1;
+    return cs->entries[cs->entries[cs->len-1].func].fn;
+}
+
+static void leave_top(call_stack* cs)
+{
+    call_entry* e = &cs->entries[--cs->len];
+    if (e->fn < 0) return;
+    long incl = now()-e->start;
+    long tasks = tasks_time-e->tasks;
+    call_counts* c = thread_counts();
+    call_rec* f = &c->fns.recs[e->fn];
+    f->self += incl-e->child-(tasks-e->child_tasks);
+    int outermost = --f->active == 0;
+    if (outermost) f->incl += incl;
+    if (cs->len > 0 && cs->entries[cs->len-1].func >= 0) {
+        call_entry* caller = &cs->entries[cs->entries[cs->len-1].func];
+        caller->child += incl;
+        caller->child_tasks += tasks;
+    }
+    else if (cs->len == 0 && cs->task) {
+        tasks_time += incl-tasks;
+    }
+    call_rec* call = table_find(&c->edges, current_fn(cs), e->site, e->fn);
+    call->count++;
+    if (outermost) call->incl += incl;
+}
+
+void callprof_start()
+{
+    callprof_on = 1;
+}
+
+call_stack* callprof_new_stack(pal_vm* vm, int pc, int site)
+{
+    call_stack* cs = GC_NEW(call_stack);
+    cs->pending = -1;
+    if (pc >= 0) {
+        cs->pending = pc;
+        cs->pending_site = site;
+        return cs;
+    }
+    pthread_mutex_lock(&lock);
+    if (!program) {
+        program = vm->program;
+        retain_program(program);
+    }
+    pthread_mutex_unlock(&lock);
+    enter(cs, CALL_MAIN, 0, 0, 0, 0);
+    return cs;
+}
+
+void callprof_suspend(call_stack* cs)
+{
+    cs->suspended = now();
+}
+
+void callprof_resume(call_stack* cs)
+{
+    if (!cs->suspended) return;
+    long t = now()-cs->suspended;
+    for (int i = 0; i < cs->len; i++) cs->entries[i].start += t;
+    cs->suspended = 0;
+}
+
+void callprof_call(pal_vm* vm, int pc, int site)
+{
+    call_stack* cs = stack_of(vm);
+    cs->pending = pc;
+    cs->pending_site = site;
+}
+
+void callprof_builtin(pal_vm* vm, char* name, int site)
+{
+    enter(stack_of(vm), CALL_BUILTIN, (long)name, name, site, 0);
+}
+
+void callprof_leave(pal_vm* vm)
+{
+    leave_top(vm->calls);
+}
+
+void callprof_index(pal_vm* vm, int site)
+{
+    call_stack* cs = stack_of(vm);
+    call_counts* c = thread_counts();
+    call_rec* f = table_find(&c->fns, CALL_INDEX, 0, 0);
+    f->count++;
+    table_find(&c->edges, current_fn(cs), site, f-c->fns.recs)->count++;
+}
+
+void callprof_save(pal_vm* vm, value* frame)
+{
+    call_stack* cs = stack_of(vm);
+    if (cs->pending >= 0) {
+        enter(cs, CALL_CLOSURE, cs->pending, 0, cs->pending_site, frame);
+        cs->pending = -1;
+    }
+    else {
+        call_entry* e = push_entry(cs);
+        e->fn = -1;
+        e->frame = frame;
+    }
+}
+
+void callprof_return(pal_vm* vm, value* frame)
+{
+    call_stack* cs = vm->calls;
+    if (!cs) return;
+    /* the frames of an interpret are above its builtin */
+    for (int i = cs->len-1; i >= 0 && cs->entries[i].frame; i--) {
+        if (cs->entries[i].frame == frame) {
+            while (cs->len > i) leave_top(cs);
+            return;
+        }
+    }
+}
+
+void callprof_unwind(pal_vm* vm, stack* S)
+{
+    call_stack* cs = vm->calls;
+    if (!cs) return;
+    int base = cs->len;
+    while (base > 0 && cs->entries[base-1].frame) base--;
+    /* the innermost frame left on the stack */
+    for (; S; S = S->next) {
+        value* v = S->value;
+        if (!v || !value_is_type(v, V_STACK)) continue;
+        for (int i = cs->len-1; i >= base; i--) {
+            if (cs->entries[i].frame == v) {
+                while (cs->len > i+1) leave_top(cs);
+                return;
+            }
+        }
+    }
+    while (cs->len > base) leave_top(cs);
+}
+
+void callprof_finish(pal_vm* vm)
+{
+    call_stack* cs = vm->calls;
+    if (!cs) return;
+    while (cs->len > 0) leave_top(cs);
+}
+
+/*
+ * The counts of all threads, with caller and callee of the calls
+ * indexing the functions of the result.
+ */
+static call_counts* merge_counts()
+{
+    call_counts* total = calloc(1, sizeof(call_counts));
+    for (call_counts* c = all_counts; c; c = c->next) {
+        int* map = malloc((c->fns.len+1)*sizeof(int));
+        for (int i = 0; i < c->fns.len; i++) {
+            call_rec* r = &c->fns.recs[i];
+            call_rec* t = table_find(&total->fns, r->key[0], r->key[1], r->key[2]);
+            map[i] = t-total->fns.recs;
+            t->name = r->name;
+            t->count += r->count;
+            t->incl += r->incl;
+            t->self += r->self;
+        }
+        for (int i = 0; i < c->edges.len; i++) {
+            call_rec* r = &c->edges.recs[i];
+            long caller = r->key[0] < 0 ? -1 : map[r->key[0]];
+            call_rec* t = table_find(&total->edges, caller, r->key[1], map[r->key[2]]);
+            t->count += r->count;
+            t->incl += r->incl;
+        }
+        free(map);
+    }
+    return total;
+}
+
+static void free_table(call_table* t)
+{
+    free(t->recs);
+    free(t->index);
+}
+
+/*
+ * The FORMCLOSURE of the closure with body pc, or -2 if the code is
+ * not that of a lambda expression.
+ */
+static int closure_site(int pc)
+{
+    operation* ops = program->ops;
+    if (pc >= 4 && ops[pc-4].op == OP_FORMCLOSURE && ops[pc-3].args.n == pc) return pc-4;
+    return -2;
+}
+
+static void print_name(FILE* file, call_rec* f)
+{
+    switch (f->key[0]) {
+    case CALL_MAIN:
+        fprintf(file, "main");
+        break;
+    case CALL_CLOSURE: {
+        int site = closure_site(f->key[1]);
+        if (site >= 0) {
+            profile_print_function(file, program, site);
+        }
+        else {
+            operation* op = &program->ops[f->key[1]];
+            fprintf(file, "lambda (%s:%d)", op->file, op->line);
+        }
+        break;
+    }
+    case CALL_BUILTIN:
+        fprintf(file, "%s", f->name);
+        break;
+    case CALL_INDEX:
+        fprintf(file, "[index]");
+        break;
+    }
+}
+
+/*
+ * The file and line a function is defined at, for callgrind.
+ */
+static char* position(call_rec* f, int* line)
+{
+    operation* op = 0;
+    if (f->key[0] == CALL_CLOSURE) {
+        int site = closure_site(f->key[1]);
+        op = &program->ops[site >= 0 ? site : f->key[1]];
+    }
+    else if (f->key[0] == CALL_MAIN && program->len > 0) {
+        op = &program->ops[0];
+    }
+    *line = op ? op->line : 0;
+    return op ? op->file : "[builtin]";
+}
+
+static call_rec* sorted_fns;
+
+static int compare_self(const void* a, const void* b)
+{
+    call_rec* x = &sorted_fns[*(int*)a];
+    call_rec* y = &sorted_fns[*(int*)b];
+    if (x->self != y->self) return x->self < y->self ? 1 : -1;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return 0;
+}
+
+static void write_table(FILE* file, call_counts* total)
+{
+    call_table* fns = &total->fns;
+    long sum = 0;
+    int* order = malloc((fns->len+1)*sizeof(int));
+    for (int i = 0; i < fns->len; i++) {
+        order[i] = i;
+        sum += fns->recs[i].self;
+    }
+    sorted_fns = fns->recs;
+    qsort(order, fns->len, sizeof(int), compare_self);
+
+    fprintf(file, "%10s %10s %10s %6s  %s\n", "calls", "incl ms", "self ms", "self", "function");
+    for (int i = 0; i < fns->len && i < CALLPROF_ROWS; i++) {
+        call_rec* f = &fns->recs[order[i]];
+        fprintf(file, "%10ld %10.1f %10.1f %5.1f%%  ", f->count, f->incl/1e6, f->self/1e6,
+                sum > 0 ? 100.0*f->self/sum : 0.0);
+        print_name(file, f);
+        fputc('\n', file);
+    }
+    free(order);
+}
+
+static void write_callgrind(FILE* file, call_counts* total)
+{
+    call_table* fns = &total->fns;
+    call_table* edges = &total->edges;
+    long sum = 0;
+    for (int i = 0; i < fns->len; i++) sum += fns->recs[i].self;
+
+    fprintf(file, "# callgrind format\n");
+    fprintf(file, "version: 1\n");
+    fprintf(file, "creator: pal70\n");
+    fprintf(file, "positions: line\n");
+    fprintf(file, "events: ns\n");
+    fprintf(file, "summary: %ld\n", sum);
+    for (int i = 0; i < fns->len; i++) {
+        call_rec* f = &fns->recs[i];
+        int line;
+        char* fl = position(f, &line);
+        fprintf(file, "\nfl=%s\nfn=", fl);
+        print_name(file, f);
+        fprintf(file, "\n%d %ld\n", line, f->self);
+        char* fi = fl;
+        for (int j = 0; j < edges->len; j++) {
+            call_rec* e = &edges->recs[j];
+            if (e->key[0] != i || e->key[1] < 0) continue;
+            call_rec* callee = &fns->recs[e->key[2]];
+            operation* op = &program->ops[e->key[1]];
+            if (strcmp(op->file, fi) != 0) {
+                fi = op->file;
+                fprintf(file, "fi=%s\n", fi);
+            }
+            int callee_line;
+            fprintf(file, "cfi=%s\ncfn=", position(callee, &callee_line));
+            print_name(file, callee);
+            fprintf(file, "\ncalls=%ld %d\n%d %ld\n", e->count, callee_line, op->line, e->incl);
+        }
+    }
+}
+
+void callprof_stop(FILE* table, FILE* callgrind)
+{
+    callprof_on = 0;
+    pthread_mutex_lock(&lock);
+    call_counts* total = merge_counts();
+    if (program) {
+        write_table(table, total);
+        write_callgrind(callgrind, total);
+        release_program(program);
+        program = 0;
+    }
+    free_table(&total->fns);
+    free_table(&total->edges);
+    free(total);
+    pthread_mutex_unlock(&lock);
+}
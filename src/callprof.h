@@ -0,0 +1,93 @@
+#ifndef CALLPROF_H
+#define CALLPROF_H
+
+#include <stdio.h>
+#include "stack.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+ * The call profiler. It counts the applications of closures, builtins
+ * and tuples, and measures the time spent in each function and in the
+ * functions it calls. A shadow stack of activations follows the frames
+ * pushed by SAVE and popped by RETURN; a SAVE right after a closure
+ * is applied enters its function, any other SAVE a block. Goto, res
+ * and J leave the activations whose frames are no longer on the stack.
+ * The counts are kept per thread and merged in the report.
+ */
+
+struct _call_entry;
+
+typedef struct _call_stack {
+    struct _call_entry* entries;
+    int len;
+    int max;
+    /* the body of the closure applied, entered by the next SAVE */
+    int pending;
+    int pending_site;
+    /* when the coroutine of the stack was suspended */
+    long suspended;
+    /* the stack of a task, which may run while another waits */
+    int task;
+} call_stack;
+
+/* set while profiling, checked by the interpreter before each hook */
+extern int callprof_on;
+
+void callprof_start();
+
+/*
+ * Returns a shadow stack for the main program of vm if pc is -1, or
+ * for a coroutine that applies the closure with body pc at site. Only
+ * the program run first is profiled.
+ */
+call_stack* callprof_new_stack(pal_vm* vm, int pc, int site);
+
+/*
+ * The coroutine of the stack is suspended or resumed. The time it is
+ * suspended does not count.
+ */
+void callprof_suspend(call_stack* cs);
+
+void callprof_resume(call_stack* cs);
+
+/*
+ * The closure with body pc is applied at site.
+ */
+void callprof_call(pal_vm* vm, int pc, int site);
+
+/*
+ * The builtin named name is applied at site; callprof_leave follows
+ * when it returns.
+ */
+void callprof_builtin(pal_vm* vm, char* name, int site);
+
+void callprof_leave(pal_vm* vm);
+
+/*
+ * A tuple or range is indexed at site.
+ */
+void callprof_index(pal_vm* vm, int site);
+
+void callprof_save(pal_vm* vm, value* frame);
+
+void callprof_return(pal_vm* vm, value* frame);
+
+/*
+ * Leaves the activations whose frames are not on S after a jump.
+ */
+void callprof_unwind(pal_vm* vm, stack* S);
+
+/*
+ * Leaves all activations of the shadow stack of vm.
+ */
+void callprof_finish(pal_vm* vm);
+
+/*
+ * Stops profiling and writes the functions sorted by their own time
+ * to table, and the counts and times in the callgrind format to
+ * callgrind.
+ */
+void callprof_stop(FILE* table, FILE* callgrind);
+
+#endif
@@ -0,0 +1,741 @@
+#define _XOPEN_SOURCE 700
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include "census.h"
+#include "code.h"
+#include "coro.h"
+#include "interpreter.h"
+#include "io.h"
+#include "map.h"
+#include "memo.h"
+#include "profile.h"
+#include "strings.h"
+
+/* the rows of each table */
+#define CENSUS_ROWS 10
+/* the objects shown at either end of a longer path */
+#define CENSUS_PATH 4
+
+/* the kinds of objects besides values, which use their type */
+enum {
+    OBJ_STACK = V_CHANNEL+1,
+    OBJ_CORO,
+    /* the root of all objects, or a set of roots named by ptr */
+    OBJ_ROOT,
+    OBJ_KINDS
+};
+
+typedef struct {
+    void* ptr;
+    int kind;
+    long size;
+    /* the objects it references are edges[first] to edges[last-1] */
+    int first;
+    int last;
+} object;
+
+typedef struct {
+    pal_vm* vm;
+    object* objs;
+    int len;
+    int max;
+    int* edges;
+    int edges_len;
+    int edges_max;
+    /* the object index+1 of each pointer, hashed */
+    void** keys;
+    int* index;
+    int cap;
+} census;
+
+int census_at_end = 0;
+
+static void request(int sig)
+{
+    interrupt_request(INTERRUPT_CENSUS);
+}
+
+int census_start(int at_end)
+{
+    census_at_end = at_end;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGUSR2, &sa, 0) == 0;
+}
+
+static unsigned long hash_ptr(void* p)
+{
+    unsigned long h = (unsigned long)p * 0x9E3779B97F4A7C15UL;
+    return h ^ (h >> 29);
+}
+
+static int new_object(census* c, void* ptr, int kind)
+{
+    if (c->len == c->max) {
+        c->max = c->max ? 2*c->max : 1024;
+        c->objs = realloc(c->objs, c->max*sizeof(object));
+    }
+    object* o = &c->objs[c->len];
+    o->ptr = ptr;
+    o->kind = kind;
+    o->size = 0;
+    o->first = o->last = -1;
+    return c->len++;
+}
+
+/*
+ * Returns the index of the object at ptr, adding it if new, or -1 if
+ * ptr is 0. The kind of a value is its type.
+ */
+static int find_object(census* c, void* ptr, int kind)
+{
+    if (!ptr) return -1;
+    if (2*(c->len+1) > c->cap) {
+        int old_cap = c->cap;
+        void** old_keys = c->keys;
+        int* old_index = c->index;
+        c->cap = c->cap ? 2*c->cap : 4096;
+        c->keys = malloc(c->cap*sizeof(void*));
+        c->index = calloc(c->cap, sizeof(int));
+        for (int i = 0; i < old_cap; i++) {
+            if (!old_index[i]) continue;
+            unsigned long j = hash_ptr(old_keys[i]) & (c->cap-1);
+            while (c->index[j]) j = (j+1) & (c->cap-1);
+            c->keys[j] = old_keys[i];
+            c->index[j] = old_index[i];
+        }
+        free(old_keys);
+        free(old_index);
+    }
+    unsigned long j = hash_ptr(ptr) & (c->cap-1);
+    while (c->index[j]) {
+        if (c->keys[j] == ptr) return c->index[j]-1;
+        j = (j+1) & (c->cap-1);
+    }
+    if (kind < 0) kind = value_type((value*)ptr);
+    int i = new_object(c, ptr, kind);
+    c->keys[j] = ptr;
+    c->index[j] = i+1;
+    return i;
+}
+
+static void add_edge(census* c, void* ptr, int kind)
+{
+    int i = find_object(c, ptr, kind);
+    if (i < 0) return;
+    if (c->edges_len == c->edges_max) {
+        c->edges_max = c->edges_max ? 2*c->edges_max : 4096;
+        c->edges = realloc(c->edges, c->edges_max*sizeof(int));
+    }
+    c->edges[c->edges_len++] = i;
+}
+
+#define add_value(_c, _v) add_edge(_c, _v, -1)
+
+static void add_coro(coro* co, void* data)
+{
+    add_edge(data, co, OBJ_CORO);
+}
+
+static void add_queue(census* c, coro_queue* q)
+{
+    for (coro* co = q->head; co; co = co->next) add_edge(c, co, OBJ_CORO);
+}
+
+/*
+ * Adds the edges of object i and sets its size.
+ */
+static void visit(census* c, int i)
+{
+    void* ptr = c->objs[i].ptr;
+    long size = sizeof(value);
+    c->objs[i].first = c->edges_len;
+    switch (c->objs[i].kind) {
+    case OBJ_STACK: {
+        stack* S = ptr;
+        size = sizeof(stack);
+        add_value(c, S->value);
+        add_edge(c, S->next, OBJ_STACK);
+        break;
+    }
+    case OBJ_CORO: {
+        coro* co = ptr;
+        size = sizeof(coro);
+        add_edge(c, co->S, OBJ_STACK);
+        add_value(c, co->E);
+        add_value(c, co->new_env);
+        add_value(c, co->resume);
+        add_value(c, co->data);
+        break;
+    }
+    case V_STRING:
+        if (((value*)ptr)->v.string) size += strlen(((value*)ptr)->v.string)+1;
+        break;
+    case V_TUPLE: {
+        value* v = ptr;
+        size += v->v.tuple.size*sizeof(value*);
+        for (int k = 0; k < v->v.tuple.size; k++) add_value(c, v->v.tuple.values[k]);
+        break;
+    }
+    case V_TUPLEMAKER: {
+        value* v = ptr;
+        size += v->v.tuplemaker.len*sizeof(value*);
+        for (int k = 0; k < v->v.tuplemaker.n; k++) add_value(c, v->v.tuplemaker.values[k]);
+        break;
+    }
+    case V_LVALUE: {
+        value* v = ptr;
+        add_value(c, v->v.element.value);
+        add_value(c, v->v.element.range);
+        break;
+    }
+    case V_ENV: {
+        value* v = ptr;
+        add_value(c, v->v.env.value);
+        add_value(c, v->v.env.next);
+        break;
+    }
+    case V_STACK: {
+        value* v = ptr;
+        add_value(c, v->v.stack.env);
+        add_edge(c, v->v.stack.stack, OBJ_STACK);
+        if (v->v.stack.memo) {
+            add_value(c, v->v.stack.memo);
+            add_value(c, v->v.stack.key);
+        }
+        break;
+    }
+    case V_JJ:
+    case V_LABEL: {
+        value* v = ptr;
+        add_value(c, v->v.jj.env);
+        add_edge(c, v->v.jj.stack, OBJ_STACK);
+        add_edge(c, v->v.jj.base, OBJ_STACK);
+        break;
+    }
+    case V_CLOSURE:
+        add_value(c, ((value*)ptr)->v.closure.env);
+        break;
+    case V_MAP: {
+        map* m = ((value*)ptr)->v.map;
+        size += sizeof(map)+m->cap*sizeof(map_entry);
+        value* key;
+        void* val;
+        int k = 0;
+        while ((k = map_next(m, k, &key, &val)) >= 0) {
+            add_value(c, key);
+            add_value(c, val);
+        }
+        break;
+    }
+    case V_MEMO: {
+        memo* m = ((value*)ptr)->v.memo;
+        size += sizeof(memo)+sizeof(map)+m->cache->cap*sizeof(map_entry);
+        add_value(c, m->fn);
+        /* it is only held to update the cache, never while applying */
+        if (pthread_mutex_trylock(&m->lock) == 0) {
+            for (memo_node* node = m->head; node; node = node->next) {
+                size += sizeof(*node);
+                add_value(c, node->key);
+                add_value(c, node->result);
+            }
+            pthread_mutex_unlock(&m->lock);
+        }
+        break;
+    }
+    case V_FUTURE: {
+        value* v = ptr;
+        add_value(c, v->v.future.fn);
+        add_value(c, v->v.future.arg);
+        add_value(c, v->v.future.result);
+        break;
+    }
+    case V_CHANNEL: {
+        channel* ch = ((value*)ptr)->v.channel;
+        size += sizeof(channel)+ch->cap*sizeof(value*);
+        for (int k = 0; k < ch->size; k++) add_value(c, ch->buf[(ch->head+k)%ch->cap]);
+        add_queue(c, &ch->receivers);
+        add_queue(c, &ch->senders);
+        break;
+    }
+    default:
+        break;
+    }
+    c->objs[i].size = size;
+    c->objs[i].last = c->edges_len;
+}
+
+static int begin_roots(census* c, char* name)
+{
+    int i = new_object(c, name, OBJ_ROOT);
+    c->objs[i].first = c->edges_len;
+    return i;
+}
+
+static void end_roots(census* c, int i)
+{
+    c->objs[i].last = c->edges_len;
+}
+
+static void print_object(FILE* file, census* c, int i)
+{
+    object* o = &c->objs[i];
+    value* v = o->ptr;
+    pal_program* program = c->vm->program;
+    operation* ops = program->ops;
+    switch (o->kind) {
+    case OBJ_ROOT:
+        fprintf(file, "%s", (char*)o->ptr);
+        break;
+    case OBJ_STACK:
+        fprintf(file, "stack cell");
+        break;
+    case OBJ_CORO:
+        fprintf(file, "coroutine");
+        break;
+    case V_ENV:
+        if (v->v.env.name >= 0)
+            fprintf(file, "env %s", ref_to_string(program->strings, v->v.env.name));
+        else
+            fprintf(file, "env");
+        break;
+    case V_TUPLE:
+        fprintf(file, "tuple[%d]", v->v.tuple.size);
+        break;
+    case V_BUILTIN:
+        fprintf(file, "builtin %s", v->v.builtin.name);
+        break;
+    case V_CLOSURE: {
+        int pc = v->v.closure.pc;
+        fprintf(file, "closure ");
+        if (pc >= 4 && pc < program->len && ops[pc-4].op == OP_FORMCLOSURE && ops[pc-3].args.n == pc)
+            profile_print_function(file, program, pc-4);
+        else if (pc >= 0 && pc < program->len)
+            fprintf(file, "(%s:%d)", ops[pc].file, ops[pc].line);
+        break;
+    }
+    case V_STACK:
+    case V_JJ:
+    case V_LABEL: {
+        int pc = v->v.stack.pc;
+        fprintf(file, "%s", value_type_name(o->kind));
+        if (pc >= 0 && pc < program->len) fprintf(file, " %s:%d", ops[pc].file, ops[pc].line);
+        break;
+    }
+    default:
+        fprintf(file, "%s", value_type_name(o->kind));
+        break;
+    }
+}
+
+static int same_names(char** names, int i, int j, int len)
+{
+    for (int k = 0; k < len; k++) {
+        if (strcmp(names[i+k], names[j+k]) != 0) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Prints the n objects in path. A run of one or two objects repeated,
+ * as the cells of a list, is printed once with its count, and the
+ * middle of a longer path is left out.
+ */
+static void print_objects(FILE* file, census* c, int* path, int n)
+{
+    char** names = malloc(n*sizeof(char*));
+    for (int j = 0; j < n; j++) {
+        size_t size;
+        FILE* out = open_memstream(&names[j], &size);
+        print_object(out, c, path[j]);
+        fclose(out);
+    }
+
+    /* the first name, the length and the repetitions of each run */
+    struct { int first, len, reps; }* runs = malloc(n*sizeof(*runs));
+    int m = 0;
+    for (int j = 0; j < n; ) {
+        int len = 1;
+        int reps = 1;
+        for (int u = 1; u <= 2; u++) {
+            int r = 1;
+            while (j+(r+1)*u <= n && same_names(names, j, j+r*u, u)) r++;
+            if (r >= 3 && r*u > reps*len) {
+                len = u;
+                reps = r;
+            }
+        }
+        runs[m].first = j;
+        runs[m].len = len;
+        runs[m].reps = reps;
+        m++;
+        j += len*reps;
+    }
+
+    for (int r = 0; r < m; r++) {
+        if (m > 2*CENSUS_PATH+1 && r == CENSUS_PATH) {
+            int more = runs[m-CENSUS_PATH].first-runs[r].first;
+            fprintf(file, " > ... %d more", more);
+            r = m-CENSUS_PATH-1;
+            continue;
+        }
+        if (r > 0) fprintf(file, " > ");
+        if (runs[r].len > 1) fputc('(', file);
+        for (int j = 0; j < runs[r].len; j++) {
+            if (j > 0) fprintf(file, " > ");
+            fprintf(file, "%s", names[runs[r].first+j]);
+        }
+        if (runs[r].len > 1) fputc(')', file);
+        if (runs[r].reps > 1) fprintf(file, " x%d", runs[r].reps);
+    }
+    for (int j = 0; j < n; j++) free(names[j]);
+    free(names);
+    free(runs);
+}
+
+/*
+ * Prints the dominators of object i, from the roots down to i. If
+ * heavy is given, also prints the objects that i holds: its dominated
+ * object retaining the most, as long as it retains nearly all i does,
+ * and so on.
+ */
+static void print_path(FILE* file, census* c, int* idom, int* heavy, long* retained, int i)
+{
+    int n = 0;
+    for (int k = i; k != 0; k = idom[k]) n++;
+    int* path = malloc(n*sizeof(int));
+    int k = i;
+    for (int j = n-1; j >= 0; j--) {
+        path[j] = k;
+        k = idom[k];
+    }
+    print_objects(file, c, path, n);
+    free(path);
+    if (!heavy) return;
+
+    n = 0;
+    for (k = i; heavy[k] >= 0 && 10*retained[heavy[k]] >= 9*retained[k]; k = heavy[k]) n++;
+    if (n == 0) return;
+    path = malloc(n*sizeof(int));
+    k = i;
+    for (int j = 0; j < n; j++) path[j] = k = heavy[k];
+    fprintf(file, " holding ");
+    print_objects(file, c, path, n);
+    free(path);
+}
+
+/* the keys compare_desc sorts objects by, the second one optional */
+static long* sort_key;
+static long* sort_key2;
+
+static int compare_desc(const void* a, const void* b)
+{
+    long x = sort_key[*(int*)a];
+    long y = sort_key[*(int*)b];
+    if (x != y) return x < y ? 1 : -1;
+    if (sort_key2) {
+        x = sort_key2[*(int*)a];
+        y = sort_key2[*(int*)b];
+        if (x != y) return x < y ? 1 : -1;
+    }
+    return *(int*)a - *(int*)b;
+}
+
+/*
+ * Returns the objects in the preorder of a depth first search from
+ * object 0, and sets parent to their parents in the search tree and
+ * num to their positions.
+ */
+static int* preorder(census* c, int* parent, int* num)
+{
+    int n = c->len;
+    int* order = malloc(n*sizeof(int));
+    int* stack = malloc(n*sizeof(int));
+    int* next = malloc(n*sizeof(int));
+    for (int v = 0; v < n; v++) num[v] = -1;
+    int sp = 0;
+    int k = 0;
+    stack[sp++] = 0;
+    next[0] = c->objs[0].first;
+    parent[0] = -1;
+    num[0] = k;
+    order[k++] = 0;
+    while (sp > 0) {
+        int v = stack[sp-1];
+        if (next[v] < c->objs[v].last) {
+            int w = c->edges[next[v]++];
+            if (num[w] < 0) {
+                parent[w] = v;
+                num[w] = k;
+                order[k++] = w;
+                next[w] = c->objs[w].first;
+                stack[sp++] = w;
+            }
+        }
+        else {
+            sp--;
+        }
+    }
+    free(stack);
+    free(next);
+    return order;
+}
+
+/*
+ * Returns the object whose ancestor in the forest built so far has
+ * the least semidominator, compressing the path to it.
+ */
+static int eval(int v, int* ancestor, int* label, int* semi, int* path)
+{
+    if (ancestor[v] < 0) return v;
+    int n = 0;
+    for (int u = v; ancestor[ancestor[u]] >= 0; u = ancestor[u]) path[n++] = u;
+    while (n > 0) {
+        int u = path[--n];
+        int a = ancestor[u];
+        if (semi[label[a]] < semi[label[u]]) label[u] = label[a];
+        ancestor[u] = ancestor[a];
+    }
+    return label[v];
+}
+
+/*
+ * Returns the immediate dominator of each object, by the algorithm of
+ * Lengauer and Tarjan with path compression. Order is the preorder of
+ * the objects and num their positions in it.
+ */
+static int* dominators(census* c, int* order, int* parent, int* num)
+{
+    int n = c->len;
+    int* pred_start = calloc(n+1, sizeof(int));
+    int* preds = malloc((c->edges_len+1)*sizeof(int));
+    for (int e = 0; e < c->edges_len; e++) pred_start[c->edges[e]+1]++;
+    for (int v = 0; v < n; v++) pred_start[v+1] += pred_start[v];
+    int* fill = malloc(n*sizeof(int));
+    memcpy(fill, pred_start, n*sizeof(int));
+    for (int v = 0; v < n; v++) {
+        for (int e = c->objs[v].first; e < c->objs[v].last; e++) preds[fill[c->edges[e]]++] = v;
+    }
+
+    /* the objects waiting in the bucket of each, as linked lists */
+    int* bucket = fill;
+    int* bucket_next = malloc(n*sizeof(int));
+    int* semi = malloc(n*sizeof(int));
+    int* ancestor = malloc(n*sizeof(int));
+    int* label = malloc(n*sizeof(int));
+    int* path = malloc(n*sizeof(int));
+    int* idom = malloc(n*sizeof(int));
+    for (int v = 0; v < n; v++) {
+        bucket[v] = -1;
+        semi[v] = num[v];
+        ancestor[v] = -1;
+        label[v] = v;
+    }
+    for (int k = n-1; k > 0; k--) {
+        int w = order[k];
+        for (int e = pred_start[w]; e < pred_start[w+1]; e++) {
+            int u = eval(preds[e], ancestor, label, semi, path);
+            if (semi[u] < semi[w]) semi[w] = semi[u];
+        }
+        int s = order[semi[w]];
+        bucket_next[w] = bucket[s];
+        bucket[s] = w;
+        int p = parent[w];
+        ancestor[w] = p;
+        for (int v = bucket[p]; v >= 0; v = bucket_next[v]) {
+            int u = eval(v, ancestor, label, semi, path);
+            idom[v] = semi[u] < semi[v] ? u : p;
+        }
+        bucket[p] = -1;
+    }
+    idom[0] = 0;
+    for (int k = 1; k < n; k++) {
+        int w = order[k];
+        if (idom[w] != order[semi[w]]) idom[w] = idom[idom[w]];
+    }
+
+    free(pred_start);
+    free(preds);
+    free(bucket);
+    free(bucket_next);
+    free(semi);
+    free(ancestor);
+    free(label);
+    free(path);
+    return idom;
+}
+
+static void write_census(FILE* file, census* c)
+{
+    int n = c->len;
+    int* parent = malloc(n*sizeof(int));
+    int* num = malloc(n*sizeof(int));
+    int* order = preorder(c, parent, num);
+    int* idom = dominators(c, order, parent, num);
+
+    /* the bytes and objects only reachable through each object */
+    long* retained = malloc(n*sizeof(long));
+    long* retained_count = malloc(n*sizeof(long));
+    /* the dominated object retaining the most */
+    int* heavy = malloc(n*sizeof(int));
+    for (int v = 0; v < n; v++) {
+        heavy[v] = -1;
+        retained[v] = c->objs[v].size;
+        retained_count[v] = c->objs[v].kind == OBJ_ROOT ? 0 : 1;
+    }
+    /* a dominator precedes the objects it dominates in the preorder */
+    for (int k = n-1; k > 0; k--) {
+        int v = order[k];
+        int d = idom[v];
+        retained[d] += retained[v];
+        retained_count[d] += retained_count[v];
+        if (heavy[d] < 0 || retained[v] > retained[heavy[d]]) heavy[d] = v;
+    }
+
+    long counts[OBJ_KINDS] = { 0 };
+    long bytes[OBJ_KINDS] = { 0 };
+    for (int v = 0; v < n; v++) {
+        counts[c->objs[v].kind]++;
+        bytes[c->objs[v].kind] += c->objs[v].size;
+    }
+    fprintf(file, "heap census: %ld objects, %ld bytes\n", retained_count[0], retained[0]);
+    int kinds[OBJ_KINDS];
+    long kind_bytes[OBJ_KINDS];
+    int m = 0;
+    for (int k = 0; k < OBJ_ROOT; k++) {
+        if (!counts[k]) continue;
+        kinds[m] = k;
+        kind_bytes[k] = bytes[k];
+        m++;
+    }
+    sort_key = kind_bytes;
+    qsort(kinds, m, sizeof(int), compare_desc);
+    fprintf(file, "%10s %12s  %s\n", "objects", "bytes", "type");
+    for (int k = 0; k < m; k++) {
+        int kind = kinds[k];
+        fprintf(file, "%10ld %12ld  %s\n", counts[kind], bytes[kind],
+                kind == OBJ_STACK ? "stack cell" : kind == OBJ_CORO ? "coroutine" : value_type_name(kind));
+    }
+
+    /* the largest tuples */
+    int* rows = malloc(n*sizeof(int));
+    long* sizes = calloc(n, sizeof(long));
+    m = 0;
+    for (int v = 0; v < n; v++) {
+        if (c->objs[v].kind != V_TUPLE) continue;
+        sizes[v] = value_tuple_size((value*)c->objs[v].ptr);
+        rows[m++] = v;
+    }
+    sort_key = sizes;
+    sort_key2 = retained;
+    qsort(rows, m, sizeof(int), compare_desc);
+    sort_key2 = 0;
+    if (m > 0) fprintf(file, "largest tuples\n%10s %12s  %s\n", "elements", "retained", "path");
+    for (int k = 0; k < m && k < CENSUS_ROWS; k++) {
+        int v = rows[k];
+        fprintf(file, "%10ld %12ld  ", sizes[v], retained[v]);
+        print_path(file, c, idom, 0, retained, v);
+        fputc('\n', file);
+    }
+
+    /*
+     * The objects retaining the most. Of an object retaining nearly all
+     * its dominator does, and of a chain of objects of the same kind or
+     * alternating kinds, as the cells of a list, only the first.
+     */
+    m = 0;
+    for (int v = 1; v < n; v++) {
+        int kind = c->objs[v].kind;
+        if (kind == OBJ_ROOT) continue;
+        int d = idom[v];
+        if (d != 0 && c->objs[d].kind != OBJ_ROOT &&
+            (10*retained[v] >= 9*retained[d] || kind == c->objs[d].kind ||
+             kind == c->objs[idom[d]].kind))
+            continue;
+        rows[m++] = v;
+    }
+    sort_key = retained;
+    qsort(rows, m, sizeof(int), compare_desc);
+    if (m > 0) fprintf(file, "largest retainers\n%10s %12s  %s\n", "objects", "retained", "path");
+    for (int k = 0; k < m && k < CENSUS_ROWS; k++) {
+        int v = rows[k];
+        fprintf(file, "%10ld %12ld  ", retained_count[v], retained[v]);
+        print_path(file, c, idom, heavy, retained, v);
+        fputc('\n', file);
+    }
+
+    free(rows);
+    free(sizes);
+    free(retained);
+    free(retained_count);
+    free(heavy);
+    free(idom);
+    free(order);
+    free(parent);
+    free(num);
+}
+
+void census_take(pal_vm* vm, stack* S, value* E, value* A, value* B)
+{
+    census c;
+    memset(&c, 0, sizeof(c));
+    c.vm = vm;
+    new_object(&c, "roots", OBJ_ROOT);
+
+    int sets[5];
+    int n = 0;
+    int i = sets[n++] = begin_roots(&c, "registers");
+    add_edge(&c, S, OBJ_STACK);
+    add_value(&c, E);
+    add_value(&c, A);
+    add_value(&c, B);
+    end_roots(&c, i);
+    i = sets[n++] = begin_roots(&c, "callers");
+    add_edge(&c, vm->apply_S, OBJ_STACK);
+    for (caller* k = vm->callers; k; k = k->next) {
+        add_edge(&c, k->S, OBJ_STACK);
+        add_edge(&c, k->base, OBJ_STACK);
+    }
+    end_roots(&c, i);
+    i = sets[n++] = begin_roots(&c, "coroutines");
+    coro_each_ready(vm, add_coro, &c);
+    io_each_reader(vm, add_coro, &c);
+    end_roots(&c, i);
+    i = sets[n++] = begin_roots(&c, "environment");
+    add_value(&c, vm->env);
+    end_roots(&c, i);
+    i = sets[n++] = begin_roots(&c, "constants");
+    add_value(&c, vm->result);
+    add_value(&c, vm->guess_rvalue);
+    add_value(&c, vm->true_rvalue);
+    add_value(&c, vm->false_rvalue);
+    add_value(&c, vm->dummy_rvalue);
+    add_value(&c, vm->nil_rvalue);
+    end_roots(&c, i);
+
+    c.objs[0].first = c.edges_len;
+    for (int k = 0; k < n; k++) {
+        if (c.edges_len == c.edges_max) {
+            c.edges_max = c.edges_max ? 2*c.edges_max : 4096;
+            c.edges = realloc(c.edges, c.edges_max*sizeof(int));
+        }
+        c.edges[c.edges_len++] = sets[k];
+    }
+    c.objs[0].last = c.edges_len;
+
+    for (int k = 1; k < c.len; k++) {
+        if (c.objs[k].kind != OBJ_ROOT) visit(&c, k);
+    }
+    write_census(vm->err, &c);
+    fflush(vm->err);
+
+    free(c.objs);
+    free(c.edges);
+    free(c.keys);
+    free(c.index);
+}
@@ -0,0 +1,34 @@
+#ifndef CENSUS_H
+#define CENSUS_H
+
+#include "stack.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+ * The heap census. It walks the objects reachable from the registers
+ * of a VM, the stacks of the interpreters suspended in builtins, the
+ * coroutines and the initial environment and constants, and reports
+ * them by type, the largest tuples, and the objects that retain the
+ * most memory: those whose dominated objects, which are only reachable
+ * through them, take the most bytes. Other threads keep running, so a
+ * census of a VM running tasks is approximate.
+ */
+
+/* set if the main program of a VM takes a census when it ends */
+extern int census_at_end;
+
+/*
+ * Makes SIGUSR2 request a census, taken by the next VM to execute an
+ * instruction, and if at_end is set, makes each main program take one
+ * when it ends. Returns 0 if the signal handler cannot be set.
+ */
+int census_start(int at_end);
+
+/*
+ * Writes a census of the objects reachable from vm with the registers
+ * S, E, A and B to vm->err.
+ */
+void census_take(pal_vm* vm, stack* S, value* E, value* A, value* B);
+
+#endif
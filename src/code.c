@@ -120,6 +120,43 @@ void write_code(FILE* file, BYTE* bytes, int len, char** files, int files_len)
     fflush(file);
 }
 
+BYTE* decode_code(BYTE* buf, size_t buf_len, int* len, char*** files, int* files_len)
+{
+    size_t n = 0;
+
+    /* check header */
+    if (buf_len < 14 || buf[0] != 0xF0) return 0;
+    n += 10;
+
+    /* number of source file names */
+    int flen = decode_int(&buf[n]);
+    n += 4;
+    if (flen < 0) return 0;
+
+    /* source file names */
+    char** file_names = malloc((flen+1)*sizeof(char*));
+    for (int i = 0; i < flen; i++) {
+        if (buf_len-n < 4) return 0;
+        int nlen = decode_int(&buf[n]);
+        n += 4;
+        if (nlen < 0 || buf_len-n < nlen) return 0;
+        char* file_name = malloc(nlen+1);
+        decode_string(&buf[n], file_name, nlen);
+        n += nlen;
+        file_names[i] = file_name;
+    }
+
+    /* length of code */
+    if (buf_len-n < 4) return 0;
+    *len = decode_int(&buf[n]);
+    n += 4;
+    if (*len < 0 || buf_len-n < *len) return 0;
+
+    *files = file_names;
+    *files_len = flen;
+    return &buf[n];
+}
+
 BYTE* read_code(FILE* file, int* len, char*** files, int* files_len)
 {
     BYTE buf[9];
@@ -61,7 +61,9 @@ typedef enum {
     OP_TESTEMPTY,
     OP_TRUE,
     OP_TUPLE,
-    OP_UPDATE
+    OP_UPDATE,
+    /* only in lazily decoded programs, never in pocode */
+    OP_ENTER
 } op;
 
 
@@ -83,4 +85,10 @@ void write_code(FILE* file, BYTE* bytes, int len, char** files, int files_len);
 
 BYTE* read_code(FILE* file, int* len, char*** files, int* files_len);
 
+/*
+ * Parses the pocode in buf like read_code, but returns a pointer to the
+ * code in buf instead of a copy. Returns 0 if buf is not valid pocode.
+ */
+BYTE* decode_code(BYTE* buf, size_t buf_len, int* len, char*** files, int* files_len);
+
 #endif
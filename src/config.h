@@ -3,6 +3,14 @@
 
 #include <stdint.h>
 
+#define PAL70_VERSION "1.0"
+
+/**
+ * The version of the pocode format. Increment it when the format
+ * changes; cached pocode of another version is not used.
+ */
+#define POCODE_VERSION 1
+
 /**
  * Set this to 0, if the machine is big endian.
  */
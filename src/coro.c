@@ -0,0 +1,277 @@
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "callprof.h"
+#include "coro.h"
+#include "error.h"
+#include "gc.h"
+
+/* the reactor */
+typedef struct {
+    int fd;
+    int (*ready)(void*);
+    void* arg;
+} fd_waiter;
+
+struct _coro_state {
+    coro* current;
+    coro_queue run_queue;
+    /* number of coroutines that have not finished */
+    int live;
+    int epoll_fd;
+    int io_waiting;
+    /* indexed by file descriptor */
+    fd_waiter** waiters;
+    int waiters_max;
+};
+
+static void enqueue(coro_queue* q, coro* c)
+{
+    c->next = 0;
+    if (q->tail)
+        q->tail->next = c;
+    else
+        q->head = c;
+    q->tail = c;
+}
+
+static coro* dequeue(coro_queue* q)
+{
+    coro* c = q->head;
+    if (c) {
+        q->head = c->next;
+        if (!q->head) q->tail = 0;
+        c->next = 0;
+    }
+    return c;
+}
+
+coro* coro_init(pal_vm* vm, value* E)
+{
+    struct _coro_state* cs = GC_NEW(struct _coro_state);
+    cs->current = GC_NEW(coro);
+    cs->current->E = E;
+    cs->live = 1;
+    cs->epoll_fd = -1;
+    vm->coro = cs;
+    vm->coro_allowed = 1;
+    return cs->current;
+}
+
+coro* coro_current(pal_vm* vm)
+{
+    return vm->coro->current;
+}
+
+int coro_can_block(pal_vm* vm)
+{
+    return vm->coro && vm->coro_allowed;
+}
+
+void coro_spawn(pal_vm* vm, value* fn, value* arg)
+{
+    if (!vm->coro) {
+        runtime_error(vm, "%s", "Go: coroutines cannot be started by a task");
+        return;
+    }
+    coro* c = GC_NEW(coro);
+    c->pc = fn->v.closure.pc;
+    c->old_pc = CORO_EXIT;
+    c->new_env = fn->v.closure.env;
+    c->E = fn->v.closure.env;
+    c->S = 0;
+    push(c->S, arg);
+    if (callprof_on) c->calls = callprof_new_stack(vm, fn->v.closure.pc, vm->apply_pc-1);
+    vm->coro->live++;
+    enqueue(&vm->coro->run_queue, c);
+}
+
+void coro_yield(pal_vm* vm)
+{
+    coro* c = vm->coro->current;
+    c->resume = make_lvalue(make_value(V_DUMMY));
+    enqueue(&vm->coro->run_queue, c);
+    vm->coro_switch = 1;
+}
+
+void coro_suspend(pal_vm* vm)
+{
+    vm->coro_switch = 1;
+}
+
+void coro_wake(pal_vm* vm, coro* c, value* resume)
+{
+    c->resume = resume;
+    enqueue(&vm->coro->run_queue, c);
+}
+
+void coro_exit(pal_vm* vm)
+{
+    vm->coro->live--;
+    vm->coro->current = 0;
+}
+
+/*
+ * Waits for readable file descriptors and runs their callbacks.
+ */
+static void poll_io(pal_vm* vm)
+{
+    struct _coro_state* cs = vm->coro;
+    struct epoll_event events[64];
+    int n = epoll_wait(cs->epoll_fd, events, 64, -1);
+    if (n < 0 && errno != EINTR) {
+        runtime_error(vm, "%s", "epoll_wait failed");
+        cs->io_waiting = 0;
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        fd_waiter* w = cs->waiters[events[i].data.fd];
+        if (!w) continue;
+        if (w->ready(w->arg)) {
+            epoll_ctl(cs->epoll_fd, EPOLL_CTL_DEL, w->fd, 0);
+            cs->waiters[w->fd] = 0;
+            cs->io_waiting--;
+        }
+        else {
+            /* rearm the one-shot notification */
+            events[i].events = EPOLLIN|EPOLLONESHOT;
+            epoll_ctl(cs->epoll_fd, EPOLL_CTL_MOD, w->fd, &events[i]);
+        }
+    }
+}
+
+coro* coro_next(pal_vm* vm)
+{
+    struct _coro_state* cs = vm->coro;
+    while (!cs->run_queue.head && cs->io_waiting > 0) {
+        poll_io(vm);
+    }
+    cs->current = dequeue(&cs->run_queue);
+    if (!cs->current && cs->live > 0) {
+        runtime_error(vm, "%s", "deadlock, all coroutines are blocked");
+    }
+    if (!cs->current && cs->epoll_fd >= 0) {
+        close(cs->epoll_fd);
+        cs->epoll_fd = -1;
+    }
+    return cs->current;
+}
+
+void coro_each_ready(pal_vm* vm, void (*fn)(coro*, void*), void* data)
+{
+    struct _coro_state* cs = vm->coro;
+    if (!cs) return;
+    if (cs->current) fn(cs->current, data);
+    for (coro* c = cs->run_queue.head; c; c = c->next) fn(c, data);
+}
+
+void coro_wait_fd(pal_vm* vm, int fd, int (*ready)(void*), void* arg)
+{
+    struct _coro_state* cs = vm->coro;
+    if (cs->epoll_fd < 0) {
+        cs->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    if (fd >= cs->waiters_max) {
+        int max = cs->waiters_max ? cs->waiters_max : 64;
+        while (fd >= max) max *= 2;
+        fd_waiter** new = GC_MALLOC(max*sizeof(fd_waiter*));
+        for (int i = 0; i < cs->waiters_max; i++) new[i] = cs->waiters[i];
+        cs->waiters = new;
+        cs->waiters_max = max;
+    }
+    fd_waiter* w = GC_NEW(fd_waiter);
+    w->fd = fd;
+    w->ready = ready;
+    w->arg = arg;
+    struct epoll_event ev;
+    ev.events = EPOLLIN|EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(cs->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+        cs->waiters[fd] = w;
+        cs->io_waiting++;
+    }
+    else {
+        /* not pollable, like a regular file, so it is always ready */
+        while (!ready(arg));
+    }
+}
+
+void coro_cancel_fd(pal_vm* vm, int fd)
+{
+    struct _coro_state* cs = vm->coro;
+    if (cs && fd < cs->waiters_max && cs->waiters[fd]) {
+        epoll_ctl(cs->epoll_fd, EPOLL_CTL_DEL, fd, 0);
+        cs->waiters[fd] = 0;
+        cs->io_waiting--;
+    }
+}
+
+channel* make_channel(int cap)
+{
+    channel* ch = GC_NEW(channel);
+    ch->cap = cap;
+    ch->size = 0;
+    ch->head = 0;
+    ch->buf = cap > 0 ? GC_MALLOC(cap*sizeof(value*)) : 0;
+    return ch;
+}
+
+void channel_send(pal_vm* vm, channel* ch, value* val)
+{
+    if (!vm->coro) {
+        runtime_error(vm, "%s", "Send: channels cannot be used by a task");
+        return;
+    }
+    coro* c = dequeue(&ch->receivers);
+    if (c) {
+        coro_wake(vm, c, make_lvalue(val));
+    }
+    else if (ch->size < ch->cap) {
+        ch->buf[(ch->head+ch->size)%ch->cap] = val;
+        ch->size++;
+    }
+    else if (coro_can_block(vm)) {
+        coro* current = vm->coro->current;
+        current->data = val;
+        current->resume = make_lvalue(make_value(V_DUMMY));
+        enqueue(&ch->senders, current);
+        coro_suspend(vm);
+    }
+    else {
+        runtime_error(vm, "%s", "Send: channel is full");
+    }
+}
+
+value* channel_receive(pal_vm* vm, channel* ch)
+{
+    value* val;
+    if (!vm->coro) {
+        runtime_error(vm, "%s", "Receive: channels cannot be used by a task");
+        return make_tuple(0);
+    }
+    if (ch->size > 0) {
+        val = ch->buf[ch->head];
+        ch->head = (ch->head+1)%ch->cap;
+        ch->size--;
+        /* a blocked sender can now put its value into the buffer */
+        coro* c = dequeue(&ch->senders);
+        if (c) {
+            ch->buf[(ch->head+ch->size)%ch->cap] = c->data;
+            ch->size++;
+            coro_wake(vm, c, c->resume);
+        }
+        return val;
+    }
+    coro* c = dequeue(&ch->senders);
+    if (c) {
+        coro_wake(vm, c, c->resume);
+        return c->data;
+    }
+    if (coro_can_block(vm)) {
+        enqueue(&ch->receivers, vm->coro->current);
+        coro_suspend(vm);
+        return 0;
+    }
+    runtime_error(vm, "%s", "Receive: channel is empty");
+    return make_tuple(0);
+}
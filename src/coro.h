@@ -0,0 +1,119 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include "stack.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+ * Coroutines (green threads) multiplexed on the interpreter of a VM.
+ * A suspended coroutine is just its registers, since the stack is
+ * persistent. Builtins can only suspend the running coroutine when
+ * called directly from the top level interpreter loop, not from
+ * within call_closure or on a forked VM.
+ */
+
+/* the pc the function of a coroutine returns to */
+#define CORO_EXIT -2
+
+typedef struct _coro {
+    int pc;
+    int old_pc;
+    value* new_env;
+    stack* S;
+    value* E;
+    /* lvalue pushed on the stack when the coroutine is resumed */
+    value* resume;
+    /* the value a coroutine blocked in Send is sending */
+    value* data;
+    /* the activations of the call profiler */
+    struct _call_stack* calls;
+    struct _coro* next;
+} coro;
+
+typedef struct {
+    coro* head;
+    coro* tail;
+} coro_queue;
+
+typedef struct _channel {
+    int cap;
+    int size;
+    int head;
+    value** buf;
+    coro_queue receivers;
+    coro_queue senders;
+} channel;
+
+/*
+ * Creates the main coroutine of vm, which starts at pc 0 in the
+ * environment E. A builtin suspending the running coroutine sets
+ * vm->coro_switch; interpret then saves the registers in
+ * coro_current(vm) and returns.
+ */
+coro* coro_init(pal_vm* vm, value* E);
+
+coro* coro_current(pal_vm* vm);
+
+/*
+ * True if the running builtin may suspend the current coroutine.
+ */
+int coro_can_block(pal_vm* vm);
+
+/*
+ * Creates a coroutine applying the closure fn to the lvalue arg and
+ * appends it to the run queue.
+ */
+void coro_spawn(pal_vm* vm, value* fn, value* arg);
+
+void coro_yield(pal_vm* vm);
+
+/*
+ * Suspends the current coroutine until some other party calls
+ * coro_wake on it.
+ */
+void coro_suspend(pal_vm* vm);
+
+void coro_wake(pal_vm* vm, coro* c, value* resume);
+
+/*
+ * Ends the current coroutine.
+ */
+void coro_exit(pal_vm* vm);
+
+/*
+ * Returns the next coroutine to run, waiting for I/O if necessary,
+ * or 0 if all coroutines have finished or are deadlocked.
+ */
+coro* coro_next(pal_vm* vm);
+
+/*
+ * Calls fn(c, data) for the current coroutine c and those ready to
+ * run. The others are referenced by the channel or file they wait on.
+ */
+void coro_each_ready(pal_vm* vm, void (*fn)(coro*, void*), void* data);
+
+/*
+ * Calls ready(arg) whenever fd becomes readable, until it returns
+ * nonzero.
+ */
+void coro_wait_fd(pal_vm* vm, int fd, int (*ready)(void*), void* arg);
+
+void coro_cancel_fd(pal_vm* vm, int fd);
+
+channel* make_channel(int cap);
+
+/*
+ * Sends the rvalue val on ch, suspending the current coroutine if the
+ * channel is full and nobody is receiving.
+ */
+void channel_send(pal_vm* vm, channel* ch, value* val);
+
+/*
+ * Returns the next rvalue from ch. If there is none the current
+ * coroutine is suspended and 0 is returned; it is resumed with the
+ * value once it is available.
+ */
+value* channel_receive(pal_vm* vm, channel* ch);
+
+#endif
@@ -1,40 +1,48 @@
 #include <stdarg.h>
+#include <stdlib.h>
 #include "error.h"
 #include "builtins.h"
+#include "metrics.h"
+#include "probes.h"
 
-int err_count = 0;
-
-static char* filename;
-static FILE* err;
-static int max_err_count = 5;
-static char* err_file;
-static int err_line;
-
-void init_error(char* f, FILE* e)
+void init_error_log(error_log* log, char* filename)
 {
-    filename = f;
-    err = e;
+    log->filename = filename;
+    log->count = 0;
+    log->messages = list_new();
 }
 
-void error(int line, char* msg)
+void error(error_log* log, int line, char* msg)
 {
-    if (err_count < max_err_count) {
-        fprintf(err, "%s:%d: %s\n", filename, line&0xFFFFFF, msg);
-        err_count++;
-    }
+    char* format = "%s:%d: %s\n";
+    int len = snprintf(0, 0, format, log->filename, line&0xFFFFFF, msg);
+    char* message = malloc(len+1);
+    snprintf(message, len+1, format, log->filename, line&0xFFFFFF, msg);
+    list_append(log->messages, message);
+    log->count++;
 }
 
-void set_error_location(char* file, int line)
+int print_errors(error_log* log, FILE* file, int max)
 {
-    err_file = file;
-    err_line = line;
+    int n = log->count < max ? log->count : max;
+    for (int i = 0; i < n; i++) {
+        fputs(list_element(log->messages, i), file);
+    }
+    return n;
 }
 
-void runtime_error(char* format, ...)
+void runtime_error(pal_vm* vm, char* format, ...)
 {
+    FILE* err = vm->err;
     va_list argp;
     va_start(argp, format);
-    fprintf(err, "%s:%d:runtime error: ", err_file, err_line);
+    atomic_fetch_add_explicit(vm->errors, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics_totals.errors, 1, memory_order_relaxed);
+    PROBE3(runtime__error, vm->loc ? vm->loc->file : 0, vm->loc ? vm->loc->line : 0, format);
+    if (vm->loc)
+        fprintf(err, "%s:%d:runtime error: ", vm->loc->file, vm->loc->line);
+    else
+        fprintf(err, "runtime error: ");
     while (*format) {
         if (*format == '%') {
             format++;
@@ -66,15 +74,15 @@ void runtime_error(char* format, ...)
     va_end(argp);
 }
 
-void lookup_error(char* name)
+void lookup_error(pal_vm* vm, char* name)
 {
-    runtime_error("unknown name '%s'", name);
+    runtime_error(vm, "unknown name '%s'", name);
 }
 
-void apply_error(char* op, value* val1, value* val2)
+void apply_error(pal_vm* vm, char* op, value* val1, value* val2)
 {
     if (val2)
-        runtime_error("'%s' applied to %v and %v", op, val1, val2);
+        runtime_error(vm, "'%s' applied to %v and %v", op, val1, val2);
     else
-        runtime_error("'%s' applied to %v", op, val1);
+        runtime_error(vm, "'%s' applied to %v", op, val1);
 }
@@ -2,24 +2,39 @@
 #define ERROR_H
 
 #include <stdio.h>
+#include "list.h"
 #include "value.h"
+#include "vm.h"
 
-extern int err_count;
+/*
+ * The compile errors of one source file. They are collected and
+ * printed afterwards, so that files compiled concurrently report them
+ * in the order of the files.
+ */
+typedef struct {
+    char* filename;
+    int count;
+    list* messages;
+} error_log;
 
-void init_error(char* filename, FILE* err);
+void init_error_log(error_log* log, char* filename);
 
-void error(int line, char* msg);
+void error(error_log* log, int line, char* msg);
 
 /*
- * Runtime errors.
+ * Prints at most max of the errors in log to file and returns the
+ * number printed.
  */
+int print_errors(error_log* log, FILE* file, int max);
 
-void set_error_location(char* file, int line);
+/*
+ * Runtime errors, reported at the current operation of vm.
+ */
 
-void runtime_error(char* format, ...);
+void runtime_error(pal_vm* vm, char* format, ...);
 
-void lookup_error(char* name);
+void lookup_error(pal_vm* vm, char* name);
 
-void apply_error(char* op, value* val1, value* val2);
+void apply_error(pal_vm* vm, char* op, value* val1, value* val2);
 
 #endif
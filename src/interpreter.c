@@ -1,35 +1,147 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#include "allocprof.h"
 #include "builtins.h"
+#include "callprof.h"
+#include "census.h"
 #include "code.h"
 #include "config.h"
+#include "coro.h"
 #include "error.h"
 #include "gc.h"
 #include "interpreter.h"
+#include "io.h"
+#include "memo.h"
+#include "metrics.h"
+#include "probes.h"
+#include "profile.h"
 #include "stack.h"
+#include "status.h"
 #include "strings.h"
 #include "value.h"
 
-typedef struct {
-    op op;
-    union {
-        INTEGER integer;
-        REAL real;
-        int ref;
-        int n;
-        int* refs;
-    } args;
-    int line;
-    char* file;
-} operation;
-
-operation* program;
-int program_len;
-
-void init_interpreter(BYTE* code, int code_len, char** files)
+decode_stats decode_counters;
+atomic_int interrupts;
+
+/*
+ * Decodes the instruction at code[*n] into o and advances *n. For
+ * LABEL, PARAM and EQU, args.n is the label number, and equ is set to
+ * the value of an EQU. Names are interned in st, or, unless intern is
+ * set, looked up among the names already interned.
+ */
+static void decode_op(BYTE* code, int* n, char** files, strings* st, int intern,
+                      operation* o, int* equ)
+{
+    int i = *n;
+    op op = code[i];
+    i++;
+    int line = decode_int(&code[i]);
+    i += 4;
+    o->op = op;
+    o->file = files[line>>24];
+    o->line = line&0xFFFFFF;
+    switch (op) {
+    case OP_LOADN:
+        o->args.integer = decode_integer(&code[i]);
+        i += 8;
+        break;
+    case OP_LOADF:
+        o->args.real = decode_real(&code[i]);
+        i += 8;
+        break;
+    case OP_INITNAME:
+    case OP_DECLNAME:
+    case OP_DECLLABEL:
+    case OP_LOADR:
+    case OP_LOADL:
+    case OP_LOADS: {
+        int len = decode_int(&code[i]);
+        i += 4;
+        char s[len+1];
+        decode_string(&code[i], s, len);
+        i += len;
+        o->args.ref = intern ? string_to_ref(st, s) : string_to_ref_if_exists(st, s);
+        break;
+    }
+    case OP_INITNAMES:
+    case OP_DECLNAMES: {
+        int len = decode_int(&code[i]);
+        i += 4;
+        int* refs = malloc((len+1)*sizeof(int));
+        refs[0] = len;
+        for (int j = 1; j <= len; j++) {
+            int slen = decode_int(&code[i]);
+            i += 4;
+            char s[slen+1];
+            decode_string(&code[i], s, slen);
+            i += slen;
+            refs[j] = intern ? string_to_ref(st, s) : string_to_ref_if_exists(st, s);
+        }
+        o->args.refs = refs;
+        break;
+    }
+    case OP_TUPLE:
+    case OP_UPDATE:
+    case OP_SETLABES:
+    case OP_MEMBERS:
+    case OP_SETUP:
+    case OP_LABEL:
+    case OP_PARAM:
+        o->args.n = decode_int(&code[i]);
+        i += 4;
+        break;
+    case OP_EQU:
+        o->args.n = decode_int(&code[i]);
+        i += 4;
+        *equ = decode_int(&code[i]);
+        i += 4;
+        break;
+    default:
+        break;
+    }
+    *n = i;
+}
+
+static void set_int(int** ints, int* max, int i, int val)
+{
+    if (i >= *max) {
+        int new_max = *max;
+        while (i >= new_max) new_max *= 2;
+        *ints = realloc(*ints, new_max*sizeof(int));
+        memset(*ints+*max, 0, (new_max-*max)*sizeof(int));
+        *max = new_max;
+    }
+    (*ints)[i] = val;
+}
+
+static pal_program* new_program(operation* ops, int len, strings* st,
+                                char** files, int files_len)
 {
-    program = calloc(code_len, sizeof(operation));
-    init_strings();
+    /* interned here, so that the table is complete once loaded */
+    string_to_ref(st, "**res**");
+
+    pal_program* prog = malloc(sizeof(pal_program));
+    prog->ops = ops;
+    prog->len = len;
+    prog->strings = st;
+    prog->files = files;
+    prog->files_len = files_len;
+    atomic_init(&prog->refs, 1);
+    prog->code = 0;
+    prog->code_owned = 0;
+    prog->labels = 0;
+    prog->bodies = 0;
+    prog->bodies_len = 0;
+    PROBE2(program__load, prog, len);
+    return prog;
+}
+
+static pal_program* load_eager(BYTE* code, int code_len, char** files, int files_len)
+{
+    operation* program = calloc(code_len, sizeof(operation));
+    int program_len = 0;
+    strings* st = new_strings();
     /* references to params/labels */
     int* refv = calloc(code_len, sizeof(int));
     int refp = 0;
@@ -37,144 +149,280 @@ void init_interpreter(BYTE* code, int code_len, char** files)
 
     int n = 0;
     while (n < code_len) {
-        op op = code[n];
-        n++;
-        int line = decode_int(&code[n]);
-        n += 3;
-        char* file = files[line>>24];
-        line = line&0xFFFFFF;
-        switch (op) {
-        case OP_LOADN: {
-            n++;
-            INTEGER i = decode_integer(&code[n]);
-            n += 8;
-            program[program_len].op = op;
-            program[program_len].args.integer = i;
-            program[program_len].file = file;
-            program[program_len].line = line;
-            program_len++;
+        operation* o = &program[program_len];
+        int N;
+        decode_op(code, &n, files, st, 1, o, &N);
+        switch (o->op) {
+        case OP_LABEL:
+            params[o->args.n] = program_len;
             break;
-        }
-        case OP_LOADF: {
-            n++;
-            REAL real = decode_real(&code[n]);
-            n += 8;
-            program[program_len].op = op;
-            program[program_len].args.real = real;
-            program[program_len].file = file;
-            program[program_len].line = line;
-            program_len++;
+        case OP_EQU:
+            params[o->args.n] = N;
             break;
-        }
-        case OP_INITNAME:
-        case OP_DECLNAME:
-        case OP_DECLLABEL:
-        case OP_LOADR:
-        case OP_LOADL:
-        case OP_LOADS: {
-            n++;
-            int len = decode_int(&code[n]);
-            n += 4;
-            char s[len+1];
-            decode_string(&code[n], s, len);
-            n += len;
-            int ref = string_to_ref(s);
-            program[program_len].op = op;
-            program[program_len].args.ref = ref;
-            program[program_len].file = file;
-            program[program_len].line = line;
+        case OP_PARAM:
+            refv[refp++] = o->args.n;
+            refv[refp++] = program_len;
             program_len++;
             break;
-        }
-        case OP_INITNAMES:
-        case OP_DECLNAMES: {
-            n++;
-            int len = decode_int(&code[n]);
-            n += 4;
-            int* refs = malloc((len+1)*sizeof(int));
-            refs[0] = len;
-            for (int i = 1; i <= len; i++) {
-                int slen = decode_int(&code[n]);
-                n += 4;
-                char s[slen+1];
-                decode_string(&code[n], s, slen);
-                n += slen;
-                int ref = string_to_ref(s);
-                refs[i] = ref;
-            }
-            program[program_len].op = op;
-            program[program_len].args.refs = refs;
-            program[program_len].file = file;
-            program[program_len].line = line;
+        default:
             program_len++;
             break;
         }
-        case OP_TUPLE:
-        case OP_UPDATE:
-        case OP_SETLABES:
-        case OP_MEMBERS:
-        case OP_SETUP: {
-            n++;
-            int i = decode_int(&code[n]);
-            n += 4;
-            program[program_len].op = op;
-            program[program_len].args.n = i;
-            program[program_len].file = file;
-            program[program_len].line = line;
-            program_len++;
+    }
+
+    /* resolve params */
+    for (int i = 0; i < refp; i += 2) {
+        program[refv[i+1]].args.n = params[refv[i]];
+    }
+    free(refv);
+    free(params);
+
+    atomic_fetch_add(&decode_counters.total, program_len);
+    atomic_fetch_add(&decode_counters.decoded, program_len);
+    return new_program(program, program_len, st, files, files_len);
+}
+
+/*
+ * Decoding in two steps. The loader decodes the code outside of
+ * function bodies, interns all names and computes the label values,
+ * while it only indexes the bodies, recognised by the code of a lambda
+ * expression:
+ *
+ *     FORMCLOSURE PARAM L JUMP PARAM M LABEL L body LABEL M
+ *
+ * L is bound to an OP_ENTER, which decodes the body when a closure is
+ * first applied and jumps to it. The operations of each body, without
+ * the bodies nested in it, get their own range after those of the main
+ * program, so that the memory of bodies never entered is not touched.
+ */
+static pal_program* load_lazy(BYTE* code, int code_len, char** files, int files_len)
+{
+    /* there are fewer operations than bytes, untouched pages cost nothing */
+    operation* program = calloc(code_len, sizeof(operation));
+    int total = 0;
+    int decoded = 0;
+    strings* st = new_strings();
+    int refs_max = 256;
+    int* refv = malloc(refs_max*sizeof(int));
+    int refp = 0;
+    /* the labels as operation index in a range, or -1 and value */
+    int ranges_max = 256;
+    int* label_ranges = calloc(ranges_max, sizeof(int));
+    int labels_max = 256;
+    int* labels = calloc(labels_max, sizeof(int));
+    /* range 0 is the main program, range i+1 body i */
+    int bodies_max = 256;
+    lazy_body* bodies = malloc(bodies_max*sizeof(lazy_body));
+    operation* enters = malloc(bodies_max*sizeof(operation));
+    int* lens = calloc(bodies_max+1, sizeof(int));
+    int bodies_len = 0;
+    /* the bodies being indexed */
+    int open_max = 64;
+    int* open = malloc(open_max*sizeof(int));
+    int depth = 0;
+    /* the progress in the code of a lambda expression, and L and M */
+    int pattern = 0;
+    int L = 0;
+    int M = 0;
+
+    int n = 0;
+    while (n < code_len) {
+        int start = n;
+        int range = depth == 0 ? 0 : open[depth-1]+1;
+        operation tmp;
+        operation* o = range == 0 ? &program[lens[0]] : &tmp;
+        int N;
+        decode_op(code, &n, files, st, 1, o, &N);
+        op op = o->op;
+        switch (op) {
+        case OP_FORMCLOSURE:
+            pattern = 1;
             break;
-        }
-        case OP_LABEL: {
-            n++;
-            int L = decode_int(&code[n]);
-            n += 4;
-            params[L] = program_len;
+        case OP_PARAM:
+            if (pattern == 1) L = o->args.n;
+            if (pattern == 3) M = o->args.n;
+            pattern = pattern == 1 || pattern == 3 ? pattern+1 : 0;
             break;
-        }
-        case OP_PARAM: {
-            n++;
-            int L = decode_int(&code[n]);
-            n += 4;
-            refv[refp++] = L;
-            refv[refp++] = program_len;
-            program[program_len].op = op;
-            program[program_len].args.n = 0;
-            program[program_len].file = file;
-            program[program_len].line = line;
-            program_len++;
+        case OP_JUMP:
+            pattern = pattern == 2 ? 3 : 0;
             break;
-        }
-        case OP_EQU: {
-            n++;
-            int L = decode_int(&code[n]);
-            n += 4;
-            int N = decode_int(&code[n]);
-            n += 4;
-            params[L] = N;
+        case OP_LABEL:
+            if (pattern == 4 && o->args.n == L) {
+                if (bodies_len == bodies_max) {
+                    bodies_max *= 2;
+                    bodies = realloc(bodies, bodies_max*sizeof(lazy_body));
+                    enters = realloc(enters, bodies_max*sizeof(operation));
+                    lens = realloc(lens, (bodies_max+1)*sizeof(int));
+                }
+                lazy_body* b = &bodies[bodies_len];
+                b->start = n;
+                /* the label of the end, until it is reached */
+                b->end = M;
+                atomic_init(&b->decoded, 0);
+                /* the OP_ENTER in the enclosing range */
+                enters[bodies_len] = *o;
+                set_int(&label_ranges, &ranges_max, L, range);
+                set_int(&labels, &labels_max, L, lens[range]++);
+                lens[bodies_len+1] = 0;
+                if (depth == open_max) {
+                    open_max *= 2;
+                    open = realloc(open, open_max*sizeof(int));
+                }
+                open[depth++] = bodies_len++;
+            }
+            else {
+                if (depth > 0 && bodies[open[depth-1]].end == o->args.n) {
+                    bodies[open[--depth]].end = start;
+                    range = depth == 0 ? 0 : open[depth-1]+1;
+                }
+                set_int(&label_ranges, &ranges_max, o->args.n, range);
+                set_int(&labels, &labels_max, o->args.n, lens[range]);
+            }
+            pattern = 0;
+            break;
+        case OP_EQU:
+            set_int(&label_ranges, &ranges_max, o->args.n, -1);
+            set_int(&labels, &labels_max, o->args.n, N);
+            pattern = 0;
             break;
-        }
         default:
-            n++;
-            program[program_len].op = op;
-            program[program_len].file = file;
-            program[program_len].line = line;
-            program_len++;
+            pattern = 0;
             break;
         }
+        if (op == OP_LABEL || op == OP_EQU) continue;
+
+        total++;
+        if (range != 0) {
+            if (op == OP_INITNAMES || op == OP_DECLNAMES) free(o->args.refs);
+        }
+        else {
+            if (op == OP_PARAM) {
+                if (refp+2 > refs_max) {
+                    refs_max *= 2;
+                    refv = realloc(refv, refs_max*sizeof(int));
+                }
+                refv[refp++] = o->args.n;
+                refv[refp++] = lens[0];
+            }
+            decoded++;
+        }
+        lens[range]++;
     }
 
-    /* resolve params */
+    /* the main program ends with a jump past the bodies */
+    int main_len = lens[0];
+    lens[0] += 2;
+    int program_len = lens[0];
+    for (int i = 0; i < bodies_len; i++) {
+        bodies[i].first_op = program_len;
+        program_len += lens[i+1];
+    }
+    for (int i = 0; i < labels_max; i++) {
+        int range = label_ranges[i];
+        if (range > 0) labels[i] += bodies[range-1].first_op;
+    }
+    operation* end = &program[main_len];
+    end[0] = main_len > 0 ? end[-1] : (operation){ 0 };
+    end[0].op = OP_JUMP;
+    end[1] = end[0];
+    end[1].op = OP_PARAM;
+    end[1].args.n = program_len;
     for (int i = 0; i < refp; i += 2) {
-        program[refv[i+1]].args.n = params[refv[i]];
+        program[refv[i+1]].args.n = labels[refv[i]];
     }
-    refp = 0;
+    /* those of nested bodies are set when the enclosing one is decoded */
+    for (int i = 0; i < bodies_len; i++) {
+        operation* o = &enters[i];
+        if (label_ranges[o->args.n] != 0) continue;
+        int enter_op = labels[o->args.n];
+        o->op = OP_ENTER;
+        o->args.n = i;
+        program[enter_op] = *o;
+    }
+    free(refv);
+    free(label_ranges);
+    free(enters);
+    free(lens);
+    free(open);
+
+    atomic_fetch_add(&decode_counters.total, total);
+    atomic_fetch_add(&decode_counters.decoded, decoded);
+    pal_program* prog = new_program(program, program_len, st, files, files_len);
+    prog->code = code;
+    prog->labels = labels;
+    prog->bodies = bodies;
+    prog->bodies_len = bodies_len;
+    pthread_mutex_init(&prog->lock, 0);
+    return prog;
+}
+
+pal_program* load_program(BYTE* code, int code_len, char** files, int files_len, int lazy)
+{
+    pal_program* program = load_program_in_place(code, code_len, files, files_len, lazy);
+    if (lazy)
+        program->code_owned = 1;
+    else
+        free(code);
+    return program;
+}
+
+pal_program* load_program_in_place(BYTE* code, int code_len, char** files, int files_len, int lazy)
+{
+    if (lazy) return load_lazy(code, code_len, files, files_len);
+    return load_eager(code, code_len, files, files_len);
+}
+
+/*
+ * Decodes the operations of the body into its range. The bodies
+ * nested in it follow it in the index, and only their OP_ENTER, at
+ * their LABEL, is in the range.
+ */
+static void decode_body(pal_program* program, int i)
+{
+    lazy_body* b = &program->bodies[i];
+    pthread_mutex_lock(&program->lock);
+    if (atomic_load_explicit(&b->decoded, memory_order_relaxed)) {
+        pthread_mutex_unlock(&program->lock);
+        return;
+    }
+    int pc = b->first_op;
+    int decoded = 0;
+    int next = i+1;
+    int n = b->start;
+    operation o;
+    while (n < b->end) {
+        if (next < program->bodies_len && program->bodies[next].start == n) {
+            /* o is its LABEL */
+            o.op = OP_ENTER;
+            o.args.n = next;
+            program->ops[pc++] = o;
+            /* skip the nested body and the bodies nested in it */
+            n = program->bodies[next].end;
+            while (next < program->bodies_len && program->bodies[next].start < n) next++;
+            continue;
+        }
+        int N;
+        decode_op(program->code, &n, program->files, program->strings, 0, &o, &N);
+        if (o.op == OP_LABEL || o.op == OP_EQU) continue;
+        if (o.op == OP_PARAM) o.args.n = program->labels[o.args.n];
+        program->ops[pc++] = o;
+        decoded++;
+    }
+    atomic_fetch_add(&decode_counters.decoded, decoded);
+    atomic_store_explicit(&b->decoded, 1, memory_order_release);
+    pthread_mutex_unlock(&program->lock);
 }
 
-static void init_builtins(builtin b[], value** env)
+static void init_builtins(pal_vm* vm, builtin b[], value** env)
 {
     value* E = *env;
     while (b->name) {
-        int n = string_to_ref(b->name);
+        /* a builtin not named by the program cannot be used by it */
+        int n = string_to_ref_if_exists(vm->program->strings, b->name);
+        if (n < 0) {
+            b++;
+            continue;
+        }
         value* A = make_builtin(b->name, b->fn);
         A = make_lvalue(A);
         E = env_bind(n, A, E);
@@ -183,36 +431,69 @@ static void init_builtins(builtin b[], value** env)
     *env = E;
 }
 
-void execute()
+static void serve_interrupts(pal_vm* vm, int pc, stack* S, value* E, value* A, value* B)
 {
-    GC_INIT();
+    int requests = atomic_exchange(&interrupts, 0);
+    if (requests & INTERRUPT_PROFILE) profile_sample(vm, pc, S);
+    if (requests & INTERRUPT_CENSUS) census_take(vm, S, E, A, B);
+    if (requests & INTERRUPT_STATUS) status_write(vm, pc, S);
+    if (requests & INTERRUPT_METRICS) metrics_write(vm, S);
+}
+
+/* each caller runs an interpret on the C stack */
+#define MAX_CALLERS 2000
 
-    value* guess_rvalue = make_value(V_GUESS);
-    value* true_rvalue = make_value(V_TRUE);
-    value* false_rvalue = make_value(V_FALSE);
-    value* dummy_rvalue = make_value(V_DUMMY);
-    value* nil_rvalue = make_tuple(0);
-    int resname = string_to_ref("**res**");
-
-    int pc = 0;
-    int old_pc = 0;
-    value* new_env = 0;
-    stack* S = 0;
-    value* E = env_bind(-1, dummy_rvalue, 0);
+/* the base of the stacks of the running interpret, 0 for the outermost */
+#define stack_base(_vm) ((_vm)->callers ? (_vm)->callers->base : 0)
+
+/*
+ * A res, goto or J whose target was created with another stack base
+ * would leave the interpret of a closure applied by a builtin without
+ * returning to the builtin, or enter one that has returned. Reports
+ * it, and returns true if the interpret must stop, as the closure
+ * cannot finish: its builtin then gets nil.
+ */
+static int cross_builtin(pal_vm* vm)
+{
+    runtime_error(vm, "%s", "jump out of or into a function applied by a builtin");
+    if (!vm->callers) return 0;
+    if (callprof_on) callprof_unwind(vm, 0);
+    return 1;
+}
+
+/*
+ * Runs the program from pc until it reaches the end of the program,
+ * returns to the negative pc stored in the saved frame of a
+ * call_closure or coroutine, or a builtin suspends the current
+ * coroutine. Returns the final stack.
+ */
+static stack* interpret(pal_vm* vm, int pc, int old_pc, value* new_env, stack* S, value* E)
+{
+    operation* program = vm->program->ops;
+    int program_len = vm->program->len;
+    value* guess_rvalue = vm->guess_rvalue;
+    value* true_rvalue = vm->true_rvalue;
+    value* false_rvalue = vm->false_rvalue;
+    value* dummy_rvalue = vm->dummy_rvalue;
+    value* nil_rvalue = vm->nil_rvalue;
     value* A = 0;
     value* B = 0;
+    /* the memo and key for the frame of a memoised closure being applied */
+    value* memo_pending = 0;
+    value* memo_key = 0;
 
-    init_builtins(builtins, &E);
-
-    while (pc < program_len) {
-        set_error_location(program[pc].file, program[pc].line);
+    while (pc >= 0 && pc < program_len) {
+        if (atomic_load_explicit(&interrupts, memory_order_relaxed))
+            serve_interrupts(vm, pc, S, E, A, B);
+        vm->loc = &program[pc];
+        vm->instructions++;
         switch (program[pc].op) {
         case OP_LOADL: {
             int name = program[pc].args.ref;
             pc++;
             A = env_lookup(name, E);
             if (!A) {
-                lookup_error(ref_to_string(name));
+                lookup_error(vm, ref_to_string(vm->program->strings, name));
                 A = make_lvalue(nil_rvalue);
             }
             push(S, A);
@@ -223,7 +504,7 @@ void execute()
             pc++;
             A = env_lookup(name, E);
             if (!A) {
-                lookup_error(ref_to_string(name));
+                lookup_error(vm, ref_to_string(vm->program->strings, name));
                 A = nil_rvalue;
             }
             else {
@@ -241,7 +522,7 @@ void execute()
         case OP_LOADS: {
             int ref = program[pc].args.ref;
             pc++;
-            char* string = ref_to_string(ref);
+            char* string = ref_to_string(vm->program->strings, ref);
             A = make_string(string);
             push(S, A);
             break;
@@ -335,6 +616,12 @@ void execute()
             pc++;
             pop(S, A);
             B = value_rvalue(A);
+            if (value_is_type(B, V_RANGE)) {
+                for (int i = n-1; i >= 0; i--) {
+                    push(S, range_element(B, i));
+                }
+                break;
+            }
             for (int i = n-1; i >= 0; i--) {
                 push(S, value_tuple_val(B, i));
             }
@@ -343,14 +630,14 @@ void execute()
         case OP_NOT: {
             pc++;
             pop(S, A);
-            if (A == false_rvalue) {
+            if (value_is_type(A, V_FALSE)) {
                 A = true_rvalue;
             }
-            else if (A == true_rvalue) {
+            else if (value_is_type(A, V_TRUE)) {
                 A = false_rvalue;
             }
             else {
-                apply_error("not", A, 0);
+                apply_error(vm, "not", A, 0);
                 A = false_rvalue;
             }
             push(S, A);
@@ -359,14 +646,14 @@ void execute()
         case OP_LOGAND: {
             pc++;
             pop2(S, A, B);
-            if (A == true_rvalue) {
+            if (value_is_type(A, V_TRUE)) {
                 A = B;
             }
-            else if (A == false_rvalue) {
+            else if (value_is_type(A, V_FALSE)) {
                 /* A = A */
             }
             else {
-                apply_error("&", A, B);
+                apply_error(vm, "&", A, B);
                 A = false_rvalue;
             }
             push(S, A);
@@ -375,14 +662,14 @@ void execute()
         case OP_LOGOR: {
             pc++;
             pop2(S, A, B);
-            if (A == true_rvalue) {
+            if (value_is_type(A, V_TRUE)) {
                 /* A = A */
             }
-            else if (A == false_rvalue) {
+            else if (value_is_type(A, V_FALSE)) {
                 A = B;
             }
             else {
-                apply_error("|", A, B);
+                apply_error(vm, "|", A, B);
                 A = false_rvalue;
             }
             push(S, A);
@@ -391,8 +678,17 @@ void execute()
         case OP_AUG: {
             pc++;
             pop2(S, A, B);
-            if (!value_is_type(A, V_TUPLE)) {
-                apply_error("aug", A, B);
+            if (value_is_type(A, V_RANGE)) {
+                int n = value_range_size(A);
+                value* T = make_tuple(n+1);
+                value_tuple_val(T, 0) = B;
+                for (int i = 0; i < n; i++) {
+                    value_tuple_val(T, i+1) = make_lvalue(make_integer(value_range_val(A, i)));
+                }
+                A = T;
+            }
+            else if (!value_is_type(A, V_TUPLE)) {
+                apply_error(vm, "aug", A, B);
                 A = nil_rvalue;
             }
             else {
@@ -418,7 +714,7 @@ void execute()
                 A = make_real(value_real(A)*value_real(B));
             }
             else {
-                apply_error("*", A, B);
+                apply_error(vm, "*", A, B);
                 A = make_integer(0);
             }
             push(S, A);
@@ -429,7 +725,7 @@ void execute()
             pop2(S, A, B);
             if (value_is_types(A, B, V_INTEGER)) {
                 if (value_integer(B) == 0) {
-                    runtime_error("%s", "division by zero");
+                    runtime_error(vm, "%s", "division by zero");
                     A = make_integer(0);
                 }
                 else {
@@ -440,7 +736,7 @@ void execute()
                 A = make_real(value_real(A)/value_real(B));
             }
             else {
-                apply_error("/", A, B);
+                apply_error(vm, "/", A, B);
                 A = make_integer(0);
             }
             push(S, A);
@@ -456,7 +752,7 @@ void execute()
                 A = make_real(value_real(A)+value_real(B));
             }
             else {
-                apply_error("+", A, B);
+                apply_error(vm, "+", A, B);
                 A = make_integer(0);
             }
             push(S, A);
@@ -472,7 +768,7 @@ void execute()
                 A = make_real(value_real(A)-value_real(B));
             }
             else {
-                apply_error("-", A, B);
+                apply_error(vm, "-", A, B);
                 A = make_integer(0);
             }
             push(S, A);
@@ -486,7 +782,7 @@ void execute()
                 INTEGER expt = value_integer(B);
                 INTEGER res = 1;
                 if (expt < 0) {
-                    apply_error("**", A, B);
+                    apply_error(vm, "**", A, B);
                 }
                 else {
                     while (expt != 0) {
@@ -504,7 +800,7 @@ void execute()
                 A = make_real(res);
             }
             else {
-                apply_error("**", A, B);
+                apply_error(vm, "**", A, B);
                 A = make_integer(0);
             }
             push(S, A);
@@ -514,7 +810,7 @@ void execute()
             pc++;
             pop(S, A);
             if (!value_is_type(A, V_INTEGER) && !value_is_type(A, V_REAL)) {
-                apply_error("+", A, 0);
+                apply_error(vm, "+", A, 0);
                 A = make_integer(0);
             }
             push(S, A);
@@ -530,7 +826,7 @@ void execute()
                 A = make_real(-value_real(A));
             }
             else {
-                apply_error("-", A, 0);
+                apply_error(vm, "-", A, 0);
                 A = make_integer(0);
             }
             push(S, A);
@@ -565,7 +861,7 @@ void execute()
             pop2(S, A, B);
             int res = value_compare(A, B);
             if (res < -1) {
-                apply_error("<", A, B);
+                apply_error(vm, "<", A, B);
                 A = false_rvalue;
 
             }
@@ -583,7 +879,7 @@ void execute()
             pop2(S, A, B);
             int res = value_compare(A, B);
             if (res < -1) {
-                apply_error("le", A, B);
+                apply_error(vm, "le", A, B);
                 A = false_rvalue;
             }
             else if (res <= 0) {
@@ -600,7 +896,7 @@ void execute()
             pop2(S, A, B);
             int res = value_compare(A, B);
             if (res < -1) {
-                apply_error("ge", A, B);
+                apply_error(vm, "ge", A, B);
                 A = false_rvalue;
             }
             else if (res >= 0) {
@@ -617,7 +913,7 @@ void execute()
             pop2(S, A, B);
             int res = value_compare(A, B);
             if (res < -1) {
-                apply_error("gr", A, B);
+                apply_error(vm, "gr", A, B);
                 A = false_rvalue;
             }
             else if (res > 0) {
@@ -643,7 +939,7 @@ void execute()
                 pc += 2;
             }
             else {
-                runtime_error("%s: %v", "not a truthvalue", A);
+                runtime_error(vm, "%s: %v", "not a truthvalue", A);
                 pc += 2;
             }
             break;
@@ -654,15 +950,19 @@ void execute()
             A = value_rvalue(A); /* A is an LVALUE, get RVALUE */
             switch (value_type(A)) {
             case V_CLOSURE:
+                if (callprof_on) callprof_call(vm, A->v.closure.pc, pc-1);
+                PROBE2(function__entry, A->v.closure.pc, pc-1);
+                vm->closure_calls++;
                 old_pc = pc;
                 pc = A->v.closure.pc;
                 new_env = A->v.closure.env;
                 break;
             case V_TUPLE:
+                if (callprof_on) callprof_index(vm, pc-1);
                 pop(S, B);
                 B = value_rvalue(B);
                 if (!value_is_type(B, V_INTEGER)) {
-                    runtime_error("%v applied to %v", A, B);
+                    runtime_error(vm, "%v applied to %v", A, B);
                     A = make_lvalue(nil_rvalue);
                     push(S, A);
                     break;
@@ -672,51 +972,110 @@ void execute()
                     A = value_tuple_val(A, n-1);
                 }
                 else {
-                    runtime_error("%v applied to %v", A, B);
+                    runtime_error(vm, "%v applied to %v", A, B);
                     A = make_lvalue(nil_rvalue);
                 }
                 push(S, A);
                 break;
-            case V_TUPLEMAKER:
+            case V_RANGE:
+                if (callprof_on) callprof_index(vm, pc-1);
                 pop(S, B);
-                n = A->v.tuplemaker.n;
-                int len = A->v.tuplemaker.len;
-                if (n < len-1) {
-                    value* val = make_value(V_TUPLEMAKER);
-                    val->v.tuplemaker.len = len;
-                    val->v.tuplemaker.n = n+1;
-                    val->v.tuplemaker.values = GC_MALLOC(len*sizeof(value*));
-                    for (int i = 0; i < n; i++) {
-                        val->v.tuplemaker.values[i] = A->v.tuplemaker.values[i];
-                    }
-                    val->v.tuplemaker.values[n] = B;
-                    A = val;
+                B = value_rvalue(B);
+                if (!value_is_type(B, V_INTEGER)) {
+                    runtime_error(vm, "%v applied to %v", A, B);
+                    A = make_lvalue(nil_rvalue);
+                    push(S, A);
+                    break;
+                }
+                n = value_integer(B);
+                if (n > 0 && n <= value_range_size(A)) {
+                    A = range_element(A, n-1);
                 }
                 else {
-                    value* val = make_tuple(len);
-                    for (int i = 0; i < n; i++) {
-                        value_tuple_val(val, i) = value_tuple_val(A, i);
-                    }
-                    value_tuple_val(val, n) = B;
-                    A = val;
+                    runtime_error(vm, "%v applied to %v", A, B);
+                    A = make_lvalue(nil_rvalue);
                 }
+                push(S, A);
+                break;
+            case V_TUPLEMAKER:
+                pop(S, B);
+                A = tuplemaker_add(A, B);
                 push(S, make_lvalue(A));
                 break;
             case V_BUILTIN:
                 pop(S, B);
-                A = A->v.builtin.fn(B, S, E);
+                vm->apply_pc = pc;
+                vm->apply_S = S;
+                if (callprof_on) callprof_builtin(vm, A->v.builtin.name, pc-1);
+                PROBE2(builtin__entry, A->v.builtin.name, pc-1);
+                vm->builtin_calls++;
+                A = A->v.builtin.fn(vm, B, S, E);
+                PROBE0(builtin__return);
+                if (callprof_on) callprof_leave(vm);
+                if (vm->coro_switch) {
+                    /* the result is pushed when the coroutine is resumed */
+                    coro* c = coro_current(vm);
+                    c->pc = pc;
+                    c->old_pc = old_pc;
+                    c->new_env = new_env;
+                    c->S = S;
+                    c->E = E;
+                    return S;
+                }
+                push(S, A);
+                break;
+            case V_MEMO:
+                if (value_is_type(A->v.memo->fn, V_CLOSURE)) {
+                    /* applied like the closure, its frame stores the result */
+                    value* fn = A->v.memo->fn;
+                    memo_key = value_rvalue(S->value);
+                    B = memo_lookup(A, memo_key);
+                    if (B) {
+                        if (callprof_on) callprof_builtin(vm, "[memo]", pc-1);
+                        PROBE2(builtin__entry, "[memo]", pc-1);
+                        vm->builtin_calls++;
+                        PROBE0(builtin__return);
+                        if (callprof_on) callprof_leave(vm);
+                        pop(S, A);
+                        push(S, make_lvalue(B));
+                        break;
+                    }
+                    memo_pending = A;
+                    if (callprof_on) callprof_call(vm, fn->v.closure.pc, pc-1);
+                    PROBE2(function__entry, fn->v.closure.pc, pc-1);
+                    vm->closure_calls++;
+                    old_pc = pc;
+                    pc = fn->v.closure.pc;
+                    new_env = fn->v.closure.env;
+                    break;
+                }
+                pop(S, B);
+                vm->apply_pc = pc;
+                vm->apply_S = S;
+                if (callprof_on) callprof_builtin(vm, "[memo]", pc-1);
+                PROBE2(builtin__entry, "[memo]", pc-1);
+                vm->builtin_calls++;
+                A = memo_apply(vm, A, B);
+                PROBE0(builtin__return);
+                if (callprof_on) callprof_leave(vm);
                 push(S, A);
                 break;
             case V_JJ:
                 pop(S, B);
+                if (A->v.jj.base != stack_base(vm)) {
+                    if (cross_builtin(vm)) return 0;
+                    push(S, B);
+                    break;
+                }
                 pc = A->v.jj.pc;
                 E = A->v.jj.env;
                 S = A->v.jj.stack;
+                if (callprof_on) callprof_unwind(vm, S);
                 push(S, B);
                 break;
             default:
                 pop(S, B);
-                runtime_error("attempt to apply %v to %v", A, B);
+                runtime_error(vm, "attempt to apply %v to %v", A, B);
                 push(S, B);
                 break;
             }
@@ -725,8 +1084,15 @@ void execute()
         case OP_SAVE: {
             pc++;
             pop(S, B);
-            push(S, make_stack(old_pc, E, S));
+            value* frame = make_stack(old_pc, E, S);
+            if (memo_pending) {
+                frame->v.stack.memo = memo_pending;
+                frame->v.stack.key = memo_key;
+                memo_pending = 0;
+            }
+            push(S, frame);
             push(S, B);
+            if (callprof_on) callprof_save(vm, frame);
             if (new_env) {
                 E = new_env;
                 new_env = 0;
@@ -738,6 +1104,10 @@ void execute()
             pop(S, A);
             value* saved;
             pop(S, saved);
+            if (saved->v.stack.memo)
+                memo_store(saved->v.stack.memo, saved->v.stack.key, A);
+            if (callprof_on) callprof_return(vm, saved);
+            PROBE2(function__return, pc, saved->v.stack.pc);
             pc = saved->v.stack.pc;
             E = saved->v.stack.env;
             S = saved->v.stack.stack;
@@ -748,7 +1118,7 @@ void execute()
             pc++;
             pop(S, A);
             if (value_rvalue(A) != nil_rvalue) {
-                runtime_error("%s: %v", "function of no arguments", A);
+                runtime_error(vm, "%s: %v", "function of no arguments", A);
             }
             break;
         }
@@ -761,13 +1131,18 @@ void execute()
             pc++;
             pop(S, A);
             if (!value_is_type(A, V_LABEL)) {
-                runtime_error("%s %v", "cannot go to", A);
+                runtime_error(vm, "%s %v", "cannot go to", A);
                 A = dummy_rvalue;
                 break;
             }
+            if (A->v.label.base != stack_base(vm)) {
+                if (cross_builtin(vm)) return 0;
+                break;
+            }
             pc = A->v.label.pc;
             E = A->v.label.env;
             S = A->v.label.stack;
+            if (callprof_on) callprof_unwind(vm, S);
             break;
         }
         case OP_UPDATE: {
@@ -776,19 +1151,25 @@ void execute()
             pop2(S, A, B);
             if (n == 1) {
                 /* one update */
-                value_rvalue(B) = A;
+                update_lvalue(B, A);
             }
-            else if (value_is_type(A, V_TUPLE) && value_tuple_size(A) == n) {
+            else if (value_is_tuple(A) && value_order(A) == n) {
                 /* multiple update */
-                B = value_rvalue(B);
+                B = range_materialize(value_rvalue(B));
                 value* tmp = make_tuple(n);
+                if (value_is_type(A, V_RANGE)) {
+                    for (int i = 0; i < n; i++)
+                        value_tuple_val(tmp, i) = make_integer(value_range_val(A, i));
+                }
+                else {
+                    for (int i = 0; i < n; i++)
+                        value_tuple_val(tmp, i) = value_rvalue(value_tuple_val(A, i));
+                }
                 for (int i = 0; i < n; i++)
-                    value_tuple_val(tmp, i) = value_rvalue(value_tuple_val(A, i));
-                for (int i = 0; i < n; i++)
-                    value_rvalue(value_tuple_val(B, i)) = value_tuple_val(tmp, i);
+                    update_lvalue(value_tuple_val(B, i), value_tuple_val(tmp, i));
             }
             else {
-                runtime_error("%s", "conformality error in assignment");
+                runtime_error(vm, "%s", "conformality error in assignment");
             }
             A = dummy_rvalue;
             push(S, A);
@@ -807,12 +1188,12 @@ void execute()
             pc++;
             pop(S, A);
             A = value_rvalue(A);
-            if (!value_is_type(A, V_TUPLE) || value_tuple_size(A) != n) {
-                runtime_error("%s", "conformality error in definition");
+            if (!value_is_tuple(A) || value_order(A) != n) {
+                runtime_error(vm, "%s", "conformality error in definition");
                 break;
             }
             for (int i = 0; i < n; i++) {
-                B = value_tuple_val(A, i);
+                B = value_is_type(A, V_RANGE) ? range_element(A, i) : value_tuple_val(A, i);
                 E = env_bind(refs[i+1], B, E);
             }
             break;
@@ -832,14 +1213,17 @@ void execute()
             pc++;
             pop(S, A);
             A = value_rvalue(A);
-            if (!value_is_type(A, V_TUPLE) || value_tuple_size(A) != n) {
-                runtime_error("%s", "conformality error in recursive definition");
+            if (!value_is_tuple(A) || value_order(A) != n) {
+                runtime_error(vm, "%s", "conformality error in recursive definition");
                 break;
             }
             for (int i = 0; i < n; i++) {
                 B = env_lookup(refs[i+1], E);
                 if (!B) B = make_lvalue(nil_rvalue);
-                B->v.value = value_tuple_val(A, i)->v.value;
+                if (value_is_type(A, V_RANGE))
+                    B->v.value = make_integer(value_range_val(A, i));
+                else
+                    B->v.value = value_tuple_val(A, i)->v.value;
             }
             break;
         }
@@ -848,7 +1232,7 @@ void execute()
             pc++;
             int c = program[pc].args.ref;
             pc++;
-            A = make_label(c, E, S);
+            A = make_label(c, E, S, stack_base(vm));
             A = make_lvalue(A);
             E = env_bind(label, A, E);
             break;
@@ -889,17 +1273,23 @@ void execute()
         case OP_RES: {
             pc++;
             pop(S, A);
-            value* jjval = env_lookup(resname, E);
+            value* jjval = env_lookup(vm->resname, E);
             if (!jjval) jjval = make_lvalue(nil_rvalue);
             jjval = value_rvalue(jjval);
             if (!value_is_type(jjval, V_JJ)) {
-                runtime_error("%s", "incorrect use of res");
+                runtime_error(vm, "%s", "incorrect use of res");
+                push(S, A);
+                break;
+            }
+            if (jjval->v.jj.base != stack_base(vm)) {
+                if (cross_builtin(vm)) return 0;
                 push(S, A);
                 break;
             }
             pc = jjval->v.jj.pc;
             E = jjval->v.jj.env;
             S = jjval->v.jj.stack;
+            if (callprof_on) callprof_unwind(vm, S);
             push(S, A);
             break;
         }
@@ -908,13 +1298,228 @@ void execute()
             stack* s = S;
             while (!value_is_type(s->value, V_STACK)) s = S->next;
             A = s->value;
-            A = make_jj(A->v.stack.pc, A->v.stack.env, A->v.stack.stack);
+            A = make_jj(A->v.stack.pc, A->v.stack.env, A->v.stack.stack, stack_base(vm));
             push(S, A);
             break;
         }
+        case OP_ENTER: {
+            lazy_body* b = &vm->program->bodies[program[pc].args.n];
+            if (!atomic_load_explicit(&b->decoded, memory_order_acquire))
+                decode_body(vm->program, program[pc].args.n);
+            pc = b->first_op;
+            break;
+        }
         default:
-            runtime_error("%s %d", "unknown opcode", program[pc].op);
-            return;
+            runtime_error(vm, "%s %d", "unknown opcode", program[pc].op);
+            return S;
         }
     }
+    if (census_at_end && pc == program_len) census_take(vm, S, E, A, B);
+    return S;
+}
+
+static void free_program(pal_program* program)
+{
+    for (int i = 0; i < program->len; i++) {
+        op op = program->ops[i].op;
+        if (op == OP_INITNAMES || op == OP_DECLNAMES) free(program->ops[i].args.refs);
+    }
+    free(program->ops);
+    if (program->code_owned) free(program->code);
+    if (program->bodies) {
+        free(program->labels);
+        free(program->bodies);
+        pthread_mutex_destroy(&program->lock);
+    }
+    free_strings(program->strings);
+    for (int i = 0; i < program->files_len; i++) free(program->files[i]);
+    free(program->files);
+    free(program);
+}
+
+void retain_program(pal_program* program)
+{
+    atomic_fetch_add(&program->refs, 1);
+}
+
+void release_program(pal_program* program)
+{
+    if (atomic_fetch_sub(&program->refs, 1) == 1) free_program(program);
+}
+
+pal_vm* new_vm(pal_program* program, FILE* err)
+{
+    GC_INIT();
+
+    /* held by the host, so it must not be collected */
+    pal_vm* vm = GC_MALLOC_UNCOLLECTABLE(sizeof(pal_vm));
+    retain_program(program);
+    vm->program = program;
+    vm->guess_rvalue = make_value(V_GUESS);
+    vm->true_rvalue = make_value(V_TRUE);
+    vm->false_rvalue = make_value(V_FALSE);
+    vm->dummy_rvalue = make_value(V_DUMMY);
+    vm->nil_rvalue = make_tuple(0);
+    vm->resname = string_to_ref_if_exists(program->strings, "**res**");
+    vm->loc = 0;
+    vm->instructions = 0;
+    vm->closure_calls = 0;
+    vm->builtin_calls = 0;
+    memset(&vm->added, 0, sizeof(vm->added));
+    vm->err = err;
+    vm->errors = GC_NEW(atomic_int);
+    atomic_init(vm->errors, 0);
+    vm->coro_switch = 0;
+    vm->coro_allowed = 0;
+    vm->coro = 0;
+    vm->io = new_io_state();
+    vm->apply_pc = 0;
+    vm->apply_S = 0;
+    vm->callers = 0;
+    vm->calls = 0;
+
+    value* E = env_bind(-1, vm->dummy_rvalue, 0);
+    init_builtins(vm, builtins, &E);
+    init_builtins(vm, extra_builtins, &E);
+    vm->env = E;
+    vm->result = 0;
+    return vm;
+}
+
+void free_vm(pal_vm* vm)
+{
+    release_program(vm->program);
+    GC_FREE(vm);
+}
+
+pal_vm* fork_vm(pal_vm* vm)
+{
+    pal_vm* new = GC_NEW(pal_vm);
+    *new = *vm;
+    new->loc = 0;
+    new->instructions = 0;
+    new->closure_calls = 0;
+    new->builtin_calls = 0;
+    memset(&new->added, 0, sizeof(new->added));
+    new->coro_switch = 0;
+    new->coro_allowed = 0;
+    new->coro = 0;
+    /* the callers are on the stack of the thread of vm */
+    caller** c = &new->callers;
+    for (caller* p = vm->callers; p; p = p->next) {
+        *c = GC_NEW(caller);
+        **c = *p;
+        c = &(*c)->next;
+    }
+    *c = 0;
+    new->calls = 0;
+    return new;
+}
+
+void execute(pal_vm* vm)
+{
+    /* run the main program and the coroutines it starts */
+    pal_vm* outer = allocprof_vm;
+    if (allocprof_on) {
+        allocprof_run(vm->program);
+        allocprof_vm = vm;
+    }
+    coro* main = coro_init(vm, vm->env);
+    if (callprof_on) main->calls = callprof_new_stack(vm, -1, 0);
+    coro* c = main;
+    vm->result = vm->nil_rvalue;
+    while (c) {
+        stack* S = c->S;
+        if (c->resume) push(S, c->resume);
+        c->resume = 0;
+        vm->coro_switch = 0;
+        vm->calls = c->calls;
+        if (vm->calls) callprof_resume(vm->calls);
+        S = interpret(vm, c->pc, c->old_pc, c->new_env, S, c->E);
+        if (vm->calls) {
+            if (vm->coro_switch)
+                callprof_suspend(vm->calls);
+            else
+                callprof_finish(vm);
+        }
+        if (!vm->coro_switch) {
+            if (c == main && S) {
+                value* A = S->value;
+                vm->result = value_is_type(A, V_LVALUE) ? value_rvalue(A) : A;
+            }
+            coro_exit(vm);
+        }
+        c = coro_next(vm);
+    }
+    allocprof_vm = outer;
+    metrics_add(vm);
+}
+
+void print_stats(FILE* file)
+{
+    fprintf(file, "instructions decoded: %ld of %ld\n",
+            atomic_load(&decode_counters.decoded), atomic_load(&decode_counters.total));
+    print_memo_stats(file);
+}
+
+value* call_closure(pal_vm* vm, value* fn, value* arg)
+{
+    /* a coroutine cannot be suspended with C frames on the stack */
+    int allowed = vm->coro_allowed;
+    vm->coro_allowed = 0;
+    /* a task may run on a thread waiting in another VM */
+    pal_vm* outer = allocprof_vm;
+    operation* loc = vm->loc;
+    if (allocprof_on) allocprof_vm = vm;
+    value* res;
+    switch (value_type(fn)) {
+    case V_CLOSURE: {
+        if (vm->callers && vm->callers->depth >= MAX_CALLERS) {
+            runtime_error(vm, "%s", "closures applied by builtins nested too deeply");
+            res = make_lvalue(vm->nil_rvalue);
+            break;
+        }
+        /* the saved frame returns to pc -1, which ends interpret */
+        stack* S = 0;
+        push(S, arg);
+        caller c = { vm->apply_pc, vm->apply_S, S, vm->callers ? vm->callers->depth+1 : 1, vm->callers };
+        vm->callers = &c;
+        if (callprof_on) callprof_call(vm, fn->v.closure.pc, c.pc-1);
+        PROBE2(function__entry, fn->v.closure.pc, c.pc-1);
+        vm->closure_calls++;
+        S = interpret(vm, fn->v.closure.pc, -1, fn->v.closure.env, S, fn->v.closure.env);
+        vm->callers = c.next;
+        vm->apply_pc = c.pc;
+        vm->apply_S = c.S;
+        res = S ? S->value : make_lvalue(vm->nil_rvalue);
+        break;
+    }
+    case V_BUILTIN:
+        if (callprof_on) callprof_builtin(vm, fn->v.builtin.name, vm->apply_pc-1);
+        PROBE2(builtin__entry, fn->v.builtin.name, vm->apply_pc-1);
+        vm->builtin_calls++;
+        res = fn->v.builtin.fn(vm, arg, 0, 0);
+        PROBE0(builtin__return);
+        if (callprof_on) callprof_leave(vm);
+        break;
+    case V_MEMO:
+        if (callprof_on) callprof_builtin(vm, "[memo]", vm->apply_pc-1);
+        PROBE2(builtin__entry, "[memo]", vm->apply_pc-1);
+        vm->builtin_calls++;
+        res = memo_apply(vm, fn, arg);
+        PROBE0(builtin__return);
+        if (callprof_on) callprof_leave(vm);
+        break;
+    default:
+        runtime_error(vm, "attempt to apply %v to %v", fn, arg);
+        res = make_lvalue(vm->nil_rvalue);
+        break;
+    }
+    vm->coro_allowed = allowed;
+    if (allocprof_on) {
+        /* what the builtin allocates next is its own */
+        vm->loc = loc;
+        allocprof_vm = outer;
+    }
+    return res;
 }
@@ -1,10 +1,90 @@
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
 
+#include <stdatomic.h>
+#include <stdio.h>
 #include "config.h"
+#include "value.h"
+#include "vm.h"
 
-void init_interpreter(BYTE* code, int code_len, char** files);
+/*
+ * Decodes the code into a program that can be shared by VMs. The
+ * program takes over the malloc'ed code and file names. The caller
+ * holds the first reference. If lazy is set, function bodies are
+ * only decoded when they are first entered.
+ */
+pal_program* load_program(BYTE* code, int code_len, char** files, int files_len, int lazy);
 
-void execute();
+/*
+ * Like load_program, but the code is used in place and not freed. It
+ * must stay valid as long as the program.
+ */
+pal_program* load_program_in_place(BYTE* code, int code_len, char** files, int files_len, int lazy);
+
+/*
+ * The number of instructions of the loaded programs, and of those
+ * decoded so far.
+ */
+typedef struct {
+    atomic_long total;
+    atomic_long decoded;
+} decode_stats;
+
+extern decode_stats decode_counters;
+
+/*
+ * Requests from signal handlers and timers, one bit each. The next VM
+ * to execute an instruction takes them all and serves them, with the
+ * stack and environment at that point.
+ */
+#define INTERRUPT_PROFILE 1
+#define INTERRUPT_CENSUS 2
+#define INTERRUPT_STATUS 4
+#define INTERRUPT_METRICS 8
+
+extern atomic_int interrupts;
+
+/* async-signal-safe */
+#define interrupt_request(_bit) atomic_fetch_or_explicit(&interrupts, _bit, memory_order_relaxed)
+
+void retain_program(pal_program* program);
+
+/*
+ * Drops a reference to program and frees it with the last one.
+ */
+void release_program(pal_program* program);
+
+/*
+ * Creates a VM for program, reporting runtime errors to err. The VM
+ * holds a reference to program until it is freed.
+ */
+pal_vm* new_vm(pal_program* program, FILE* err);
+
+void free_vm(pal_vm* vm);
+
+/*
+ * Returns a copy of vm for running a task on another thread. It
+ * shares the program and environment, but has its own error location
+ * and cannot run coroutines. It holds no reference to the program.
+ */
+pal_vm* fork_vm(pal_vm* vm);
+
+/*
+ * Runs the program of vm and the coroutines it starts. Afterwards
+ * vm->result is the value the main program ended with.
+ */
+void execute(pal_vm* vm);
+
+/*
+ * Prints the runtime statistics.
+ */
+void print_stats(FILE* file);
+
+/*
+ * Applies the closure or builtin fn to the lvalue arg from within a
+ * builtin and returns the resulting lvalue. A non-local exit out of
+ * fn is not supported.
+ */
+value* call_closure(pal_vm* vm, value* fn, value* arg);
 
 #endif
@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "coro.h"
+#include "gc.h"
+#include "io.h"
+
+extern char** environ;
+
+typedef struct {
+    int fd;
+    pid_t pid;
+    char* buf;
+    int len;
+    int cap;
+    int eof;
+    /* the coroutine suspended in io_readln */
+    coro* reader;
+    pal_vm* reader_vm;
+} io_file;
+
+struct _io_state {
+    /* indexed by file descriptor */
+    io_file** files;
+    int files_max;
+};
+
+struct _io_state* new_io_state()
+{
+    return GC_NEW(struct _io_state);
+}
+
+static int add_file(pal_vm* vm, int fd, pid_t pid)
+{
+    struct _io_state* io = vm->io;
+    if (fd >= io->files_max) {
+        int max = io->files_max ? io->files_max : 64;
+        while (fd >= max) max *= 2;
+        io_file** new = GC_MALLOC(max*sizeof(io_file*));
+        for (int i = 0; i < io->files_max; i++) new[i] = io->files[i];
+        io->files = new;
+        io->files_max = max;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL)|O_NONBLOCK);
+    io_file* f = GC_NEW(io_file);
+    f->fd = fd;
+    f->pid = pid;
+    f->cap = 4096;
+    f->buf = GC_MALLOC_ATOMIC(f->cap);
+    f->len = 0;
+    f->eof = 0;
+    f->reader = 0;
+    f->reader_vm = 0;
+    io->files[fd] = f;
+    return fd;
+}
+
+static io_file* get_file(pal_vm* vm, int fd)
+{
+    if (fd < 0 || fd >= vm->io->files_max) return 0;
+    return vm->io->files[fd];
+}
+
+void io_each_reader(pal_vm* vm, void (*fn)(coro*, void*), void* data)
+{
+    struct _io_state* io = vm->io;
+    if (!io) return;
+    for (int i = 0; i < io->files_max; i++) {
+        if (io->files[i] && io->files[i]->reader) fn(io->files[i]->reader, data);
+    }
+}
+
+int io_open(pal_vm* vm, char* name)
+{
+    int fd = open(name, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return -1;
+    return add_file(vm, fd, 0);
+}
+
+int io_popen(pal_vm* vm, char* cmd)
+{
+    int p[2];
+    if (pipe(p) < 0) return -1;
+    fcntl(p[0], F_SETFD, FD_CLOEXEC);
+    fcntl(p[1], F_SETFD, FD_CLOEXEC);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, p[1], 1);
+    char* argv[] = { "sh", "-c", cmd, 0 };
+    pid_t pid;
+    int res = posix_spawn(&pid, "/bin/sh", &actions, 0, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(p[1]);
+    if (res != 0) {
+        close(p[0]);
+        return -1;
+    }
+    return add_file(vm, p[0], pid);
+}
+
+/*
+ * Removes the next line from the buffer. Returns 0 if there is no
+ * complete line yet.
+ */
+static value* take_line(io_file* f)
+{
+    char* nl = memchr(f->buf, '\n', f->len);
+    if (!nl && !f->eof) return 0;
+    if (!nl && f->len == 0) return make_tuple(0);
+    int n = nl ? nl-f->buf : f->len;
+    char* s = GC_MALLOC_ATOMIC(n+1);
+    memcpy(s, f->buf, n);
+    s[n] = 0;
+    int skip = nl ? n+1 : n;
+    memmove(f->buf, f->buf+skip, f->len-skip);
+    f->len -= skip;
+    return make_string(s);
+}
+
+/*
+ * Reads what is available into the buffer. Returns 0 if the read
+ * would block.
+ */
+static int fill(io_file* f)
+{
+    if (f->len == f->cap) {
+        char* buf = GC_MALLOC_ATOMIC(2*f->cap);
+        memcpy(buf, f->buf, f->len);
+        f->buf = buf;
+        f->cap *= 2;
+    }
+    ssize_t n = read(f->fd, f->buf+f->len, f->cap-f->len);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (n < 0 && errno == EINTR) return 1;
+    if (n <= 0)
+        f->eof = 1;
+    else
+        f->len += n;
+    return 1;
+}
+
+/*
+ * Called by the reactor when the file of a suspended reader is
+ * readable.
+ */
+static int readln_ready(void* arg)
+{
+    io_file* f = arg;
+    while (1) {
+        value* line = take_line(f);
+        if (line) {
+            coro* c = f->reader;
+            f->reader = 0;
+            coro_wake(f->reader_vm, c, make_lvalue(line));
+            return 1;
+        }
+        if (!fill(f)) return 0;
+    }
+}
+
+value* io_readln(pal_vm* vm, int fd)
+{
+    io_file* f = get_file(vm, fd);
+    if (!f) return 0;
+    while (1) {
+        value* line = take_line(f);
+        if (line) return line;
+        if (fill(f)) continue;
+        if (coro_can_block(vm) && !f->reader) {
+            f->reader = coro_current(vm);
+            f->reader_vm = vm;
+            coro_wait_fd(vm, fd, readln_ready, f);
+            coro_suspend(vm);
+            return make_tuple(0);
+        }
+        /* block the whole thread, also when another coroutine is
+           already waiting for fd */
+        struct pollfd p = { fd, POLLIN, 0 };
+        poll(&p, 1, -1);
+    }
+}
+
+int io_close(pal_vm* vm, int fd)
+{
+    io_file* f = get_file(vm, fd);
+    if (!f) return -1;
+    if (f->reader) {
+        coro_cancel_fd(vm, fd);
+        coro_wake(vm, f->reader, make_lvalue(make_tuple(0)));
+    }
+    vm->io->files[fd] = 0;
+    close(fd);
+    if (f->pid > 0) waitpid(f->pid, 0, 0);
+    return 0;
+}
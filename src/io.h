@@ -0,0 +1,48 @@
+#ifndef IO_H
+#define IO_H
+
+#include "value.h"
+#include "vm.h"
+
+/*
+ * Line oriented input on file descriptors. Reads are non-blocking:
+ * a coroutine waiting for input is suspended and resumed by the
+ * reactor, so that other coroutines keep running.
+ */
+
+/*
+ * Returns the table of open files of a VM.
+ */
+struct _io_state* new_io_state();
+
+/*
+ * Opens the file name for reading. Returns the file descriptor or -1.
+ */
+int io_open(pal_vm* vm, char* name);
+
+/*
+ * Runs cmd with /bin/sh and returns a file descriptor for reading its
+ * standard output, or -1.
+ */
+int io_popen(pal_vm* vm, char* cmd);
+
+/*
+ * Returns the next line of fd without the newline as a string, or
+ * nil at the end of the file. Returns 0 if fd is not open. If no line
+ * is available yet and the current coroutine is suspended, the line
+ * is passed on resumption instead.
+ */
+value* io_readln(pal_vm* vm, int fd);
+
+/*
+ * Closes fd and waits for the command of io_popen. Returns -1 if fd
+ * is not open.
+ */
+int io_close(pal_vm* vm, int fd);
+
+/*
+ * Calls fn(c, data) for each coroutine c suspended in io_readln.
+ */
+void io_each_reader(pal_vm* vm, void (*fn)(struct _coro*, void*), void* data);
+
+#endif
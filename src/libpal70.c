@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <string.h>
+#include "gc.h"
+#include "allocprof.h"
+#include "builtins.h"
+#include "callprof.h"
+#include "census.h"
+#include "code.h"
+#include "interpreter.h"
+#include "libpal70.h"
+#include "metrics.h"
+#include "pool.h"
+#include "probes.h"
+#include "profile.h"
+#include "status.h"
+
+static int lazy = 0;
+
+void pal_init()
+{
+    GC_INIT();
+    probes_init();
+}
+
+void pal_set_threads(int n)
+{
+    pool_set_threads(n);
+}
+
+void pal_set_lazy(int on)
+{
+    lazy = on;
+}
+
+static pal_program* load(FILE* file)
+{
+    int code_len;
+    char** files;
+    int files_len;
+    BYTE* code = read_code(file, &code_len, &files, &files_len);
+    if (!code) return 0;
+    return load_program(code, code_len, files, files_len, lazy);
+}
+
+pal_program* pal_load(const unsigned char* buf, size_t len)
+{
+    FILE* file = fmemopen((void*)buf, len, "r");
+    if (!file) return 0;
+    pal_program* program = load(file);
+    fclose(file);
+    return program;
+}
+
+pal_program* pal_load_file(const char* file_name)
+{
+    FILE* file = fopen(file_name, "r");
+    if (!file) return 0;
+    pal_program* program = load(file);
+    fclose(file);
+    return program;
+}
+
+pal_program* pal_load_in_place(const unsigned char* buf, size_t len)
+{
+    int code_len;
+    char** files;
+    int files_len;
+    BYTE* code = decode_code((BYTE*)buf, len, &code_len, &files, &files_len);
+    if (!code) return 0;
+    return load_program_in_place(code, code_len, files, files_len, lazy);
+}
+
+void pal_free_program(pal_program* program)
+{
+    release_program(program);
+}
+
+pal_vm* pal_new_vm(pal_program* program, FILE* err)
+{
+    return new_vm(program, err);
+}
+
+void pal_free_vm(pal_vm* vm)
+{
+    free_vm(vm);
+}
+
+int pal_bind(pal_vm* vm, const char* name, pal_value* val)
+{
+    int ref = string_to_ref_if_exists(vm->program->strings, (char*)name);
+    if (ref < 0) return 0;
+    vm->env = env_bind(ref, make_lvalue(val), vm->env);
+    return 1;
+}
+
+pal_value* pal_run(pal_vm* vm)
+{
+    atomic_store(vm->errors, 0);
+    execute(vm);
+    return vm->result;
+}
+
+int pal_errors(pal_vm* vm)
+{
+    return atomic_load(vm->errors);
+}
+
+void pal_register_builtin(const char* name, pal_builtin fn)
+{
+    register_builtin((char*)name, fn);
+}
+
+void pal_print_stats(FILE* file)
+{
+    print_stats(file);
+}
+
+int pal_profile_start(int hz)
+{
+    return profile_start(hz);
+}
+
+void pal_profile_stop(FILE* folded, FILE* lines)
+{
+    profile_stop(folded, lines);
+}
+
+void pal_callprof_start()
+{
+    callprof_start();
+}
+
+void pal_callprof_stop(FILE* table, FILE* callgrind)
+{
+    callprof_stop(table, callgrind);
+}
+
+void pal_allocprof_start(int interval, FILE* report)
+{
+    allocprof_start(interval, report);
+}
+
+void pal_allocprof_stop(FILE* file)
+{
+    allocprof_stop(file);
+}
+
+int pal_heap_census(int at_end)
+{
+    return census_start(at_end);
+}
+
+int pal_status_start(FILE* file)
+{
+    return status_start(file);
+}
+
+void pal_write_symbol_map(pal_program* program, FILE* file)
+{
+    probes_write_map(program, file);
+}
+
+int pal_metrics_start(const char* path, int interval)
+{
+    return metrics_start(path, interval);
+}
+
+void pal_metrics_stop()
+{
+    metrics_stop();
+}
+
+pal_value* pal_integer(long i)
+{
+    return make_integer(i);
+}
+
+pal_value* pal_real(double r)
+{
+    return make_real(r);
+}
+
+pal_value* pal_string(const char* s)
+{
+    size_t len = strlen(s);
+    char* copy = GC_MALLOC_ATOMIC(len+1);
+    memcpy(copy, s, len+1);
+    return make_string(copy);
+}
+
+pal_value* pal_bool(int b)
+{
+    return make_value(b ? V_TRUE : V_FALSE);
+}
+
+pal_value* pal_tuple(int n)
+{
+    value* T = make_tuple(n);
+    for (int i = 0; i < n; i++) {
+        value_tuple_val(T, i) = make_lvalue(make_tuple(0));
+    }
+    return T;
+}
+
+void pal_tuple_set(pal_value* tuple, int i, pal_value* val)
+{
+    value_tuple_val(tuple, i) = make_lvalue(val);
+}
+
+pal_value* pal_lvalue(pal_value* val)
+{
+    return make_lvalue(val);
+}
+
+pal_value* pal_rvalue(pal_value* val)
+{
+    return value_is_type(val, V_LVALUE) ? value_rvalue(val) : val;
+}
+
+pal_type pal_typeof(pal_value* val)
+{
+    switch (value_type(val)) {
+    case V_TRUE:    return PAL_TRUE;
+    case V_FALSE:   return PAL_FALSE;
+    case V_INTEGER: return PAL_INTEGER;
+    case V_REAL:    return PAL_REAL;
+    case V_STRING:  return PAL_STRING;
+    case V_TUPLE:
+    case V_RANGE:   return PAL_TUPLE;
+    default:        return PAL_OTHER;
+    }
+}
+
+long pal_get_integer(pal_value* val)
+{
+    return value_integer(val);
+}
+
+double pal_get_real(pal_value* val)
+{
+    return value_real(val);
+}
+
+const char* pal_get_string(pal_value* val)
+{
+    return value_string(val);
+}
+
+int pal_size(pal_value* val)
+{
+    return value_order(val);
+}
+
+pal_value* pal_tuple_get(pal_value* tuple, int i)
+{
+    if (value_is_type(tuple, V_RANGE)) return make_integer(value_range_val(tuple, i));
+    return value_rvalue(value_tuple_val(tuple, i));
+}
+
+void pal_print(FILE* file, pal_value* val)
+{
+    fprintval(file, val, 0, 0);
+}
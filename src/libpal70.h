@@ -0,0 +1,239 @@
+#ifndef LIBPAL70_H
+#define LIBPAL70_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Embedding the PAL interpreter.
+ *
+ * A pocode buffer is loaded once into a program, which may be run by
+ * any number of VMs, also concurrently on different threads. Values
+ * are allocated by the Boehm GC: pal_init must be called by the main
+ * thread first, and other threads using the library must be known to
+ * the GC (created with GC_pthread_create or registered).
+ */
+
+typedef struct _pal_program pal_program;
+
+typedef struct _pal_vm pal_vm;
+
+typedef struct _value pal_value;
+
+struct _stack;
+
+/*
+ * A builtin gets its argument as an lvalue and must return an lvalue,
+ * see pal_lvalue and pal_rvalue. S and E are only for the interpreter.
+ */
+typedef pal_value* (*pal_builtin)(pal_vm* vm, pal_value* arg, struct _stack* S, pal_value* E);
+
+typedef enum {
+    PAL_TRUE,
+    PAL_FALSE,
+    PAL_INTEGER,
+    PAL_REAL,
+    PAL_STRING,
+    PAL_TUPLE,
+    PAL_OTHER
+} pal_type;
+
+void pal_init();
+
+/*
+ * Sets the number of threads used by the parallel builtins, see
+ * pool_set_threads.
+ */
+void pal_set_threads(int n);
+
+/*
+ * If on, programs loaded afterwards decode a function body only when
+ * it is first entered, which speeds up loading large programs of which
+ * little code runs.
+ */
+void pal_set_lazy(int on);
+
+/*
+ * Loads the pocode in buf. Returns 0 if it is not valid pocode.
+ */
+pal_program* pal_load(const unsigned char* buf, size_t len);
+
+pal_program* pal_load_file(const char* file_name);
+
+/*
+ * Like pal_load, but the code is used in place instead of copied, so
+ * buf must stay valid and unchanged as long as the program.
+ */
+pal_program* pal_load_in_place(const unsigned char* buf, size_t len);
+
+/*
+ * Drops the reference of the loader. VMs hold their own reference, so
+ * the program is only freed once the VMs running it are freed as well.
+ * A host may thus swap in a newly loaded program while executions on
+ * the old one are still in flight.
+ */
+void pal_free_program(pal_program* program);
+
+/*
+ * Creates a VM for program, reporting runtime errors to err.
+ */
+pal_vm* pal_new_vm(pal_program* program, FILE* err);
+
+void pal_free_vm(pal_vm* vm);
+
+/*
+ * Binds name to val in the initial environment of vm, so that it
+ * overrides a builtin or global of the same name. Returns 0 if the
+ * program does not use name.
+ */
+int pal_bind(pal_vm* vm, const char* name, pal_value* val);
+
+/*
+ * Runs the program and returns the value it ended with. A VM can be
+ * run again; the bindings are kept.
+ */
+pal_value* pal_run(pal_vm* vm);
+
+/*
+ * Returns the number of runtime errors of the last run, including
+ * those of the ParMap and Spawn tasks it ran.
+ */
+int pal_errors(pal_vm* vm);
+
+/*
+ * Registers a builtin for the VMs created afterwards. Not thread
+ * safe; register before creating VMs on other threads.
+ */
+void pal_register_builtin(const char* name, pal_builtin fn);
+
+void pal_print_stats(FILE* file);
+
+/*
+ * Starts the sampling profiler, which samples the running VMs hz
+ * times per second of CPU time. It uses SIGPROF. Returns 0 if the
+ * timer cannot be set.
+ */
+int pal_profile_start(int hz);
+
+/*
+ * Stops the profiler and writes the sampled call chains to folded as
+ * folded stacks, one line per chain with its number of samples, and
+ * a table of the most sampled lines to lines.
+ */
+void pal_profile_stop(FILE* folded, FILE* lines);
+
+/*
+ * Starts the call profiler, which counts the applications of each
+ * function and measures the time spent in it and in the functions it
+ * calls, for the programs run afterwards.
+ */
+void pal_callprof_start();
+
+/*
+ * Stops the call profiler and writes a table of the functions, sorted
+ * by the time spent in them, to table, and the counts and times in the
+ * callgrind format, as read by KCachegrind, to callgrind.
+ */
+void pal_callprof_stop(FILE* table, FILE* callgrind);
+
+/*
+ * Starts the allocation profiler, which counts the values, tuple
+ * arrays and stack cells allocated by each line of the programs run
+ * afterwards. If interval is positive, a sample of the objects is also
+ * tracked with finalizers, and the lines whose objects survive garbage
+ * collections are written to report every interval seconds.
+ */
+void pal_allocprof_start(int interval, FILE* report);
+
+/*
+ * Stops the allocation profiler and writes the lines that allocated
+ * the most objects and bytes, and the lines of the tracked objects
+ * surviving a final collection, to file.
+ */
+void pal_allocprof_stop(FILE* file);
+
+/*
+ * Makes SIGUSR2 write a census of the heap of the VM running when it
+ * arrives to its error file: the objects by type, the largest tuples
+ * and the objects retaining the most memory. If at_end is set, each
+ * program also takes one when its main program ends. Returns 0 if the
+ * signal handler cannot be set.
+ */
+int pal_heap_census(int at_end);
+
+/*
+ * Makes SIGUSR1 write a status report of the VM running when it
+ * arrives to file, or to its error file if file is 0: the line it
+ * executes, its call stack, the instructions it executed, the size of
+ * the heap and the time since this call. The VM then continues.
+ * Returns 0 if the signal handler cannot be set.
+ */
+int pal_status_start(FILE* file);
+
+/*
+ * Writes the functions of the operations of program to file, one range
+ * of operations per line as "START SIZE NAME", START and SIZE in hex,
+ * in the format of the /tmp/perf-PID.map files of JIT compilers. The
+ * pcs passed to the USDT probes, built in with HAVE_SYS_SDT_H, index
+ * these operations. The bodies of a lazily decoded program are only
+ * included once decoded.
+ */
+void pal_write_symbol_map(pal_program* program, FILE* file);
+
+/*
+ * Rewrites the file at path every interval milliseconds with metrics
+ * in the Prometheus text format: the instructions executed and their
+ * rate, the closures and builtins applied, the runtime errors, the
+ * size of the heap, the collections and the depth of the stack. The
+ * file is replaced by renaming a temporary file path.tmp, and written
+ * by the VMs between instructions, so a VM blocked in a builtin does
+ * not update it. The interval is timed with SIGALRM. Returns 0 if the
+ * signal handler cannot be set.
+ */
+int pal_metrics_start(const char* path, int interval);
+
+/*
+ * Rewrites the metrics file a last time and stops updating it.
+ */
+void pal_metrics_stop();
+
+pal_value* pal_integer(long i);
+
+pal_value* pal_real(double r);
+
+pal_value* pal_string(const char* s);
+
+pal_value* pal_bool(int b);
+
+/*
+ * Returns a tuple of n elements, each initialised to nil.
+ */
+pal_value* pal_tuple(int n);
+
+void pal_tuple_set(pal_value* tuple, int i, pal_value* val);
+
+pal_value* pal_lvalue(pal_value* val);
+
+pal_value* pal_rvalue(pal_value* val);
+
+pal_type pal_typeof(pal_value* val);
+
+long pal_get_integer(pal_value* val);
+
+double pal_get_real(pal_value* val);
+
+const char* pal_get_string(pal_value* val);
+
+/*
+ * Returns the size of a tuple.
+ */
+int pal_size(pal_value* val);
+
+/*
+ * Returns the rvalue of element i (starting at 0) of a tuple.
+ */
+pal_value* pal_tuple_get(pal_value* tuple, int i);
+
+void pal_print(FILE* file, pal_value* val);
+
+#endif
@@ -0,0 +1,168 @@
+#include <string.h>
+#include "gc.h"
+#include "map.h"
+
+/* marks deleted entries */
+static value deleted_key;
+
+map* map_new(int cap)
+{
+    int c = 8;
+    while (c < cap*2) c *= 2;
+    map* m = GC_NEW(map);
+    m->size = 0;
+    m->used = 0;
+    m->cap = c;
+    m->entries = GC_MALLOC(c*sizeof(map_entry));
+    return m;
+}
+
+int map_keyable(value* val)
+{
+    switch (value_type(val)) {
+    case V_TRUE:
+    case V_FALSE:
+    case V_INTEGER:
+    case V_REAL:
+    case V_STRING:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t value_hash(value* val)
+{
+    switch (value_type(val)) {
+    case V_TRUE:
+        return mix(1);
+    case V_FALSE:
+        return mix(2);
+    case V_INTEGER:
+        return mix((uint64_t)value_integer(val));
+    case V_REAL: {
+        /* 0.0 and -0.0 are equal */
+        REAL r = value_real(val);
+        if (r == 0) r = 0;
+        uint64_t bits;
+        memcpy(&bits, &r, sizeof(bits));
+        return mix(bits ^ 0x9e3779b97f4a7c15ULL);
+    }
+    case V_STRING: {
+        /* FNV-1a */
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (unsigned char* s = (unsigned char*)value_string(val); *s; s++) {
+            h ^= *s;
+            h *= 0x100000001b3ULL;
+        }
+        return mix(h);
+    }
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Returns the index of the entry for key, or of the slot where it
+ * would be inserted.
+ */
+static int find(map* m, value* key, uint64_t hash)
+{
+    int mask = m->cap-1;
+    int i = hash&mask;
+    int free = -1;
+    while (1) {
+        map_entry* e = &m->entries[i];
+        if (!e->key) {
+            return free >= 0 ? free : i;
+        }
+        if (e->key == &deleted_key) {
+            if (free < 0) free = i;
+        }
+        else if (e->hash == hash && value_equal(e->key, key) == 1) {
+            return i;
+        }
+        i = (i+1)&mask;
+    }
+}
+
+static void resize(map* m, int cap)
+{
+    map_entry* old = m->entries;
+    int old_cap = m->cap;
+    m->cap = cap;
+    m->entries = GC_MALLOC(cap*sizeof(map_entry));
+    m->used = m->size;
+    int mask = cap-1;
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i].key && old[i].key != &deleted_key) {
+            int j = old[i].hash&mask;
+            while (m->entries[j].key) j = (j+1)&mask;
+            m->entries[j] = old[i];
+        }
+    }
+}
+
+void* map_get(map* m, value* key)
+{
+    map_entry* e = &m->entries[find(m, key, value_hash(key))];
+    if (e->key && e->key != &deleted_key)
+        return e->val;
+    else
+        return 0;
+}
+
+void map_put(map* m, value* key, void* val)
+{
+    uint64_t hash = value_hash(key);
+    map_entry* e = &m->entries[find(m, key, hash)];
+    if (e->key && e->key != &deleted_key) {
+        e->val = val;
+        return;
+    }
+    if (!e->key) m->used++;
+    m->size++;
+    e->key = key;
+    e->val = val;
+    e->hash = hash;
+    /* keep the load including deleted entries below 3/4 */
+    if (m->used*4 >= m->cap*3) {
+        int cap = m->cap;
+        while (m->size*2 >= cap) cap *= 2;
+        resize(m, cap);
+    }
+}
+
+int map_delete(map* m, value* key)
+{
+    map_entry* e = &m->entries[find(m, key, value_hash(key))];
+    if (!e->key || e->key == &deleted_key) return 0;
+    e->key = &deleted_key;
+    e->val = 0;
+    m->size--;
+    return 1;
+}
+
+int map_next(map* m, int i, value** key, void** val)
+{
+    while (i < m->cap) {
+        map_entry* e = &m->entries[i];
+        i++;
+        if (e->key && e->key != &deleted_key) {
+            *key = e->key;
+            *val = e->val;
+            return i;
+        }
+    }
+    return -1;
+}
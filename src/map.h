@@ -0,0 +1,51 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include <stdint.h>
+#include "value.h"
+
+typedef struct {
+    value* key;
+    void* val;
+    uint64_t hash;
+} map_entry;
+
+/*
+ * Hash map from atoms to rvalues, or other GC allocated data, using
+ * open addressing with linear probing. Keys are compared with
+ * value_equal().
+ */
+struct _map {
+    int size;
+    int used;
+    int cap;
+    map_entry* entries;
+};
+
+typedef struct _map map;
+
+map* map_new(int cap);
+
+/*
+ * Returns 1 if val can be used as a key.
+ */
+int map_keyable(value* val);
+
+uint64_t value_hash(value* val);
+
+void* map_get(map* m, value* key);
+
+void map_put(map* m, value* key, void* val);
+
+/*
+ * Removes key, returns 1 if it was present.
+ */
+int map_delete(map* m, value* key);
+
+/*
+ * Iterates over the entries, starting with i = 0. Returns the next
+ * index or -1 at the end.
+ */
+int map_next(map* m, int i, value** key, void** val);
+
+#endif
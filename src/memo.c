@@ -0,0 +1,111 @@
+#include "gc.h"
+#include "interpreter.h"
+#include "map.h"
+#include "memo.h"
+
+memo_stats memo_counters;
+
+value* make_memo(value* fn, int max)
+{
+    if (max < 1) max = 1;
+    memo* m = GC_NEW(memo);
+    m->fn = fn;
+    m->max = max;
+    m->cache = map_new(max < 1024 ? max : 1024);
+    m->head = 0;
+    m->tail = 0;
+    pthread_mutex_init(&m->lock, 0);
+    value* V = make_value(V_MEMO);
+    V->v.memo = m;
+    return V;
+}
+
+static void unlink_node(memo* m, memo_node* node)
+{
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        m->head = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        m->tail = node->prev;
+}
+
+static void push_front(memo* m, memo_node* node)
+{
+    node->prev = 0;
+    node->next = m->head;
+    if (m->head)
+        m->head->prev = node;
+    else
+        m->tail = node;
+    m->head = node;
+}
+
+value* memo_lookup(value* val, value* key)
+{
+    memo* m = val->v.memo;
+    if (!map_keyable(key)) {
+        memo_counters.bypasses++;
+        return 0;
+    }
+
+    pthread_mutex_lock(&m->lock);
+    memo_node* node = map_get(m->cache, key);
+    if (node) {
+        memo_counters.hits++;
+        if (node != m->head) {
+            unlink_node(m, node);
+            push_front(m, node);
+        }
+        value* res = node->result;
+        pthread_mutex_unlock(&m->lock);
+        return res;
+    }
+    pthread_mutex_unlock(&m->lock);
+    memo_counters.misses++;
+    return 0;
+}
+
+void memo_store(value* val, value* key, value* res)
+{
+    memo* m = val->v.memo;
+    if (!map_keyable(key)) return;
+
+    pthread_mutex_lock(&m->lock);
+    /* the call may have cached key itself */
+    memo_node* node = map_get(m->cache, key);
+    if (!node) {
+        if (m->cache->size >= m->max) {
+            memo_node* last = m->tail;
+            unlink_node(m, last);
+            map_delete(m->cache, last->key);
+            memo_counters.evictions++;
+        }
+        node = GC_NEW(memo_node);
+        node->key = key;
+        map_put(m->cache, key, node);
+        push_front(m, node);
+    }
+    node->result = value_rvalue(res);
+    pthread_mutex_unlock(&m->lock);
+}
+
+value* memo_apply(pal_vm* vm, value* val, value* arg)
+{
+    value* key = value_rvalue(arg);
+    value* res = memo_lookup(val, key);
+    if (res) return make_lvalue(res);
+    res = call_closure(vm, val->v.memo->fn, arg);
+    memo_store(val, key, res);
+    return res;
+}
+
+void print_memo_stats(FILE* file)
+{
+    fprintf(file, "memo hits: %ld\n", atomic_load(&memo_counters.hits));
+    fprintf(file, "memo misses: %ld\n", atomic_load(&memo_counters.misses));
+    fprintf(file, "memo bypasses: %ld\n", atomic_load(&memo_counters.bypasses));
+    fprintf(file, "memo evictions: %ld\n", atomic_load(&memo_counters.evictions));
+}
@@ -0,0 +1,69 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "value.h"
+#include "vm.h"
+
+#define MEMO_DEFAULT_SIZE 4096
+
+typedef struct _memo_node {
+    value* key;
+    value* result;
+    struct _memo_node* prev;
+    struct _memo_node* next;
+} memo_node;
+
+
+struct _memo {
+    value* fn;
+    int max;
+    struct _map* cache;
+    /* most recently used first */
+    struct _memo_node* head;
+    struct _memo_node* tail;
+    /* guards the cache, which ParMap workers may share */
+    pthread_mutex_t lock;
+};
+
+typedef struct _memo memo;
+
+typedef struct {
+    atomic_long hits;
+    atomic_long misses;
+    atomic_long bypasses;
+    atomic_long evictions;
+} memo_stats;
+
+extern memo_stats memo_counters;
+
+/*
+ * Returns a memoizing wrapper for the closure or builtin fn which
+ * caches at most max results.
+ */
+value* make_memo(value* fn, int max);
+
+/*
+ * Returns the cached rvalue of the memoizing wrapper for the rvalue
+ * key, or 0 if there is none or key cannot be cached.
+ */
+value* memo_lookup(value* memo, value* key);
+
+/*
+ * Caches the lvalue res as the result for key, unless key cannot be
+ * cached. The least recently used result is evicted if the cache is full.
+ */
+void memo_store(value* memo, value* key, value* res);
+
+/*
+ * Applies the memoizing wrapper to the lvalue arg and returns the
+ * resulting lvalue. The interpreter applies a wrapped closure itself,
+ * see OP_APPLY.
+ */
+value* memo_apply(pal_vm* vm, value* memo, value* arg);
+
+void print_memo_stats(FILE* file);
+
+#endif
@@ -0,0 +1,138 @@
+#define _XOPEN_SOURCE 700
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "gc.h"
+#include "interpreter.h"
+#include "metrics.h"
+
+metrics_counters metrics_totals;
+
+/* on and the names are guarded by lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int on = 0;
+static char* file_name;
+static char* temp_name;
+/* the time and instructions at the last write, for the rate */
+static struct timespec last;
+static long last_instructions;
+
+static void tick(int sig)
+{
+    interrupt_request(INTERRUPT_METRICS);
+}
+
+static void set_timer(int interval)
+{
+    struct itimerval t;
+    t.it_interval.tv_sec = interval/1000;
+    t.it_interval.tv_usec = interval%1000*1000;
+    t.it_value = t.it_interval;
+    setitimer(ITIMER_REAL, &t, 0);
+}
+
+static void header(FILE* file, char* name, char* type, char* help)
+{
+    fprintf(file, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* with lock held */
+static void write_file(long depth)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long instructions = atomic_load(&metrics_totals.instructions);
+    double elapsed = (now.tv_sec-last.tv_sec) + (now.tv_nsec-last.tv_nsec)/1e9;
+    double rate = elapsed > 0 ? (instructions-last_instructions)/elapsed : 0;
+    last = now;
+    last_instructions = instructions;
+
+    FILE* file = fopen(temp_name, "w");
+    if (!file) return;
+    header(file, "pal70_instructions_total", "counter", "Instructions executed.");
+    fprintf(file, "pal70_instructions_total %ld\n", instructions);
+    header(file, "pal70_instructions_per_second", "gauge", "Instructions executed per second since the previous write.");
+    fprintf(file, "pal70_instructions_per_second %.0f\n", rate);
+    header(file, "pal70_closure_calls_total", "counter", "Closures applied.");
+    fprintf(file, "pal70_closure_calls_total %ld\n", atomic_load(&metrics_totals.closure_calls));
+    header(file, "pal70_builtin_calls_total", "counter", "Builtins and memo functions applied.");
+    fprintf(file, "pal70_builtin_calls_total %ld\n", atomic_load(&metrics_totals.builtin_calls));
+    header(file, "pal70_runtime_errors_total", "counter", "Runtime errors reported.");
+    fprintf(file, "pal70_runtime_errors_total %ld\n", atomic_load(&metrics_totals.errors));
+    header(file, "pal70_heap_bytes", "gauge", "Size of the garbage collected heap.");
+    fprintf(file, "pal70_heap_bytes %lu\n", (unsigned long)GC_get_heap_size());
+    header(file, "pal70_gc_collections_total", "counter", "Garbage collections.");
+    fprintf(file, "pal70_gc_collections_total %lu\n", (unsigned long)GC_get_gc_no());
+    header(file, "pal70_stack_depth", "gauge", "Stack cells of the VM that wrote the file.");
+    fprintf(file, "pal70_stack_depth %ld\n", depth);
+    if (fclose(file) != 0 || rename(temp_name, file_name) != 0) remove(temp_name);
+}
+
+int metrics_start(const char* path, int interval)
+{
+    metrics_stop();
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = tick;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGALRM, &sa, 0) != 0) return 0;
+
+    pthread_mutex_lock(&lock);
+    file_name = strdup(path);
+    temp_name = malloc(strlen(path)+5);
+    sprintf(temp_name, "%s.tmp", path);
+    clock_gettime(CLOCK_MONOTONIC, &last);
+    last_instructions = atomic_load(&metrics_totals.instructions);
+    on = 1;
+    write_file(0);
+    pthread_mutex_unlock(&lock);
+    set_timer(interval > 0 ? interval : 1);
+    return 1;
+}
+
+void metrics_add(pal_vm* vm)
+{
+    atomic_fetch_add_explicit(&metrics_totals.instructions,
+                              vm->instructions-vm->added.instructions, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics_totals.closure_calls,
+                              vm->closure_calls-vm->added.closure_calls, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics_totals.builtin_calls,
+                              vm->builtin_calls-vm->added.builtin_calls, memory_order_relaxed);
+    vm->added.instructions = vm->instructions;
+    vm->added.closure_calls = vm->closure_calls;
+    vm->added.builtin_calls = vm->builtin_calls;
+}
+
+void metrics_write(pal_vm* vm, stack* S)
+{
+    metrics_add(vm);
+    long depth = 0;
+    for (stack* s = S; s; s = s->next) depth++;
+    for (caller* c = vm->callers; c; c = c->next) {
+        for (stack* s = c->S; s; s = s->next) depth++;
+    }
+    pthread_mutex_lock(&lock);
+    /* a request may still be served after metrics_stop */
+    if (on) write_file(depth);
+    pthread_mutex_unlock(&lock);
+}
+
+void metrics_stop()
+{
+    pthread_mutex_lock(&lock);
+    if (on) {
+        set_timer(0);
+        signal(SIGALRM, SIG_IGN);
+        atomic_fetch_and(&interrupts, ~INTERRUPT_METRICS);
+        write_file(0);
+        on = 0;
+        free(file_name);
+        free(temp_name);
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,56 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include "stack.h"
+#include "vm.h"
+
+/*
+ * The metrics file. While it is on, a SIGALRM timer requests
+ * INTERRUPT_METRICS every interval, and the next VM to execute an
+ * instruction rewrites the file in the Prometheus text format, as read
+ * by the textfile collector of node_exporter: a temporary file is
+ * written and renamed over it, so a reader never sees half a file.
+ *
+ * Each VM counts its instructions and applications in plain fields
+ * and adds them to the totals when it writes the file, when its task
+ * ends and when execute returns, so the counts of tasks still running
+ * on other threads lag behind. A program blocked in a builtin writes
+ * nothing until it executes again. A file that cannot be written is
+ * skipped until the next interval.
+ */
+
+typedef struct {
+    atomic_long instructions;
+    atomic_long closure_calls;
+    atomic_long builtin_calls;
+    atomic_long errors;
+} metrics_counters;
+
+/* the counts added by the VMs, and the runtime errors */
+extern metrics_counters metrics_totals;
+
+/*
+ * Starts writing the metrics to path every interval milliseconds.
+ * Returns 0 if the signal handler cannot be set.
+ */
+int metrics_start(const char* path, int interval);
+
+/*
+ * Adds the counts of vm since the last call to the totals.
+ */
+void metrics_add(pal_vm* vm);
+
+/*
+ * Adds the counts of vm and rewrites the file, with the depth of the
+ * stack S and of the callers of vm.
+ */
+void metrics_write(pal_vm* vm, stack* S);
+
+/*
+ * Stops the timer and rewrites the file a last time, with a stack
+ * depth of 0.
+ */
+void metrics_stop();
+
+#endif
@@ -0,0 +1,373 @@
+#include <stdlib.h>
+#include <string.h>
+#include "builtins.h"
+#include "code.h"
+#include "object.h"
+
+static int contains(list* names, char* name)
+{
+    for (int i = 0; i < names->len; i++) {
+        if (strcmp(list_element(names, i), name) == 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Appends the names declared by the definition d, as declnames in
+ * the translator does.
+ */
+static void defined_names(tree* d, list* names)
+{
+    if (!d) return;
+    switch (d->type) {
+    case S_NAME:
+        list_append(names, tree_string(d));
+        break;
+    case S_COMMA:
+    case S_AND:
+        for (int i = 0; i < tree_list_size(d); i++) {
+            defined_names(tree_list_element(d, i), names);
+        }
+        break;
+    case S_REC:
+        defined_names(tree_operand(d), names);
+        break;
+    case S_VALDEF:
+        defined_names(tree_left(d), names);
+        break;
+    case S_WITHIN:
+        defined_names(tree_right(d), names);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Appends the labels declared in the body t, as find_labels in the
+ * translator does.
+ */
+static void label_names(tree* t, list* names)
+{
+    if (!t) return;
+    switch (t->type) {
+    case S_COLON:
+        list_append(names, tree_string(tree_list_element(t, 0)));
+        label_names(tree_list_element(t, 1), names);
+        break;
+    case S_COND:
+        label_names(tree_list_element(t, 1), names);
+        label_names(tree_list_element(t, 2), names);
+        break;
+    case S_WHILE:
+        label_names(tree_right(t), names);
+        break;
+    case S_SEQ:
+        label_names(tree_left(t), names);
+        label_names(tree_right(t), names);
+        break;
+    default:
+        break;
+    }
+}
+
+static void free_names(tree* t, list* scope, list* imports);
+
+/*
+ * The free names of the right hand sides of the definition d.
+ */
+static void free_names_rhs(tree* d, list* scope, list* imports)
+{
+    if (!d) return;
+    int len = scope->len;
+    switch (d->type) {
+    case S_AND:
+        for (int i = 0; i < tree_list_size(d); i++) {
+            free_names_rhs(tree_list_element(d, i), scope, imports);
+        }
+        break;
+    case S_VALDEF:
+        free_names(tree_right(d), scope, imports);
+        break;
+    case S_REC:
+        defined_names(tree_operand(d), scope);
+        free_names_rhs(tree_operand(d), scope, imports);
+        break;
+    case S_WITHIN:
+        free_names_rhs(tree_left(d), scope, imports);
+        defined_names(tree_left(d), scope);
+        free_names_rhs(tree_right(d), scope, imports);
+        break;
+    default:
+        break;
+    }
+    scope->len = len;
+}
+
+/*
+ * The free names of a body that declares labels.
+ */
+static void free_names_body(tree* t, list* scope, list* imports)
+{
+    int len = scope->len;
+    label_names(t, scope);
+    free_names(t, scope, imports);
+    scope->len = len;
+}
+
+static void free_names(tree* t, list* scope, list* imports)
+{
+    if (!t) return;
+    int len = scope->len;
+    switch (t->type) {
+    case S_NAME:
+        if (!contains(scope, tree_string(t)) && !contains(imports, tree_string(t)))
+            list_append(imports, tree_string(t));
+        break;
+    case S_LET:
+        free_names_rhs(tree_left(t), scope, imports);
+        defined_names(tree_left(t), scope);
+        free_names_body(tree_right(t), scope, imports);
+        break;
+    case S_LAMBDA:
+        defined_names(tree_left(t), scope);
+        free_names_body(tree_right(t), scope, imports);
+        break;
+    case S_VALOF:
+        free_names_body(tree_operand(t), scope, imports);
+        break;
+    case S_DEF:
+        /* each definition sees the ones before */
+        for (int i = 0; i < tree_list_size(t); i++) {
+            tree* d = tree_list_element(t, i);
+            free_names_rhs(d, scope, imports);
+            defined_names(d, scope);
+        }
+        break;
+    case S_COLON:
+        free_names(tree_list_element(t, 1), scope, imports);
+        break;
+    case S_COND:
+    case S_COMMA:
+        for (int i = 0; i < tree_list_size(t); i++) {
+            free_names(tree_list_element(t, i), scope, imports);
+        }
+        break;
+    case S_NOT:
+    case S_NEG:
+    case S_POS:
+    case S_NOSHARE:
+    case S_GOTO:
+    case S_RES:
+        free_names(tree_operand(t), scope, imports);
+        break;
+    case S_APPLY:
+    case S_ASS:
+    case S_AUG:
+    case S_SEQ:
+    case S_WHILE:
+    case S_MULT:
+    case S_DIV:
+    case S_PLUS:
+    case S_MINUS:
+    case S_POWER:
+    case S_EQ:
+    case S_LS:
+    case S_GR:
+    case S_GE:
+    case S_LE:
+    case S_NE:
+    case S_LOGAND:
+    case S_LOGOR:
+        free_names(tree_left(t), scope, imports);
+        free_names(tree_right(t), scope, imports);
+        break;
+    default:
+        break;
+    }
+    scope->len = len;
+}
+
+void object_names(tree* t, list* exports, list* imports)
+{
+    if (t->type == S_DEF) {
+        for (int i = 0; i < tree_list_size(t); i++) {
+            defined_names(tree_list_element(t, i), exports);
+        }
+    }
+    list* scope = list_new();
+    free_names_body(t, scope, imports);
+    free(scope->elements);
+    free(scope);
+}
+
+static void put_int(FILE* file, int i)
+{
+    BYTE buf[4];
+    encode_int(i, buf);
+    fwrite(buf, 1, 4, file);
+}
+
+static void put_string(FILE* file, char* s)
+{
+    int len = strlen(s);
+    put_int(file, len);
+    fwrite(s, 1, len, file);
+}
+
+static void put_names(FILE* file, list* names)
+{
+    put_int(file, names->len);
+    for (int i = 0; i < names->len; i++) {
+        put_string(file, list_element(names, i));
+    }
+}
+
+static void put_ints(FILE* file, int* ints, int len)
+{
+    put_int(file, len);
+    for (int i = 0; i < len; i++) put_int(file, ints[i]);
+}
+
+void write_object(FILE* file, object* obj)
+{
+    /* write header */
+    fputc(0xF1, file);
+    fprintf(file, "%s", "POCODE70");
+    fputc(0x00, file);
+
+    put_string(file, obj->file);
+    put_names(file, obj->exports);
+    put_names(file, obj->imports);
+
+    code_unit* unit = &obj->unit;
+    put_int(file, unit->params);
+    put_int(file, unit->ssp);
+    put_int(file, unit->msp);
+    put_int(file, unit->line);
+    put_ints(file, unit->refs, unit->refs_len);
+    put_ints(file, unit->lines, unit->lines_len);
+    put_int(file, unit->code_len);
+    fwrite(unit->code, 1, unit->code_len, file);
+    fflush(file);
+}
+
+static int get_int(FILE* file, int* i)
+{
+    BYTE buf[4];
+    if (fread(buf, 1, 4, file) != 4) return 0;
+    *i = decode_int(buf);
+    return 1;
+}
+
+static char* get_string(FILE* file)
+{
+    int len;
+    if (!get_int(file, &len) || len < 0) return 0;
+    char* s = malloc(len+1);
+    if (fread(s, 1, len, file) != len) {
+        free(s);
+        return 0;
+    }
+    s[len] = 0;
+    return s;
+}
+
+static list* get_names(FILE* file)
+{
+    int len;
+    if (!get_int(file, &len) || len < 0) return 0;
+    list* names = list_new();
+    for (int i = 0; i < len; i++) {
+        char* name = get_string(file);
+        if (!name) return 0;
+        list_append(names, name);
+    }
+    return names;
+}
+
+static int* get_ints(FILE* file, int* len)
+{
+    if (!get_int(file, len) || *len < 0) return 0;
+    int* ints = malloc((*len+1)*sizeof(int));
+    for (int i = 0; i < *len; i++) {
+        if (!get_int(file, &ints[i])) return 0;
+    }
+    return ints;
+}
+
+/*
+ * Checks that the positions lie within the code.
+ */
+static int valid_positions(int* pos, int len, int code_len)
+{
+    for (int i = 0; i < len; i++) {
+        if (pos[i] < 0 || pos[i] > code_len-4) return 0;
+    }
+    return 1;
+}
+
+object* read_object(FILE* file)
+{
+    BYTE buf[9];
+
+    /* read header */
+    if (fgetc(file) != 0xF1) return 0;
+    if (fread(buf, 1, 9, file) != 9) return 0;
+
+    object* obj = malloc(sizeof(object));
+    code_unit* unit = &obj->unit;
+    obj->file = get_string(file);
+    if (!obj->file) return 0;
+    obj->exports = get_names(file);
+    if (!obj->exports) return 0;
+    obj->imports = get_names(file);
+    if (!obj->imports) return 0;
+    if (!get_int(file, &unit->params) || !get_int(file, &unit->ssp) ||
+        !get_int(file, &unit->msp) || !get_int(file, &unit->line))
+        return 0;
+    unit->refs = get_ints(file, &unit->refs_len);
+    if (!unit->refs) return 0;
+    unit->lines = get_ints(file, &unit->lines_len);
+    if (!unit->lines) return 0;
+
+    if (!get_int(file, &unit->code_len) || unit->code_len < 0) return 0;
+    unit->code = malloc(unit->code_len+1);
+    if (fread(unit->code, 1, unit->code_len, file) != unit->code_len) return 0;
+    if (!valid_positions(unit->refs, unit->refs_len, unit->code_len) ||
+        !valid_positions(unit->lines, unit->lines_len, unit->code_len))
+        return 0;
+    return obj;
+}
+
+static int is_builtin(char* name)
+{
+    for (builtin* b = builtins; b->name; b++) {
+        if (strcmp(b->name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+BYTE* link_objects(object** objects, int n, int* code_len, FILE* err)
+{
+    list* defined = list_new();
+    code_unit* units = malloc(n*sizeof(code_unit));
+    for (int i = 0; i < n; i++) {
+        object* obj = objects[i];
+        for (int j = 0; j < obj->imports->len; j++) {
+            char* name = list_element(obj->imports, j);
+            if (!contains(defined, name) && !is_builtin(name))
+                fprintf(err, "%s: warning: unresolved name %s\n", obj->file, name);
+        }
+        for (int j = 0; j < obj->exports->len; j++) {
+            list_append(defined, list_element(obj->exports, j));
+        }
+        units[i] = obj->unit;
+        relocate_file(&units[i], i);
+    }
+    BYTE* code = link_units(units, n, code_len);
+    free(units);
+    free(defined->elements);
+    free(defined);
+    return code;
+}
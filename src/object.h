@@ -0,0 +1,42 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include <stdio.h>
+#include "config.h"
+#include "list.h"
+#include "translator.h"
+#include "tree.h"
+
+/*
+ * A relocatable object: the code of one source file, translated as
+ * file number 0, with the names it defines at the top level and the
+ * free names it uses.
+ */
+typedef struct {
+    char* file;
+    code_unit unit;
+    list* exports;
+    list* imports;
+} object;
+
+/*
+ * Collects the names defined at the top level of t into exports and
+ * the names used by t but not bound in it into imports.
+ */
+void object_names(tree* t, list* exports, list* imports);
+
+void write_object(FILE* file, object* obj);
+
+/*
+ * Reads an object. Returns 0 if the file is not a valid object.
+ */
+object* read_object(FILE* file);
+
+/*
+ * Links the objects, in order, into a program and returns its code,
+ * the length in code_len. A name used by an object that is neither
+ * defined by a preceding object nor a builtin is reported to err.
+ */
+BYTE* link_objects(object** objects, int n, int* code_len, FILE* err);
+
+#endif
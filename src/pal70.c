@@ -1,3 +1,5 @@
+#include <errno.h>
+#include <getopt.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -7,10 +9,28 @@
 #include "parser.h"
 #include "translator.h"
 #include "disassembler.h"
-#include "interpreter.h"
 #include "code.h"
+#include "bundle.h"
+#include "cache.h"
+#include "libpal70.h"
+#include "object.h"
+#include "pool.h"
+#include "server.h"
+
+/* the sampling rate of --profile */
+#define PROFILE_HZ 1000
 
 static int verbose = 0;
+static int stats = 0;
+static char* profile_file_name = 0;
+static char* callprof_file_name = 0;
+/* the interval of the survival reports, 0 for none, -1 if not profiling */
+static int allocprof = -1;
+static int heap_census = 0;
+static char* status_file_name = 0;
+static char* symbol_map_file_name = 0;
+static char* metrics_file_name = 0;
+static int metrics_interval = 1000;
 
 static int disass(char* prg, char* file_name)
 {
@@ -41,39 +61,167 @@ static int disass(char* prg, char* file_name)
     return 0;
 }
 
-static int compile(char* prg, char** file_names, char* output_file_name)
+/*
+ * A source file, parsed and translated on its own.
+ */
+typedef struct {
+    char* file_name;
+    int nr;
+    /* errno if the file could not be opened */
+    int open_errno;
+    error_log parse_errors;
+    error_log errors;
+    code_unit unit;
+    /* the names of the object, if one is made */
+    list* exports;
+    list* imports;
+} compile_job;
+
+static void compile_file(void* arg)
 {
-    if (!output_file_name) output_file_name = "pocode.out";
+    compile_job* job = arg;
+    init_error_log(&job->parse_errors, job->file_name);
+    init_error_log(&job->errors, job->file_name);
+    job->open_errno = 0;
 
-    list* tree_list = list_new();
-    int i = 0;
-    while (file_names[i]) {
-        char* file_name = file_names[i];
-        if (verbose) fprintf(stdout, "Parsing %s\n", file_name);
+    FILE* source_in = fopen(job->file_name, "r");
+    if (!source_in) {
+        job->open_errno = errno;
+        return;
+    }
+    parser* p = new_parser(source_in, job->nr, &job->parse_errors);
+    tree* tree = parse(p);
+    free_parser(p);
+    fclose(source_in);
 
-        FILE* source_in = fopen(file_name, "r");
-        if (!source_in) {
-            perror(prg);
-            return 1;
-        }
+    if (job->parse_errors.count != 0) return;
+    translate_unit(tree, &job->unit, &job->errors);
+    if (job->exports) object_names(tree, job->exports, job->imports);
+}
+
+/*
+ * The name of the object of a source file: its base name with the
+ * extension replaced by .po.
+ */
+static char* object_name(char* file_name)
+{
+    char* base = strrchr(file_name, '/');
+    base = base ? base+1 : file_name;
+    char* name = malloc(strlen(base)+4);
+    strcpy(name, base);
+    char* dot = strrchr(name, '.');
+    if (dot && dot != name) *dot = 0;
+    strcat(name, ".po");
+    return name;
+}
 
-        init_error(file_name, stderr);
-        init_parser(file_name, source_in, i);
-        tree* tree = parse();
-        fclose(source_in);
+static int write_object_file(char* prg, char* file_name, object* obj)
+{
+    if (verbose) fprintf(stdout, "Writing object to %s\n", file_name);
+    FILE* object_out = fopen(file_name, "w");
+    if (!object_out) {
+        perror(prg);
+        return 1;
+    }
+    write_object(object_out, obj);
+    fclose(object_out);
+    return 0;
+}
+
+static int job_failed(compile_job* job)
+{
+    return job->open_errno != 0 || job->parse_errors.count != 0;
+}
+
+/*
+ * Parses and translates the files. With more than one job, they are
+ * processed concurrently. Messages are reported in the order of the
+ * files, and the code is the same as when compiling them one after
+ * the other. Returns 0 if there were errors.
+ */
+static compile_job* compile_files(char* prg, char** file_names, int n, int jobs, int objects)
+{
+    compile_job* job = calloc(n, sizeof(compile_job));
+    void** args = malloc(n*sizeof(void*));
+    for (int i = 0; i < n; i++) {
+        job[i].file_name = file_names[i];
+        /* an object is translated as file 0 and relocated when linked */
+        job[i].nr = objects ? 0 : i;
+        if (objects) {
+            job[i].exports = list_new();
+            job[i].imports = list_new();
+        }
+        args[i] = &job[i];
+    }
 
-        if (err_count != 0) return 1;
+    int done = n;
+    if (jobs != 1 && n > 1) {
+        pal_init();
+        pool_set_threads(jobs);
+        pool_run(compile_file, args, n);
+    }
+    else {
+        /* stop at the first file that fails */
+        for (int i = 0; i < n; i++) {
+            compile_file(&job[i]);
+            if (job_failed(&job[i])) {
+                done = i+1;
+                break;
+            }
+        }
+    }
 
-        list_append(tree_list, tree);
-        i++;
+    int max_errors = 5;
+    for (int i = 0; i < done; i++) {
+        if (verbose) fprintf(stdout, "Parsing %s\n", job[i].file_name);
+        if (job[i].open_errno) {
+            fprintf(stderr, "%s: %s\n", prg, strerror(job[i].open_errno));
+            return 0;
+        }
+        if (job[i].parse_errors.count != 0) {
+            print_errors(&job[i].parse_errors, stderr, max_errors);
+            return 0;
+        }
     }
 
     if (verbose) fprintf(stdout, "Translating\n");
-    init_translator();
-    int code_len;
-    BYTE* code = translate_list(tree_list, &code_len);
+    int errors = 0;
+    for (int i = 0; i < n; i++) {
+        errors += print_errors(&job[i].errors, stderr, max_errors-errors);
+    }
+    if (errors != 0) return 0;
+    return job;
+}
+
+static BYTE* link_jobs(compile_job* job, int n, int* code_len)
+{
+    code_unit* units = malloc(n*sizeof(code_unit));
+    for (int i = 0; i < n; i++) units[i] = job[i].unit;
+    BYTE* code = link_units(units, n, code_len);
+    free(units);
+    return code;
+}
+
+static int compile(char* prg, char** file_names, char* output_file_name, int jobs, int objects)
+{
+    int n = 0;
+    while (file_names[n]) n++;
+    compile_job* job = compile_files(prg, file_names, n, jobs, objects);
+    if (!job) return 1;
 
-    if (err_count != 0) return 1;
+    if (objects) {
+        for (int i = 0; i < n; i++) {
+            object obj = { file_names[i], job[i].unit, job[i].exports, job[i].imports };
+            char* object_file_name = n == 1 && output_file_name ?
+                output_file_name : object_name(file_names[i]);
+            if (write_object_file(prg, object_file_name, &obj) != 0) return 1;
+        }
+        return 0;
+    }
+
+    if (!output_file_name) output_file_name = "pocode.out";
+    int code_len;
+    BYTE* code = link_jobs(job, n, &code_len);
 
     if (verbose) fprintf(stdout, "Writing code to %s\n", output_file_name);
     FILE* code_out = fopen(output_file_name, "w");
@@ -81,54 +229,292 @@ static int compile(char* prg, char** file_names, char* output_file_name)
         perror(prg);
         return 1;
     }
-    write_code(code_out, code, code_len, file_names, i);
+    write_code(code_out, code, code_len, file_names, n);
     fclose(code_out);
 
     return 0;
 }
 
-static int run(char* prg, char* file_name)
+/*
+ * Links objects into a program. The source file names recorded in
+ * the objects become the file names of the program.
+ */
+static int link_program(char* prg, char** file_names, char* output_file_name)
 {
-    FILE* code_in = fopen(file_name, "r");
-    if (!code_in) {
+    if (!output_file_name) output_file_name = "pocode.out";
+
+    int n = 0;
+    while (file_names[n]) n++;
+    object** objects = malloc(n*sizeof(object*));
+    char** source_names = malloc(n*sizeof(char*));
+    for (int i = 0; i < n; i++) {
+        if (verbose) fprintf(stdout, "Reading %s\n", file_names[i]);
+        FILE* object_in = fopen(file_names[i], "r");
+        if (!object_in) {
+            perror(prg);
+            return 1;
+        }
+        objects[i] = read_object(object_in);
+        fclose(object_in);
+        if (!objects[i]) {
+            fprintf(stderr, "%s: error reading %s\n", prg, file_names[i]);
+            return 1;
+        }
+        source_names[i] = objects[i]->file;
+    }
+
+    if (verbose) fprintf(stdout, "Linking\n");
+    int code_len;
+    BYTE* code = link_objects(objects, n, &code_len, stderr);
+
+    if (verbose) fprintf(stdout, "Writing code to %s\n", output_file_name);
+    FILE* code_out = fopen(output_file_name, "w");
+    if (!code_out) {
         perror(prg);
         return 1;
     }
+    write_code(code_out, code, code_len, source_names, n);
+    fclose(code_out);
 
-    char** file_names;
-    int file_names_len;
-    int code_len;
-    BYTE* code = read_code(code_in, &code_len, &file_names, &file_names_len);
-    if (!code) {
-        fprintf(stderr, "%s: error reading %s\n", prg, file_name);
+    return 0;
+}
+
+static int write_symbol_map(char* prg, pal_program* program)
+{
+    FILE* file = fopen(symbol_map_file_name, "w");
+    if (!file) {
+        perror(prg);
+        return 0;
+    }
+    pal_write_symbol_map(program, file);
+    fclose(file);
+    return 1;
+}
+
+static int execute(char* prg, pal_program* program, char* file_name)
+{
+    if (symbol_map_file_name && !write_symbol_map(prg, program)) return 1;
+
+    FILE* profile_out = 0;
+    if (profile_file_name) {
+        profile_out = fopen(profile_file_name, "w");
+        if (!profile_out) {
+            perror(prg);
+            return 1;
+        }
+        if (!pal_profile_start(PROFILE_HZ)) {
+            fprintf(stderr, "%s: cannot start the profiler\n", prg);
+            return 1;
+        }
+    }
+
+    FILE* callprof_out = 0;
+    if (callprof_file_name) {
+        callprof_out = fopen(callprof_file_name, "w");
+        if (!callprof_out) {
+            perror(prg);
+            return 1;
+        }
+        pal_callprof_start();
+    }
+    if (allocprof >= 0) pal_allocprof_start(allocprof, stderr);
+    if (!pal_heap_census(heap_census)) {
+        fprintf(stderr, "%s: cannot set the census signal handler\n", prg);
+        return 1;
+    }
+    FILE* status_out = 0;
+    if (status_file_name) {
+        status_out = fopen(status_file_name, "a");
+        if (!status_out) {
+            perror(prg);
+            return 1;
+        }
+    }
+    if (!pal_status_start(status_out)) {
+        fprintf(stderr, "%s: cannot set the status signal handler\n", prg);
+        return 1;
+    }
+    if (metrics_file_name && !pal_metrics_start(metrics_file_name, metrics_interval)) {
+        fprintf(stderr, "%s: cannot set the metrics signal handler\n", prg);
         return 1;
     }
-    fclose(code_in);
 
-    init_error(file_name, stderr);
-    init_interpreter(code, code_len, file_names);
+    pal_vm* vm = pal_new_vm(program, stderr);
     if (verbose) fprintf(stdout, "Executing %s\n", file_name);
-    execute();
+    pal_run(vm);
     if (verbose) fprintf(stdout, "Terminated\n");
+    if (stats) pal_print_stats(stderr);
+    if (profile_out) {
+        pal_profile_stop(profile_out, stderr);
+        fclose(profile_out);
+    }
+    if (callprof_out) {
+        pal_callprof_stop(stderr, callprof_out);
+        fclose(callprof_out);
+    }
+    if (allocprof >= 0) pal_allocprof_stop(stderr);
+    /* again, with the bodies decoded lazily during the run */
+    if (symbol_map_file_name) write_symbol_map(prg, program);
+    if (metrics_file_name) pal_metrics_stop();
+    if (status_out) {
+        /* no report is written once the program has ended */
+        pal_status_start(0);
+        fclose(status_out);
+    }
 
     return 0;
 }
 
+static int run(char* prg, char* file_name)
+{
+    if (access(file_name, R_OK) != 0) {
+        perror(prg);
+        return 1;
+    }
+
+    pal_init();
+    pal_program* program = pal_load_file(file_name);
+    if (!program) {
+        fprintf(stderr, "%s: error reading %s\n", prg, file_name);
+        return 1;
+    }
+
+    return execute(prg, program, file_name);
+}
+
+/*
+ * Compiles the source files and runs the result. The pocode is kept
+ * in the cache, unless use_cache is 0, and an unchanged set of
+ * sources is run from there without compiling.
+ */
+static int run_source(char* prg, char** file_names, int n, int jobs, int use_cache)
+{
+    char* cache_file = 0;
+    if (use_cache) {
+        char* dir = cache_dir();
+        if (dir) cache_file = cache_file_name(dir, file_names, n);
+    }
+
+    pal_init();
+    if (cache_file) {
+        pal_program* program = pal_load_file(cache_file);
+        if (program) {
+            if (verbose) fprintf(stdout, "Using %s\n", cache_file);
+            return execute(prg, program, file_names[0]);
+        }
+    }
+
+    compile_job* job = compile_files(prg, file_names, n, jobs, 0);
+    if (!job) return 1;
+    int code_len;
+    BYTE* code = link_jobs(job, n, &code_len);
+
+    char* pocode;
+    size_t pocode_len;
+    FILE* code_out = open_memstream(&pocode, &pocode_len);
+    write_code(code_out, code, code_len, file_names, n);
+    fclose(code_out);
+
+    if (cache_file) {
+        if (verbose) fprintf(stdout, "Writing code to %s\n", cache_file);
+        if (!cache_store(cache_file, pocode, pocode_len))
+            fprintf(stderr, "%s: cannot write %s\n", prg, cache_file);
+    }
+
+    pal_program* program = pal_load((unsigned char*)pocode, pocode_len);
+    free(pocode);
+    if (!program) {
+        fprintf(stderr, "%s: error loading %s\n", prg, file_names[0]);
+        return 1;
+    }
+    return execute(prg, program, file_names[0]);
+}
+
+static int run_bundle(char* prg, const unsigned char* pocode, size_t len)
+{
+    pal_init();
+    pal_program* program = pal_load_in_place(pocode, len);
+    if (!program) {
+        fprintf(stderr, "%s: error reading bundled pocode\n", prg);
+        return 1;
+    }
+    return execute(prg, program, prg);
+}
+
+/*
+ * Whether the file starts like pocode rather than PAL source.
+ */
+static int is_pocode(char* file_name)
+{
+    FILE* file = fopen(file_name, "r");
+    if (!file) return 0;
+    int ch = fgetc(file);
+    fclose(file);
+    return ch == 0xF0;
+}
+
 static void print_usage(FILE* file, char* prg)
 {
-    fprintf(file, "Usage: %s [-c] [-h] [-d] [-v] [-o FILE] FILE...\n", prg);
+    fprintf(file, "Usage: %s [-c] [-h] [-d] [-v] [-j N] [-o FILE] [--object] [--lazy] [--stats] [--profile=FILE] [--callprof=FILE] [--allocprof[=SECONDS]] [--heap-census] [--status-file=FILE] [--symbol-map=FILE] [--metrics-file=FILE [--metrics-interval=MS]] [--threads N] FILE...\n", prg);
+    fprintf(file, "       %s [-v] [-j N] [--no-cache] [--lazy] [--stats] [--profile=FILE] [--callprof=FILE] [--allocprof[=SECONDS]] [--heap-census] [--status-file=FILE] [--symbol-map=FILE] [--metrics-file=FILE [--metrics-interval=MS]] [--threads N] SOURCE...\n", prg);
+    fprintf(file, "       %s [-v] [-o FILE] --link OBJECT...\n", prg);
+    fprintf(file, "       %s [--lazy] [-o FILE] --bundle POCODE\n", prg);
+    fprintf(file, "       %s [-v] [--lazy] [--workers N] --serve SOCKET\n", prg);
+    fprintf(file, "       %s --client SOCKET FILE\n", prg);
+    fprintf(file, "       %s --reload SOCKET\n", prg);
 }
 
+static struct option long_options[] = {
+    { "stats", no_argument, 0, 'S' },
+    { "threads", required_argument, 0, 'T' },
+    { "serve", required_argument, 0, 'L' },
+    { "client", required_argument, 0, 'C' },
+    { "workers", required_argument, 0, 'W' },
+    { "reload", required_argument, 0, 'R' },
+    { "object", no_argument, 0, 'O' },
+    { "link", no_argument, 0, 'K' },
+    { "no-cache", no_argument, 0, 'N' },
+    { "lazy", no_argument, 0, 'Z' },
+    { "bundle", required_argument, 0, 'B' },
+    { "profile", required_argument, 0, 'P' },
+    { "callprof", required_argument, 0, 'G' },
+    { "allocprof", optional_argument, 0, 'A' },
+    { "heap-census", no_argument, 0, 'H' },
+    { "status-file", required_argument, 0, 'U' },
+    { "symbol-map", required_argument, 0, 'M' },
+    { "metrics-file", required_argument, 0, 'E' },
+    { "metrics-interval", required_argument, 0, 'I' },
+    { 0, 0, 0, 0 }
+};
+
 int main(int argc, char* argv[])
 {
     int opt;
     int do_disass = 0;
     int do_compile = 0;
+    int do_object = 0;
+    int do_link = 0;
     char* file_name = 0;
     char* output_file_name = 0;
+    char* serve_socket = 0;
+    char* client_socket = 0;
+    char* reload_socket = 0;
+    int workers = 0;
+    int jobs = 1;
+    int use_cache = 1;
+    int lazy = 0;
+    char* bundle_file = 0;
     char* prg = argv[0];
 
-    while ((opt = getopt(argc, argv, "vhcdo:")) != -1) {
+    /* a bundle runs its program and takes no options */
+    size_t bundle_len;
+    const unsigned char* bundled = bundled_pocode(&bundle_len, &lazy);
+    if (bundled) {
+        pal_set_lazy(lazy);
+        return run_bundle(prg, bundled, bundle_len);
+    }
+
+    while ((opt = getopt_long(argc, argv, "vhcdj:o:", long_options, 0)) != -1) {
         switch (opt) {
         case 'd':
             do_disass = 1;
@@ -139,12 +525,75 @@ int main(int argc, char* argv[])
         case 'o':
             output_file_name = strdup(optarg);
             break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
         case 'h':
             print_usage(stdout, prg);
             return 0;
         case 'v':
             verbose = 1;
             break;
+        case 'S':
+            stats = 1;
+            break;
+        case 'T':
+            pal_set_threads(atoi(optarg));
+            break;
+        case 'L':
+            serve_socket = optarg;
+            break;
+        case 'C':
+            client_socket = optarg;
+            break;
+        case 'W':
+            workers = atoi(optarg);
+            break;
+        case 'R':
+            reload_socket = optarg;
+            break;
+        case 'O':
+            do_object = 1;
+            break;
+        case 'K':
+            do_link = 1;
+            break;
+        case 'N':
+            use_cache = 0;
+            break;
+        case 'Z':
+            lazy = 1;
+            pal_set_lazy(1);
+            break;
+        case 'B':
+            bundle_file = optarg;
+            break;
+        case 'P':
+            profile_file_name = optarg;
+            break;
+        case 'G':
+            callprof_file_name = optarg;
+            break;
+        case 'A':
+            allocprof = optarg ? atoi(optarg) : 0;
+            if (allocprof < 0) allocprof = 0;
+            break;
+        case 'H':
+            heap_census = 1;
+            break;
+        case 'U':
+            status_file_name = optarg;
+            break;
+        case 'M':
+            symbol_map_file_name = optarg;
+            break;
+        case 'E':
+            metrics_file_name = optarg;
+            break;
+        case 'I':
+            metrics_interval = atoi(optarg);
+            if (metrics_interval <= 0) metrics_interval = 1000;
+            break;
         default:
             print_usage(stderr, prg);
             return 1;
@@ -153,28 +602,47 @@ int main(int argc, char* argv[])
 
     file_name = argv[optind];
 
+    if (serve_socket) {
+        return serve(prg, serve_socket, workers, verbose);
+    }
+
+    if (bundle_file) {
+        return bundle(prg, bundle_file, output_file_name ? output_file_name : "a.out", lazy);
+    }
+
+    if (reload_socket) {
+        return reload(prg, reload_socket);
+    }
+
+    if (client_socket) {
+        if (!file_name) {
+            fprintf(stderr, "%s: missing file name\n", prg);
+            return 1;
+        }
+        return client(prg, client_socket, file_name);
+    }
+
     if (do_disass) {
         return disass(prg, file_name);
     }
 
-    if (do_compile) {
-        int nrfiles = argc-optind;
+    int nrfiles = argc-optind;
+    char** file_names = calloc(nrfiles+1, sizeof(char*));
+    for (int i = 0; i < nrfiles; i++) file_names[i] = argv[optind+i];
+
+    if (do_compile || do_object || do_link) {
         if (nrfiles == 0) {
             fprintf(stderr, "%s: missing file name\n", prg);
             exit(1);
         }
-        char** file_names = calloc(nrfiles+1, sizeof(char*));
-        int i = 0;
-        while (optind < argc) {
-            file_names[i] = argv[optind];
-            i++;
-            optind++;
-        }
-
-        return compile(prg, file_names, output_file_name);
+        if (do_link) return link_program(prg, file_names, output_file_name);
+        return compile(prg, file_names, output_file_name, jobs, do_object);
     }
 
     if (file_name) {
+        /* source files are compiled and run in one step */
+        if (access(file_name, R_OK) == 0 && !is_pocode(file_name))
+            return run_source(prg, file_names, nrfiles, jobs, use_cache);
         return run(prg, file_name);
     }
 
@@ -2,10 +2,19 @@
 #define PARSER_H
 
 #include <stdio.h>
+#include "error.h"
 #include "tree.h"
 
-void init_parser(char* filename, FILE* file, int filenr);
+typedef struct _parser parser;
 
-tree* parse();
+/*
+ * Creates a parser for the source file with number filenr, which is
+ * recorded in the line numbers of the tree.
+ */
+parser* new_parser(FILE* file, int filenr, error_log* errors);
+
+void free_parser(parser* p);
+
+tree* parse(parser* p);
 
 #endif
@@ -0,0 +1,352 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "gc.h"
+#include "pool.h"
+
+struct _task {
+    pool_fn fn;
+    void* arg;
+    atomic_int done;
+    /* number of unfinished tasks in the batch of pool_run */
+    atomic_int* pending;
+};
+
+typedef struct {
+    long size;
+    _Atomic(task*) buf[];
+} task_array;
+
+/*
+ * Chase-Lev deque following Le et al., "Correct and Efficient
+ * Work-Stealing for Weak Memory Models", PPoPP 2013. Arrays are
+ * allocated by the GC, so a thief may still read a replaced one.
+ */
+typedef struct {
+    atomic_long top;
+    atomic_long bottom;
+    _Atomic(task_array*) array;
+} deque;
+
+#define STEAL_ABORT ((task*)1)
+
+static int threads = 0;
+static atomic_int started;
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static deque** deques;
+
+/* tasks started by threads that are not workers */
+static pthread_mutex_t inject_lock = PTHREAD_MUTEX_INITIALIZER;
+static deque* injected;
+
+/* idle workers sleep on wake_cond, and threads waiting for a task
+   that find nothing to run on done_cond */
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static atomic_int sleepers;
+static atomic_int waiters;
+
+static _Thread_local int worker_id = -1;
+static _Thread_local unsigned int steal_seed;
+
+static task_array* new_array(long size)
+{
+    task_array* a = GC_MALLOC(sizeof(task_array)+size*sizeof(task*));
+    a->size = size;
+    return a;
+}
+
+static deque* new_deque()
+{
+    deque* q = GC_NEW(deque);
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->array, new_array(64));
+    return q;
+}
+
+static void push(deque* q, task* t)
+{
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&q->top, memory_order_acquire);
+    task_array* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    if (b-top > a->size-1) {
+        task_array* new = new_array(2*a->size);
+        for (long i = top; i < b; i++) {
+            task* x = atomic_load_explicit(&a->buf[i%a->size], memory_order_relaxed);
+            atomic_store_explicit(&new->buf[i%new->size], x, memory_order_relaxed);
+        }
+        atomic_store_explicit(&q->array, new, memory_order_release);
+        a = new;
+    }
+    atomic_store_explicit(&a->buf[b%a->size], t, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b+1, memory_order_relaxed);
+}
+
+static task* take(deque* q)
+{
+    long b = atomic_load_explicit(&q->bottom, memory_order_relaxed)-1;
+    task_array* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&q->top, memory_order_relaxed);
+    task* x = 0;
+    if (t <= b) {
+        x = atomic_load_explicit(&a->buf[b%a->size], memory_order_relaxed);
+        if (t == b) {
+            /* last element, race against thieves */
+            if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t+1,
+                    memory_order_seq_cst, memory_order_relaxed))
+                x = 0;
+            atomic_store_explicit(&q->bottom, b+1, memory_order_relaxed);
+        }
+    }
+    else {
+        atomic_store_explicit(&q->bottom, b+1, memory_order_relaxed);
+    }
+    return x;
+}
+
+static task* steal(deque* q)
+{
+    long t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b) return 0;
+    task_array* a = atomic_load_explicit(&q->array, memory_order_acquire);
+    task* x = atomic_load_explicit(&a->buf[t%a->size], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t+1,
+            memory_order_seq_cst, memory_order_relaxed))
+        return STEAL_ABORT;
+    return x;
+}
+
+static int has_work()
+{
+    for (int i = 0; i < threads; i++) {
+        deque* q = deques[i];
+        if (atomic_load(&q->top) < atomic_load(&q->bottom)) return 1;
+    }
+    return atomic_load(&injected->top) < atomic_load(&injected->bottom);
+}
+
+/* wakes the sleeping workers and waiters when a task is submitted */
+static void wake()
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    int s = atomic_load(&sleepers);
+    int w = atomic_load(&waiters);
+    if (s > 0 || w > 0) {
+        pthread_mutex_lock(&wake_lock);
+        if (s > 0) pthread_cond_broadcast(&wake_cond);
+        if (w > 0) pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&wake_lock);
+    }
+}
+
+/* wakes the waiters when a task has finished */
+static void finished()
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&waiters) > 0) {
+        pthread_mutex_lock(&wake_lock);
+        pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&wake_lock);
+    }
+}
+
+/* the timeout of a sleep, which guards against a missed wakeup */
+static void deadline(struct timespec* ts)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_nsec += 10000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static void run(task* t)
+{
+    t->fn(t->arg);
+    atomic_store_explicit(&t->done, 1, memory_order_release);
+    if (t->pending) atomic_fetch_sub(t->pending, 1);
+    finished();
+}
+
+/*
+ * Runs one task from the own deque or stolen from another one.
+ * Returns 0 if no task was found.
+ */
+static int help()
+{
+    task* t = 0;
+    if (worker_id >= 0) t = take(deques[worker_id]);
+    if (!t) {
+        int start = rand_r(&steal_seed)%threads;
+        for (int i = 0; i < threads && !t; i++) {
+            int victim = (start+i)%threads;
+            if (victim == worker_id) continue;
+            t = steal(deques[victim]);
+            if (t == STEAL_ABORT) t = 0;
+        }
+    }
+    if (!t) {
+        t = steal(injected);
+        if (t == STEAL_ABORT) t = 0;
+    }
+    if (!t) return 0;
+    run(t);
+    return 1;
+}
+
+static void* worker(void* arg)
+{
+    worker_id = (int)(long)arg;
+    steal_seed = worker_id;
+    int idle = 0;
+    while (1) {
+        if (help()) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < 100) {
+            sched_yield();
+            continue;
+        }
+        pthread_mutex_lock(&wake_lock);
+        atomic_fetch_add(&sleepers, 1);
+        if (!has_work()) {
+            struct timespec ts;
+            deadline(&ts);
+            pthread_cond_timedwait(&wake_cond, &wake_lock, &ts);
+        }
+        atomic_fetch_sub(&sleepers, 1);
+        pthread_mutex_unlock(&wake_lock);
+        idle = 0;
+    }
+    return 0;
+}
+
+void pool_set_threads(int n)
+{
+    threads = n;
+}
+
+int pool_threads()
+{
+    if (threads < 1) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n < 1 ? 1 : n;
+    }
+    return threads;
+}
+
+/*
+ * Starts the workers on first use. The calling thread becomes
+ * worker 0.
+ */
+static void start()
+{
+    if (atomic_load_explicit(&started, memory_order_acquire)) return;
+    pthread_mutex_lock(&start_lock);
+    if (!atomic_load(&started)) {
+        int n = pool_threads();
+        deques = GC_MALLOC(n*sizeof(deque*));
+        for (int i = 0; i < n; i++) deques[i] = new_deque();
+        injected = new_deque();
+        worker_id = 0;
+        for (int i = 1; i < n; i++) {
+            pthread_t thread;
+            if (pthread_create(&thread, 0, worker, (void*)(long)i) != 0) break;
+            pthread_detach(thread);
+        }
+        atomic_store_explicit(&started, 1, memory_order_release);
+    }
+    pthread_mutex_unlock(&start_lock);
+}
+
+static void submit(task* t)
+{
+    if (worker_id >= 0) {
+        push(deques[worker_id], t);
+    }
+    else {
+        pthread_mutex_lock(&inject_lock);
+        push(injected, t);
+        pthread_mutex_unlock(&inject_lock);
+    }
+    wake();
+}
+
+/*
+ * Waits for flag to reach value, running other tasks meanwhile. After
+ * 100 attempts that found nothing to run, it sleeps until a task
+ * finishes or is submitted.
+ */
+static void help_until(atomic_int* flag, int value)
+{
+    int idle = 0;
+    while (atomic_load_explicit(flag, memory_order_acquire) != value) {
+        if (help()) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < 100) continue;
+        pthread_mutex_lock(&wake_lock);
+        atomic_fetch_add(&waiters, 1);
+        if (atomic_load(flag) != value && !has_work()) {
+            struct timespec ts;
+            deadline(&ts);
+            pthread_cond_timedwait(&done_cond, &wake_lock, &ts);
+        }
+        atomic_fetch_sub(&waiters, 1);
+        pthread_mutex_unlock(&wake_lock);
+        idle = 0;
+    }
+}
+
+void pool_run(pool_fn fn, void** args, int n)
+{
+    if (n == 0) return;
+    start();
+    atomic_int pending;
+    atomic_init(&pending, n);
+    task* tasks = GC_MALLOC(n*sizeof(task));
+    /* push in reverse, so that the owner takes them in order */
+    for (int i = n-1; i >= 0; i--) {
+        tasks[i].fn = fn;
+        tasks[i].arg = args[i];
+        atomic_init(&tasks[i].done, 0);
+        tasks[i].pending = &pending;
+        submit(&tasks[i]);
+    }
+    help_until(&pending, 0);
+}
+
+task* pool_spawn(pool_fn fn, void* arg)
+{
+    start();
+    task* t = GC_NEW(task);
+    t->fn = fn;
+    t->arg = arg;
+    atomic_init(&t->done, 0);
+    t->pending = 0;
+    submit(t);
+    return t;
+}
+
+int pool_done(task* t)
+{
+    return atomic_load_explicit(&t->done, memory_order_acquire);
+}
+
+void pool_wait(task* t)
+{
+    help_until(&t->done, 1);
+}
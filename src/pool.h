@@ -0,0 +1,44 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ * A work-stealing scheduler. Each worker thread owns a Chase-Lev
+ * deque: it pushes and takes tasks at the bottom while idle workers
+ * steal from the top of the others.
+ */
+
+typedef void (*pool_fn)(void* arg);
+
+struct _task;
+
+typedef struct _task task;
+
+/*
+ * Sets the number of threads, including the calling thread, used by
+ * the pool. Must be called before the first task is started. A value
+ * below 1 selects the number of online processors.
+ */
+void pool_set_threads(int n);
+
+int pool_threads();
+
+/*
+ * Runs fn on each of the n args and returns when all have finished.
+ * The calling thread runs tasks while waiting, so pool_run may be
+ * called from within a task.
+ */
+void pool_run(pool_fn fn, void** args, int n);
+
+/*
+ * Starts fn on arg asynchronously and returns its task.
+ */
+task* pool_spawn(pool_fn fn, void* arg);
+
+int pool_done(task* t);
+
+/*
+ * Returns when t has finished, running other tasks in the meantime.
+ */
+void pool_wait(task* t);
+
+#endif
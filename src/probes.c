@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include "gc.h"
+#include "code.h"
+#include "probes.h"
+#include "profile.h"
+
+#ifdef HAVE_SYS_SDT_H
+/* the callback set before, called in turn */
+static GC_on_collection_event_proc chained = 0;
+
+static void collection_event(GC_EventType event)
+{
+    if (event == GC_EVENT_START)
+        PROBE0(gc__start);
+    else if (event == GC_EVENT_END)
+        PROBE0(gc__done);
+    if (chained) chained(event);
+}
+#endif
+
+void probes_init()
+{
+#ifdef HAVE_SYS_SDT_H
+    GC_on_collection_event_proc current = GC_get_on_collection_event();
+    if (current != collection_event) {
+        chained = current;
+        GC_set_on_collection_event(collection_event);
+    }
+#endif
+}
+
+void probes_write_map(pal_program* program, FILE* file)
+{
+    operation* ops = program->ops;
+    int len = program->len;
+    int* site = profile_function_sites(program);
+    /* a closure of a lazily decoded body starts at its ENTER */
+    for (int i = 0; i+4 < len; i++) {
+        if (ops[i].op == OP_FORMCLOSURE && ops[i+1].args.n == i+4 && ops[i+4].op == OP_ENTER)
+            site[i+4] = i;
+    }
+    /* the operations of the bodies not decoded yet are left out */
+    lazy_body* bodies = program->bodies;
+    for (int b = 0; b < program->bodies_len; b++) {
+        if (atomic_load(&bodies[b].decoded)) continue;
+        int end = b+1 < program->bodies_len ? bodies[b+1].first_op : len;
+        for (int i = bodies[b].first_op; i < end; i++) site[i] = -2;
+    }
+    for (int i = 0; i < len; ) {
+        int j = i+1;
+        while (j < len && site[j] == site[i]) j++;
+        if (site[i] == -2) {
+            i = j;
+            continue;
+        }
+        fprintf(file, "%x %x ", i, j-i);
+        profile_print_function(file, program, site[i]);
+        fputc('\n', file);
+        i = j;
+    }
+    free(site);
+}
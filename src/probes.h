@@ -0,0 +1,55 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <stdio.h>
+#include "vm.h"
+
+/*
+ * USDT probes of the provider pal70, for perf, bpftrace and SystemTap.
+ * They are built in if HAVE_SYS_SDT_H is defined, as by
+ * make PROBEFLAGS=-DHAVE_SYS_SDT_H, and are a nop each until a tracer
+ * enables them; otherwise they are no code at all. A pc is the index
+ * of an operation, named by the symbol map.
+ *
+ *   program__load(program, len)  a program of len operations is loaded
+ *   function__entry(pc, site)    the closure starting at pc is applied
+ *                                by the operation site, or by a builtin
+ *                                applied there
+ *   function__return(pc, ret)    the RETURN at pc returns to ret, or
+ *                                to -1 if the closure was applied by
+ *                                a builtin
+ *   builtin__entry(name, site)   the builtin name is applied
+ *   builtin__return()            and returns
+ *   runtime__error(file, line, format)
+ *                                a runtime error, with its message
+ *                                before formatting
+ *   gc__start(), gc__done()      a garbage collection
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE0(_name) DTRACE_PROBE(pal70, _name)
+#define PROBE1(_name, _a) DTRACE_PROBE1(pal70, _name, _a)
+#define PROBE2(_name, _a, _b) DTRACE_PROBE2(pal70, _name, _a, _b)
+#define PROBE3(_name, _a, _b, _c) DTRACE_PROBE3(pal70, _name, _a, _b, _c)
+#else
+#define PROBE0(_name) ((void)0)
+#define PROBE1(_name, _a) ((void)0)
+#define PROBE2(_name, _a, _b) ((void)0)
+#define PROBE3(_name, _a, _b, _c) ((void)0)
+#endif
+
+/*
+ * Fires gc__start and gc__done around the collections.
+ */
+void probes_init();
+
+/*
+ * Writes the functions of the operations of program to file, one range
+ * of operations per line, as "START SIZE NAME" with START and SIZE in
+ * hexadecimal, like the /tmp/perf-PID.map files of JIT compilers. The
+ * bodies of a lazily decoded program are only included once decoded.
+ */
+void probes_write_map(pal_program* program, FILE* file);
+
+#endif
@@ -0,0 +1,280 @@
+#define _XOPEN_SOURCE 700
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "code.h"
+#include "interpreter.h"
+#include "profile.h"
+#include "strings.h"
+#include "value.h"
+
+/* the frames recorded of a call chain, the outer ones are cut off */
+#define PROFILE_MAX_DEPTH 512
+/* the rows of the table of lines */
+#define PROFILE_LINES 20
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pal_program* program = 0;
+/*
+ * Each sample is its length n followed by n operation indices: the
+ * operation executed and the applications in the callers, innermost
+ * first, ending with -1 if the chain was cut off.
+ */
+static int* samples = 0;
+static int samples_len = 0;
+static int samples_max = 0;
+static int samples_count = 0;
+
+static void tick(int sig)
+{
+    interrupt_request(INTERRUPT_PROFILE);
+}
+
+int profile_start(int hz)
+{
+    if (hz <= 0 || hz > 1000000) return 0;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = tick;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, 0) != 0) return 0;
+
+    long usec = 1000000/hz;
+    struct itimerval t;
+    t.it_interval.tv_sec = usec/1000000;
+    t.it_interval.tv_usec = usec%1000000;
+    t.it_value = t.it_interval;
+    return setitimer(ITIMER_PROF, &t, 0) == 0;
+}
+
+int profile_chain(pal_vm* vm, int pc, stack* S, int* chain, int max)
+{
+    operation* ops = vm->program->ops;
+    int len = vm->program->len;
+    int n = 0;
+    chain[n++] = pc;
+    caller* c = vm->callers;
+    while (n < max) {
+        if (!S) {
+            /* the bottom of a call_closure, continue in its caller */
+            if (!c) return n;
+            if (c->pc > 0) chain[n++] = c->pc-1;
+            S = c->S;
+            c = c->next;
+            continue;
+        }
+        /* a frame saved by an application, not by a SETUP */
+        value* v = S->value;
+        if (v && value_is_type(v, V_STACK)) {
+            int ret = v->v.stack.pc;
+            if (ret > 0 && ret < len && ops[ret-1].op == OP_APPLY && ops[ret].op != OP_SETUP)
+                chain[n++] = ret-1;
+        }
+        S = S->next;
+    }
+    if (S || c) chain[n++] = -1;
+    return n;
+}
+
+void profile_sample(pal_vm* vm, int pc, stack* S)
+{
+    int chain[PROFILE_MAX_DEPTH+1];
+    int n = profile_chain(vm, pc, S, chain, PROFILE_MAX_DEPTH);
+
+    pthread_mutex_lock(&lock);
+    if (!program) {
+        program = vm->program;
+        retain_program(program);
+    }
+    if (vm->program == program) {
+        if (samples_len+n+1 > samples_max) {
+            samples_max = samples_max ? samples_max*2 : 4096;
+            while (samples_len+n+1 > samples_max) samples_max *= 2;
+            samples = realloc(samples, samples_max*sizeof(int));
+        }
+        samples[samples_len++] = n;
+        memcpy(&samples[samples_len], chain, n*sizeof(int));
+        samples_len += n;
+        samples_count++;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Sets site[i] for the operations from start to end, whose function
+ * is defined at outer, to the FORMCLOSURE of the function they belong
+ * to, and body_site[b] to that of lazily decoded body b. The bodies
+ * are recognised by the code of a lambda expression, as by the loader.
+ */
+static void find_sites(pal_program* program, int start, int end, int outer, int* site,
+                       int* body_site, int* ends, int* sites)
+{
+    operation* ops = program->ops;
+    int depth = 0;
+    for (int i = start; i < end; i++) {
+        while (depth > 0 && i >= ends[depth-1]) depth--;
+        site[i] = depth > 0 ? sites[depth-1] : outer;
+        if (ops[i].op != OP_FORMCLOSURE || i+4 >= end) continue;
+        int L = ops[i+1].args.n;
+        if (L != i+4 || ops[i+2].op != OP_JUMP) continue;
+        if (ops[L].op == OP_ENTER) {
+            body_site[ops[L].args.n] = i;
+        }
+        else {
+            ends[depth] = ops[i+3].args.n;
+            sites[depth++] = i;
+        }
+    }
+}
+
+int* profile_function_sites(pal_program* program)
+{
+    int len = program->len;
+    int* site = malloc((len+1)*sizeof(int));
+    for (int i = 0; i < len; i++) site[i] = -1;
+    int* body_site = malloc((program->bodies_len+1)*sizeof(int));
+    int* ends = malloc((len/4+1)*sizeof(int));
+    int* sites = malloc((len/4+1)*sizeof(int));
+
+    lazy_body* bodies = program->bodies;
+    int main_end = program->bodies_len > 0 ? bodies[0].first_op : len;
+    find_sites(program, 0, main_end, -1, site, body_site, ends, sites);
+    /* a body is decoded after the one it is nested in */
+    for (int b = 0; b < program->bodies_len; b++) {
+        if (!atomic_load(&bodies[b].decoded)) continue;
+        int end = b+1 < program->bodies_len ? bodies[b+1].first_op : len;
+        find_sites(program, bodies[b].first_op, end, body_site[b], site, body_site, ends, sites);
+    }
+    free(body_site);
+    free(ends);
+    free(sites);
+    return site;
+}
+
+void profile_print_function(FILE* file, pal_program* program, int site)
+{
+    if (site < 0) {
+        fprintf(file, "main");
+        return;
+    }
+    operation* ops = program->ops;
+    char* name = "lambda";
+    int M = ops[site+3].args.n;
+    if (M+1 < program->len && ops[M].op == OP_FORMLVALUE &&
+        (ops[M+1].op == OP_DECLNAME || ops[M+1].op == OP_INITNAME))
+        name = ref_to_string(program->strings, ops[M+1].args.ref);
+    fprintf(file, "%s (%s:%d)", name, ops[site].file, ops[site].line);
+}
+
+static int compare_strings(const void* a, const void* b)
+{
+    return strcmp(*(char**)a, *(char**)b);
+}
+
+static void write_folded(FILE* file, int* site)
+{
+    char** stacks = malloc((samples_count+1)*sizeof(char*));
+    int k = 0;
+    for (int i = 0; i < samples_len; i += samples[i]+1) {
+        int n = samples[i];
+        int* chain = &samples[i+1];
+        size_t size;
+        FILE* out = open_memstream(&stacks[k], &size);
+        for (int j = n-1; j >= 0; j--) {
+            if (j < n-1) fputc(';', out);
+            if (chain[j] < 0)
+                fprintf(out, "[truncated]");
+            else
+                profile_print_function(out, program, site[chain[j]]);
+        }
+        fclose(out);
+        k++;
+    }
+    qsort(stacks, k, sizeof(char*), compare_strings);
+    for (int i = 0; i < k; ) {
+        int j = i;
+        while (j < k && strcmp(stacks[i], stacks[j]) == 0) j++;
+        fprintf(file, "%s %d\n", stacks[i], j-i);
+        i = j;
+    }
+    for (int i = 0; i < k; i++) free(stacks[i]);
+    free(stacks);
+}
+
+typedef struct {
+    operation* op;
+    int count;
+} line_count;
+
+static int compare_lines(const void* a, const void* b)
+{
+    const line_count* x = a;
+    const line_count* y = b;
+    int c = strcmp(x->op->file, y->op->file);
+    if (c != 0) return c;
+    return x->op->line - y->op->line;
+}
+
+static int compare_counts(const void* a, const void* b)
+{
+    const line_count* x = a;
+    const line_count* y = b;
+    if (x->count != y->count) return y->count - x->count;
+    return compare_lines(a, b);
+}
+
+static void write_lines(FILE* file, int* site)
+{
+    line_count* lines = malloc((samples_count+1)*sizeof(line_count));
+    int k = 0;
+    for (int i = 0; i < samples_len; i += samples[i]+1) {
+        lines[k].op = &program->ops[samples[i+1]];
+        lines[k].count = 1;
+        k++;
+    }
+    /* count the samples of each line */
+    qsort(lines, k, sizeof(line_count), compare_lines);
+    int m = 0;
+    for (int i = 0; i < k; i++) {
+        if (m > 0 && compare_lines(&lines[m-1], &lines[i]) == 0)
+            lines[m-1].count++;
+        else
+            lines[m++] = lines[i];
+    }
+    qsort(lines, m, sizeof(line_count), compare_counts);
+
+    fprintf(file, "%d samples\n", samples_count);
+    if (m > 0) fprintf(file, "%8s %6s  %s\n", "samples", "%", "line");
+    for (int i = 0; i < m && i < PROFILE_LINES; i++) {
+        operation* op = lines[i].op;
+        fprintf(file, "%8d %5.1f%%  %s:%d  ", lines[i].count,
+                100.0*lines[i].count/samples_count, op->file, op->line);
+        profile_print_function(file, program, site[op-program->ops]);
+        fputc('\n', file);
+    }
+    free(lines);
+}
+
+void profile_stop(FILE* folded, FILE* lines)
+{
+    struct itimerval t;
+    memset(&t, 0, sizeof(t));
+    setitimer(ITIMER_PROF, &t, 0);
+    signal(SIGPROF, SIG_IGN);
+    atomic_fetch_and(&interrupts, ~INTERRUPT_PROFILE);
+
+    pthread_mutex_lock(&lock);
+    int* site = program ? profile_function_sites(program) : 0;
+    write_folded(folded, site);
+    write_lines(lines, site);
+    free(site);
+    free(samples);
+    samples = 0;
+    samples_len = samples_max = samples_count = 0;
+    if (program) release_program(program);
+    program = 0;
+    pthread_mutex_unlock(&lock);
+}
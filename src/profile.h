@@ -0,0 +1,53 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include "stack.h"
+#include "vm.h"
+
+/*
+ * The sampling profiler. A SIGPROF timer requests INTERRUPT_PROFILE,
+ * and the first VM to execute an instruction afterwards takes the
+ * sample: the operation at pc and the return addresses of the frames
+ * saved on its stack. Time spent in builtins and the GC is thus
+ * attributed to the instruction following the application.
+ */
+
+/*
+ * Starts sampling hz times per second of CPU time. Returns 0 if the
+ * timer cannot be set.
+ */
+int profile_start(int hz);
+
+/*
+ * Sets chain to the operation at pc and the applications of the frames
+ * saved on S and in the callers of vm, innermost first, and returns
+ * their number. If there are more than max, the chain is cut off and
+ * ends with -1.
+ */
+int profile_chain(pal_vm* vm, int pc, stack* S, int* chain, int max);
+
+void profile_sample(pal_vm* vm, int pc, stack* S);
+
+/*
+ * Stops sampling and writes the call chains as folded stacks to
+ * folded, and the most sampled lines to lines. A frame is named by
+ * the definition site of its function. Only samples of the program
+ * that was sampled first are kept.
+ */
+void profile_stop(FILE* folded, FILE* lines);
+
+/*
+ * Returns the FORMCLOSURE of the function of each operation of the
+ * program, or -1 for the main program. It is to be freed.
+ */
+int* profile_function_sites(pal_program* program);
+
+/*
+ * Prints the name of the function whose FORMCLOSURE is at site, or of
+ * the main program if site is -1: the name it is bound to, if it is
+ * the right hand side of a definition, and where it is defined.
+ */
+void profile_print_function(FILE* file, pal_program* program, int site);
+
+#endif
@@ -4,22 +4,24 @@
 #include "error.h"
 #include "scanner.h"
 
-static char *filename;
-static FILE* input;
-static int ch;
-static int line;
-static char* buf;
-static int buf_len;
-static int buf_max = 1024;
-
 typedef struct {
     char* name;
     token_type type;
 } name_entry;
 
-static int name_table_max = 100;
-static int name_table_size = 0;
-static name_entry** name_table;
+struct _scanner {
+    FILE* input;
+    error_log* errors;
+    int ch;
+    int line;
+    char* buf;
+    int buf_len;
+    int buf_max;
+    /* keywords and names, sorted */
+    name_entry** name_table;
+    int name_table_size;
+    int name_table_max;
+};
 
 static int name_entry_compare(const void* e1, const void* e2)
 {
@@ -28,129 +30,141 @@ static int name_entry_compare(const void* e1, const void* e2)
     return strcmp((*ne1)->name, (*ne2)->name);
 }
 
-static void kw(char* name, token_type type)
+static void kw(scanner* s, char* name, token_type type)
 {
     name_entry* entry = malloc(sizeof(name_entry));
     entry->name = name;
     entry->type = type;
-    name_table[name_table_size] = entry;
-    name_table_size++;
+    s->name_table[s->name_table_size] = entry;
+    s->name_table_size++;
 }
 
-static void ensure_buf_size(int size)
+static void ensure_buf_size(scanner* s, int size)
 {
-    if (size > buf_max) {
-        buf_max *= 2;
-        buf = realloc(buf, (buf_max+1)*sizeof(char));
+    if (size > s->buf_max) {
+        s->buf_max *= 2;
+        s->buf = realloc(s->buf, (s->buf_max+1)*sizeof(char));
     }
 }
 
-void init_scanner()
+scanner* new_scanner(FILE* file, error_log* errors)
 {
-    line = 1;
-    buf = malloc((buf_max+1)*sizeof(char));
-    buf_len = 0;
+    scanner* s = malloc(sizeof(scanner));
+    s->input = file;
+    s->errors = errors;
+    s->line = 1;
+    s->buf_max = 1024;
+    s->buf = malloc((s->buf_max+1)*sizeof(char));
+    s->buf_len = 0;
 
-    name_table_size = 0;
-    name_table = malloc(name_table_max*sizeof(name_entry*));
+    s->name_table_size = 0;
+    s->name_table_max = 100;
+    s->name_table = malloc(s->name_table_max*sizeof(name_entry*));
 
     /* register keywords */
-    kw("J",      T_JJ);
-    kw("and",    T_AND);
-    kw("aug",    T_AUG);
-    kw("def",    T_DEF);
-    kw("do",     T_DO);
-    kw("dummy",  T_DUMMY);
-    kw("eq",     T_EQ);
-    kw("false",  T_FALSE);
-    kw("fn",     T_LAMBDA);
-    kw("ge",     T_GE);
-    kw("goto",   T_GOTO);
-    kw("gr",     T_GR);
-    kw("if",     T_IF);
-    kw("ifnot",  T_IFNOT);
-    kw("ifso",   T_IFSO);
-    kw("in",     T_IN);
-    kw("jj",     T_JJ);
-    kw("le",     T_LE);
-    kw("let",    T_LET);
-    kw("ll",     T_LAMBDA);
-    kw("ls",     T_LS);
-    kw("ne",     T_NE);
-    kw("nil",    T_NIL);
-    kw("not",    T_NOT);
-    kw("or",     T_LOGOR);
-    kw("rec",    T_REC);
-    kw("res",    T_RES);
-    kw("test",   T_TEST);
-    kw("true",   T_TRUE);
-    kw("val",    T_VALOF);
-    kw("valof",  T_VALOF);
-    kw("where",  T_WHERE);
-    kw("while",  T_WHILE);
-    kw("within", T_WITHIN);
+    kw(s, "J",      T_JJ);
+    kw(s, "and",    T_AND);
+    kw(s, "aug",    T_AUG);
+    kw(s, "def",    T_DEF);
+    kw(s, "do",     T_DO);
+    kw(s, "dummy",  T_DUMMY);
+    kw(s, "eq",     T_EQ);
+    kw(s, "false",  T_FALSE);
+    kw(s, "fn",     T_LAMBDA);
+    kw(s, "ge",     T_GE);
+    kw(s, "goto",   T_GOTO);
+    kw(s, "gr",     T_GR);
+    kw(s, "if",     T_IF);
+    kw(s, "ifnot",  T_IFNOT);
+    kw(s, "ifso",   T_IFSO);
+    kw(s, "in",     T_IN);
+    kw(s, "jj",     T_JJ);
+    kw(s, "le",     T_LE);
+    kw(s, "let",    T_LET);
+    kw(s, "ll",     T_LAMBDA);
+    kw(s, "ls",     T_LS);
+    kw(s, "ne",     T_NE);
+    kw(s, "nil",    T_NIL);
+    kw(s, "not",    T_NOT);
+    kw(s, "or",     T_LOGOR);
+    kw(s, "rec",    T_REC);
+    kw(s, "res",    T_RES);
+    kw(s, "test",   T_TEST);
+    kw(s, "true",   T_TRUE);
+    kw(s, "val",    T_VALOF);
+    kw(s, "valof",  T_VALOF);
+    kw(s, "where",  T_WHERE);
+    kw(s, "while",  T_WHILE);
+    kw(s, "within", T_WITHIN);
+
+    qsort(s->name_table, s->name_table_size, sizeof(name_entry*), name_entry_compare);
+
+    s->ch = fgetc(s->input);
+    return s;
+}
 
-    qsort(name_table, name_table_size, sizeof(name_entry*), name_entry_compare);
+/*
+ * The names stay allocated, as they are referenced by the tokens.
+ */
+void free_scanner(scanner* s)
+{
+    for (int i = 0; i < s->name_table_size; i++) free(s->name_table[i]);
+    free(s->name_table);
+    free(s->buf);
+    free(s);
 }
 
-static name_entry* lookup_name(char* name)
+static name_entry* lookup_name(scanner* s, char* name)
 {
     name_entry key;
     key.name = name;
     name_entry* p = &key;
-    name_entry** res = bsearch(&p, name_table, name_table_size, sizeof(name_entry*), name_entry_compare);
+    name_entry** res = bsearch(&p, s->name_table, s->name_table_size, sizeof(name_entry*), name_entry_compare);
     if (res) return *res;
 
-    if (name_table_size == name_table_max) {
-        name_table_max *= 2;
-        name_table = realloc(name_table, name_table_max*sizeof(name_entry*));
+    if (s->name_table_size == s->name_table_max) {
+        s->name_table_max *= 2;
+        s->name_table = realloc(s->name_table, s->name_table_max*sizeof(name_entry*));
     }
 
     name_entry* new_entry = malloc(sizeof(name_entry));
     new_entry->name = strdup(name);
     new_entry->type = T_NAME;
-    name_table[name_table_size] = new_entry;
-    name_table_size++;
-    qsort(name_table, name_table_size, sizeof(name_entry*), name_entry_compare);
+    s->name_table[s->name_table_size] = new_entry;
+    s->name_table_size++;
+    qsort(s->name_table, s->name_table_size, sizeof(name_entry*), name_entry_compare);
 
     return new_entry;
 }
 
-void set_scanner_input(char* name, FILE* file)
-{
-    filename = name;
-    input = file;
-    ch = fgetc(input);
-}
-
-void scan_next(token* token)
+void scan_next(scanner* s, token* token)
 {
     START:
-    while (ch != EOF && isspace(ch)) {
-        if (ch == '\n') {
-            line++;
+    while (s->ch != EOF && isspace(s->ch)) {
+        if (s->ch == '\n') {
+            s->line++;
         }
-        ch = fgetc(input);
+        s->ch = fgetc(s->input);
     }
 
-    if (ch == EOF) {
+    if (s->ch == EOF) {
         token->type = T_EOF;
-        token->line = line;
+        token->line = s->line;
         return;
     }
 
-    token->line = line;
-    switch (ch) {
+    token->line = s->line;
+    switch (s->ch) {
     case '/':
-        ch = fgetc(input);
-        if (ch == '/') {
+        s->ch = fgetc(s->input);
+        if (s->ch == '/') {
             /* end of line comment */
-            while (ch != EOF && ch != '\n') {
-                ch = fgetc(input);
+            while (s->ch != EOF && s->ch != '\n') {
+                s->ch = fgetc(s->input);
             }
-            if (ch == '\n') {
-                line++;
-                ch = fgetc(input);
+            if (s->ch == '\n') {
+                s->line++;
+                s->ch = fgetc(s->input);
             }
             goto START;
         }
@@ -163,8 +177,8 @@ void scan_next(token* token)
         token->type = T_PLUS;
         break;
     case '-':
-        ch = fgetc(input);
-        if (ch == '>') {
+        s->ch = fgetc(s->input);
+        if (s->ch == '>') {
             token->type = T_COND;
             break;
         }
@@ -173,8 +187,8 @@ void scan_next(token* token)
             return;
         }
     case '*':
-        ch = fgetc(input);
-        if (ch == '*') {
+        s->ch = fgetc(s->input);
+        if (s->ch == '*') {
             token->type = T_POWER;
             break;
         }
@@ -186,8 +200,8 @@ void scan_next(token* token)
         token->type = T_DOT;
         break;
     case ':':
-        ch = fgetc(input);
-        if (ch == '=') {
+        s->ch = fgetc(s->input);
+        if (s->ch == '=') {
             token->type = T_ASS;
             break;
         }
@@ -245,86 +259,86 @@ void scan_next(token* token)
         break;
     case '\'':
         /* string literal */
-        buf_len = 0;
-        ch = fgetc(input);
-        while (ch != '\'' && ch != EOF) {
-            if (ch == '*') {
-                ch = fgetc(input);
-                if (ch == EOF) {
+        s->buf_len = 0;
+        s->ch = fgetc(s->input);
+        while (s->ch != '\'' && s->ch != EOF) {
+            if (s->ch == '*') {
+                s->ch = fgetc(s->input);
+                if (s->ch == EOF) {
                     break;
                 }
-                else if (ch == 'n') {
-                    ensure_buf_size(buf_len+1);
-                    buf[buf_len++] = '\n';
-                    ch = fgetc(input);
+                else if (s->ch == 'n') {
+                    ensure_buf_size(s, s->buf_len+1);
+                    s->buf[s->buf_len++] = '\n';
+                    s->ch = fgetc(s->input);
                     continue;
                 }
-                else if (ch == 't') {
-                    ensure_buf_size(buf_len+1);
-                    buf[buf_len++] = '\t';
-                    ch = fgetc(input);
+                else if (s->ch == 't') {
+                    ensure_buf_size(s, s->buf_len+1);
+                    s->buf[s->buf_len++] = '\t';
+                    s->ch = fgetc(s->input);
                     continue;
                 }
-                else if (ch == 's') {
-                    ensure_buf_size(buf_len+1);
-                    buf[buf_len++] = ' ';
-                    ch = fgetc(input);
+                else if (s->ch == 's') {
+                    ensure_buf_size(s, s->buf_len+1);
+                    s->buf[s->buf_len++] = ' ';
+                    s->ch = fgetc(s->input);
                     continue;
                 }
-                else if (ch == 'b') {
-                    ensure_buf_size(buf_len+1);
-                    buf[buf_len++] = '\b';
-                    ch = fgetc(input);
+                else if (s->ch == 'b') {
+                    ensure_buf_size(s, s->buf_len+1);
+                    s->buf[s->buf_len++] = '\b';
+                    s->ch = fgetc(s->input);
                     continue;
                 }
-                else if (ch == '*') {
-                    ensure_buf_size(buf_len+1);
-                    buf[buf_len++] = '*';
-                    ch = fgetc(input);
+                else if (s->ch == '*') {
+                    ensure_buf_size(s, s->buf_len+1);
+                    s->buf[s->buf_len++] = '*';
+                    s->ch = fgetc(s->input);
                     continue;
                 }
-                else if (ch == '\'') {
-                    ensure_buf_size(buf_len+1);
-                    buf[buf_len++] = '\'';
-                    ch = fgetc(input);
+                else if (s->ch == '\'') {
+                    ensure_buf_size(s, s->buf_len+1);
+                    s->buf[s->buf_len++] = '\'';
+                    s->ch = fgetc(s->input);
                     continue;
                 }
                 else {
-                    ensure_buf_size(buf_len+1);
-                    buf[buf_len++] = '\n';
-                    ch = fgetc(input);
+                    ensure_buf_size(s, s->buf_len+1);
+                    s->buf[s->buf_len++] = '\n';
+                    s->ch = fgetc(s->input);
                     continue;
                 }
             }
-            ensure_buf_size(buf_len+1);
-            buf[buf_len++] = ch;
-            ch = fgetc(input);
+            ensure_buf_size(s, s->buf_len+1);
+            s->buf[s->buf_len++] = s->ch;
+            s->ch = fgetc(s->input);
         }
-        if (ch != '\'')
-            error(line, "missing end of string quote");
-        buf[buf_len++] = 0;
+        if (s->ch != '\'')
+            error(s->errors, s->line, "missing end of string quote");
+        s->buf[s->buf_len++] = 0;
         token->type = T_STRING;
-        token->data.string = strdup(buf);
+        token->data.string = strdup(s->buf);
         break;
     default:
-        if (ch >= '0' && ch <= '9') {
+        if (s->ch >= '0' && s->ch <= '9') {
             /* integer and real literal */
             long i = 0;
-            while (ch >= '0' && ch <= '9') {
-                i = i*10+(ch-'0');
-                ch = fgetc(input);
+            while (s->ch >= '0' && s->ch <= '9') {
+                i = i*10+(s->ch-'0');
+                s->ch = fgetc(s->input);
             }
-            if (ch == '.') {
-                ch = fgetc(input);
-                if (!(ch >= '0' && ch <= '9'))
-                    error(line, "incorrect format of real literal");
+            if (s->ch == '.') {
+                s->ch = fgetc(s->input);
+                if (!(s->ch >= '0' && s->ch <= '9'))
+                    error(s->errors, s->line, "incorrect format of real literal");
                 double d = i;
                 double f = 0;
                 double b = 0.1;
-                while (ch >= '0' && ch <= '9') {
-                    f += b*(ch-'0');
+                while (s->ch >= '0' && s->ch <= '9') {
+                    f += b*(s->ch-'0');
                     b /= 10;
-                    ch = fgetc(input);
+                    s->ch = fgetc(s->input);
                 }
                 token->type = T_REAL;
                 token->data.real = d+f;
@@ -335,33 +349,33 @@ void scan_next(token* token)
             }
             return;
         }
-        else if ((ch >= 'a' && ch <= 'z')
-                 || (ch >= 'A' && ch <= 'Z')
-                 || ch == '_') {
+        else if ((s->ch >= 'a' && s->ch <= 'z')
+                 || (s->ch >= 'A' && s->ch <= 'Z')
+                 || s->ch == '_') {
             /* name or keyword */
-            buf_len = 0;
-            while ((ch >= 'a' && ch <= 'z')
-                   || (ch >= 'A' && ch <= 'Z')
-                   || (ch >= '0' && ch <= '9')
-                   || ch == '_') {
-                ensure_buf_size(buf_len+1);
-                buf[buf_len++] = ch;
-                ch = fgetc(input);
+            s->buf_len = 0;
+            while ((s->ch >= 'a' && s->ch <= 'z')
+                   || (s->ch >= 'A' && s->ch <= 'Z')
+                   || (s->ch >= '0' && s->ch <= '9')
+                   || s->ch == '_') {
+                ensure_buf_size(s, s->buf_len+1);
+                s->buf[s->buf_len++] = s->ch;
+                s->ch = fgetc(s->input);
             }
-            buf[buf_len++] = 0;
-            name_entry* res = lookup_name(buf);
+            s->buf[s->buf_len++] = 0;
+            name_entry* res = lookup_name(s, s->buf);
             token->type = res->type;
             token->data.string = res->name;
             return;
         }
         else {
-            error(line, "illegal character");
-            ch = fgetc(input);
+            error(s->errors, s->line, "illegal character");
+            s->ch = fgetc(s->input);
             goto START;
         }
         break;
     }
-    ch = fgetc(input);
+    s->ch = fgetc(s->input);
 }
 
 char* token_name(token_type type)
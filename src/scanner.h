@@ -2,6 +2,7 @@
 #define SCANNER_H
 
 #include <stdio.h>
+#include "error.h"
 
 typedef enum {
     T_AND,
@@ -75,11 +76,20 @@ typedef struct {
     int col;
 } token;
 
-void init_scanner();
+/*
+ * The state of scanning one file, so that several files may be
+ * scanned concurrently.
+ */
+typedef struct _scanner scanner;
 
-void set_scanner_input(char* filename, FILE* file);
+/*
+ * Creates a scanner reading file and reporting errors to errors.
+ */
+scanner* new_scanner(FILE* file, error_log* errors);
 
-void scan_next(token* token);
+void free_scanner(scanner* s);
+
+void scan_next(scanner* s, token* token);
 
 char* token_name(token_type type);
 
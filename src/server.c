@@ -0,0 +1,401 @@
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "libpal70.h"
+#include "server.h"
+
+/*
+ * Decoded programs of a worker, keyed by path and modification time.
+ */
+typedef struct _cache_entry {
+    char* path;
+    struct timespec mtime;
+    pal_program* program;
+    struct _cache_entry* next;
+} cache_entry;
+
+static cache_entry* cache = 0;
+
+static volatile sig_atomic_t stopping = 0;
+
+static volatile sig_atomic_t reloading = 0;
+
+/* the signal mask before serve blocked the signals of the master */
+static sigset_t serve_mask;
+
+static void on_stop(int sig)
+{
+    stopping = 1;
+}
+
+static void on_reload(int sig)
+{
+    reloading = 1;
+}
+
+/* interrupts the master's sigsuspend to replace a worker */
+static void on_child(int sig)
+{
+}
+
+static pal_program* cache_lookup(char* path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+
+    cache_entry* entry = cache;
+    while (entry && strcmp(entry->path, path) != 0) entry = entry->next;
+    if (entry) {
+        if (entry->mtime.tv_sec == st.st_mtim.tv_sec &&
+            entry->mtime.tv_nsec == st.st_mtim.tv_nsec)
+            return entry->program;
+        /* the file changed since it was decoded */
+        pal_program* program = pal_load_file(path);
+        if (!program) return 0;
+        pal_free_program(entry->program);
+        entry->program = program;
+        entry->mtime = st.st_mtim;
+        return program;
+    }
+
+    pal_program* program = pal_load_file(path);
+    if (!program) return 0;
+    entry = malloc(sizeof(cache_entry));
+    entry->path = strdup(path);
+    entry->mtime = st.st_mtim;
+    entry->program = program;
+    entry->next = cache;
+    cache = entry;
+    return program;
+}
+
+/*
+ * Decodes all cached programs again and swaps them in, also those
+ * whose file was replaced without changing its modification time,
+ * which cache_lookup cannot notice. The old program is released, and
+ * freed once no VM runs it anymore. If the new file cannot be
+ * decoded, the old program is kept.
+ */
+static void reload_cache()
+{
+    for (cache_entry* entry = cache; entry; entry = entry->next) {
+        struct stat st;
+        if (stat(entry->path, &st) != 0) continue;
+        pal_program* program = pal_load_file(entry->path);
+        if (!program) {
+            fprintf(stderr, "pal70: error reading %s, keeping old version\n", entry->path);
+            continue;
+        }
+        pal_program* old = entry->program;
+        entry->program = program;
+        entry->mtime = st.st_mtim;
+        pal_free_program(old);
+    }
+}
+
+/*
+ * Reads the request line byte by byte, so that nothing of the
+ * program's input is consumed.
+ */
+static int read_request(int conn, char* path, int size)
+{
+    int i = 0;
+    while (i < size-1) {
+        char ch;
+        ssize_t n = read(conn, &ch, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        if (ch == '\n') {
+            path[i] = 0;
+            return i > 0;
+        }
+        path[i++] = ch;
+    }
+    return 0;
+}
+
+/*
+ * Runs the requested program with the connection as standard input
+ * and output. Runtime errors are reported to the client as well.
+ */
+static void handle(int conn, int saved_in, int saved_out)
+{
+    char path[PATH_MAX];
+    if (!read_request(conn, path, sizeof(path))) return;
+
+    if (strcmp(path, "!reload") == 0) {
+        /* the master passes it on to all workers */
+        kill(getppid(), SIGHUP);
+        dprintf(conn, "reloading\n");
+        return;
+    }
+
+    pal_program* program = cache_lookup(path);
+    if (!program) {
+        dprintf(conn, "pal70: error reading %s\n", path);
+        return;
+    }
+
+    __fpurge(stdin);
+    clearerr(stdin);
+    dup2(conn, 0);
+    dup2(conn, 1);
+
+    pal_vm* vm = pal_new_vm(program, stdout);
+    pal_run(vm);
+    pal_free_vm(vm);
+
+    fflush(stdout);
+    __fpurge(stdin);
+    clearerr(stdin);
+    dup2(saved_in, 0);
+    dup2(saved_out, 1);
+}
+
+/*
+ * SIGHUP is only delivered while a worker waits for a connection, so
+ * that requests are never interrupted and reloading happens between
+ * them.
+ */
+static void worker(int sock)
+{
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &serve_mask, 0);
+    sigset_t hup, wait_mask;
+    sigemptyset(&hup);
+    sigaddset(&hup, SIGHUP);
+    sigprocmask(SIG_BLOCK, &hup, &wait_mask);
+    sigdelset(&wait_mask, SIGHUP);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_reload;
+    sigaction(SIGHUP, &sa, 0);
+
+    int saved_in = dup(0);
+    int saved_out = dup(1);
+    for (;;) {
+        if (reloading) {
+            reloading = 0;
+            reload_cache();
+        }
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        if (pselect(sock+1, &fds, 0, 0, 0, &wait_mask) < 0) {
+            if (errno == EINTR) continue;
+            perror("pal70: select");
+            _exit(1);
+        }
+        /* the socket is non-blocking, another worker may be faster */
+        int conn = accept(sock, 0, 0);
+        if (conn < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                errno == EINTR || errno == ECONNABORTED) continue;
+            perror("pal70: accept");
+            _exit(1);
+        }
+        handle(conn, saved_in, saved_out);
+        close(conn);
+    }
+}
+
+static pid_t start_worker(int sock)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        worker(sock);
+        _exit(0);
+    }
+    return pid;
+}
+
+int serve(char* prg, char* socket_name, int workers, int verbose)
+{
+    struct sockaddr_un addr;
+    if (strlen(socket_name) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket name too long\n", prg);
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_name);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror(prg);
+        return 1;
+    }
+    unlink(socket_name);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(sock, 128) != 0) {
+        perror(prg);
+        return 1;
+    }
+
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL)|O_NONBLOCK);
+
+    if (workers <= 0) workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0) workers = 1;
+
+    /* the signals are only delivered in sigsuspend, so that none
+       arrives between checking the flags and waiting */
+    sigset_t block;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    sigaddset(&block, SIGHUP);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &serve_mask);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    sa.sa_handler = on_reload;
+    sigaction(SIGHUP, &sa, 0);
+    sa.sa_handler = on_child;
+    sigaction(SIGCHLD, &sa, 0);
+    signal(SIGPIPE, SIG_IGN);
+
+    /* the workers fork before any thread exists */
+    pal_init();
+    if (verbose) fprintf(stdout, "Serving on %s with %d workers\n", socket_name, workers);
+    pid_t* pids = calloc(workers, sizeof(pid_t));
+    for (int i = 0; i < workers; i++) pids[i] = start_worker(sock);
+
+    while (!stopping) {
+        if (reloading) {
+            reloading = 0;
+            if (verbose) fprintf(stdout, "Reloading\n");
+            for (int i = 0; i < workers; i++) kill(pids[i], SIGHUP);
+        }
+        pid_t pid;
+        while ((pid = waitpid(-1, 0, WNOHANG)) > 0) {
+            /* replace a worker that died */
+            for (int i = 0; i < workers; i++) {
+                if (pids[i] == pid) pids[i] = start_worker(sock);
+            }
+        }
+        if (!stopping && !reloading) sigsuspend(&serve_mask);
+    }
+
+    for (int i = 0; i < workers; i++) kill(pids[i], SIGTERM);
+    while (wait(0) > 0);
+    sigprocmask(SIG_SETMASK, &serve_mask, 0);
+    close(sock);
+    unlink(socket_name);
+    free(pids);
+    return 0;
+}
+
+static int write_all(int fd, char* buf, ssize_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        buf += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/*
+ * Connects to the server and sends the request line. Returns the
+ * socket, or -1 after printing an error.
+ */
+static int request(char* prg, char* socket_name, char* line)
+{
+    struct sockaddr_un addr;
+    if (strlen(socket_name) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket name too long\n", prg);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_name);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror(prg);
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!write_all(sock, line, strlen(line)) || !write_all(sock, "\n", 1)) {
+        perror(prg);
+        return -1;
+    }
+    return sock;
+}
+
+/*
+ * Sends the request and copies standard input to the connection and
+ * the connection to standard output until the server closes it.
+ */
+int client(char* prg, char* socket_name, char* file_name)
+{
+    char path[PATH_MAX];
+    if (!realpath(file_name, path)) {
+        perror(prg);
+        return 1;
+    }
+    int sock = request(prg, socket_name, path);
+    if (sock < 0) return 1;
+
+    char buf[4096];
+    struct pollfd fds[2] = {
+        { sock, POLLIN, 0 },
+        { 0, POLLIN, 0 }
+    };
+    int nfds = 2;
+    for (;;) {
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror(prg);
+            return 1;
+        }
+        if (fds[0].revents) {
+            ssize_t n = read(sock, buf, sizeof(buf));
+            if (n <= 0) break;
+            if (!write_all(1, buf, n)) return 1;
+        }
+        if (nfds == 2 && fds[1].revents) {
+            ssize_t n = read(0, buf, sizeof(buf));
+            if (n <= 0 || !write_all(sock, buf, n)) {
+                /* no more input for the program */
+                shutdown(sock, SHUT_WR);
+                nfds = 1;
+            }
+        }
+    }
+    close(sock);
+    return 0;
+}
+
+int reload(char* prg, char* socket_name)
+{
+    int sock = request(prg, socket_name, "!reload");
+    if (sock < 0) return 1;
+    char buf[64];
+    ssize_t n;
+    while ((n = read(sock, buf, sizeof(buf))) > 0) write_all(1, buf, n);
+    close(sock);
+    return 0;
+}
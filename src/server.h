@@ -0,0 +1,22 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*
+ * Persistent server mode. The server listens on a Unix socket and
+ * hands connections to pre-forked worker processes. A request is the
+ * absolute path of a pocode file terminated by a newline; the rest of
+ * the connection is the standard input and output of the program.
+ * A worker decodes a cached program again when the modification time
+ * of its file changed, so each request runs the file as it is when the
+ * request arrives. The request "!reload", or SIGHUP to the server,
+ * makes the workers decode all their cached programs again between
+ * requests, for files replaced with the same modification time.
+ */
+
+int serve(char* prg, char* socket_name, int workers, int verbose);
+
+int client(char* prg, char* socket_name, char* file_name);
+
+int reload(char* prg, char* socket_name);
+
+#endif
@@ -2,6 +2,7 @@
 #define STACK_H
 
 #include <stdio.h>
+#include "allocprof.h"
 #include "value.h"
 
 struct _stack {
@@ -13,6 +14,7 @@ typedef struct _stack stack;
 
 #define push(_S, _V) { \
         stack* _top = GC_NEW(stack); \
+        if (allocprof_on) allocprof_record(_top, ALLOC_STACK, sizeof(stack)); \
         _top->next = _S; \
         _top->value = _V; \
         _S = _top; }
@@ -0,0 +1,104 @@
+#define _XOPEN_SOURCE 700
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "gc.h"
+#include "interpreter.h"
+#include "profile.h"
+#include "status.h"
+
+/* the lines of the call stack written at either end of a longer one */
+#define STATUS_FRAMES 16
+
+static FILE* report = 0;
+static struct timespec start;
+
+static void request(int sig)
+{
+    interrupt_request(INTERRUPT_STATUS);
+}
+
+int status_start(FILE* file)
+{
+    report = file;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGUSR1, &sa, 0) == 0;
+}
+
+static int same_line(pal_program* program, int* site, int i, int j)
+{
+    operation* ops = program->ops;
+    return site[i] == site[j] && ops[i].line == ops[j].line && ops[i].file == ops[j].file;
+}
+
+static void print_operation(FILE* file, pal_program* program, int* site, int i)
+{
+    operation* op = &program->ops[i];
+    fprintf(file, "%s:%d in ", op->file, op->line);
+    profile_print_function(file, program, site[i]);
+}
+
+void status_write(pal_vm* vm, int pc, stack* S)
+{
+    FILE* file = report ? report : vm->err;
+    pal_program* program = vm->program;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec-start.tv_sec) + (now.tv_nsec-start.tv_nsec)/1e9;
+
+    /* the cells of the stack, with those of the callers */
+    long depth = 0;
+    int callers = 0;
+    for (stack* s = S; s; s = s->next) depth++;
+    for (caller* c = vm->callers; c; c = c->next) {
+        callers++;
+        for (stack* s = c->S; s; s = s->next) depth++;
+    }
+    int* chain = malloc((depth+callers+1)*sizeof(int));
+    int n = profile_chain(vm, pc, S, chain, depth+callers+1);
+    int* site = profile_function_sites(program);
+
+    /* the first frame and the number of frames of each line, as a recursion is one line */
+    int* lines = malloc(2*n*sizeof(int));
+    int m = 0;
+    for (int i = 0; i < n; ) {
+        int j = i+1;
+        while (j < n && same_line(program, site, chain[i], chain[j])) j++;
+        lines[2*m] = chain[i];
+        lines[2*m+1] = j-i;
+        m++;
+        i = j;
+    }
+
+    fprintf(file, "status of pid %d after %.3f s\n", (int)getpid(), elapsed);
+    fprintf(file, "at ");
+    print_operation(file, program, site, pc);
+    fprintf(file, "\n%ld instructions, %d frames, %ld stack cells\n", vm->instructions, n, depth);
+    fprintf(file, "heap %lu bytes after %lu collections\n",
+            (unsigned long)GC_get_heap_size(), (unsigned long)GC_get_gc_no());
+    fprintf(file, "call stack, innermost first\n");
+    for (int k = 0; k < m; k++) {
+        if (m > 2*STATUS_FRAMES+1 && k == STATUS_FRAMES) {
+            int frames = 0;
+            for (int l = k; l < m-STATUS_FRAMES; l++) frames += lines[2*l+1];
+            fprintf(file, "  ... %d frames\n", frames);
+            k = m-STATUS_FRAMES-1;
+            continue;
+        }
+        fprintf(file, "  ");
+        print_operation(file, program, site, lines[2*k]);
+        if (lines[2*k+1] > 1) fprintf(file, " x%d", lines[2*k+1]);
+        fputc('\n', file);
+    }
+    fflush(file);
+    free(chain);
+    free(site);
+    free(lines);
+}
@@ -0,0 +1,26 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdio.h>
+#include "stack.h"
+#include "vm.h"
+
+/*
+ * The status report. SIGUSR1 requests INTERRUPT_STATUS, and the first
+ * VM to execute an instruction afterwards writes where it is: the
+ * operation at pc and the applications of the frames saved on its
+ * stack, with the depth of the stack, the instructions it executed,
+ * the size of the heap and the time since status_start. It then
+ * continues as if nothing happened.
+ */
+
+/*
+ * Makes SIGUSR1 request a report, written to file, or to the error
+ * file of the VM if file is 0. Returns 0 if the signal handler cannot
+ * be set.
+ */
+int status_start(FILE* file);
+
+void status_write(pal_vm* vm, int pc, stack* S);
+
+#endif
@@ -1,53 +1,100 @@
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "strings.h"
 
-typedef struct {
+/*
+ * The strings are found through an open addressing hash index of
+ * their references plus 1, with linear probing.
+ */
+struct _strings {
     int size;
     int max;
     char** strings;
-} string_table;
+    int index_cap;
+    int* index;
+};
 
-static string_table* ST;
+strings* new_strings()
+{
+    strings* st = malloc(sizeof(strings));
+    st->size = 0;
+    st->max = 512;
+    st->strings = calloc(st->max, sizeof(char*));
+    st->index_cap = 1024;
+    st->index = calloc(st->index_cap, sizeof(int));
+    return st;
+}
+
+void free_strings(strings* st)
+{
+    for (int i = 0; i < st->size; i++) free(st->strings[i]);
+    free(st->strings);
+    free(st->index);
+    free(st);
+}
 
-void init_strings()
+/* 32-bit FNV-1a */
+static uint32_t hash(char* string)
 {
-    ST = malloc(sizeof(string_table));
-    ST->size = 0;
-    ST->max = 512;
-    ST->strings = calloc(ST->max, sizeof(char*));
+    uint32_t h = 2166136261u;
+    for (unsigned char* p = (unsigned char*)string; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
 }
 
-int string_to_ref(char* string)
+/*
+ * The slot of string in the index, or of the empty slot where it
+ * belongs.
+ */
+static int find_slot(strings* st, char* string)
 {
-    int size = ST->size;
-    for (int i = 0; i < size; i++) {
-        if (strcmp(string, ST->strings[i]) == 0) {
-            return i;
-        }
+    int mask = st->index_cap-1;
+    int i = hash(string)&mask;
+    while (st->index[i] && strcmp(string, st->strings[st->index[i]-1]) != 0) {
+        i = (i+1)&mask;
     }
+    return i;
+}
+
+static void grow_index(strings* st)
+{
+    free(st->index);
+    st->index_cap *= 2;
+    st->index = calloc(st->index_cap, sizeof(int));
+    for (int ref = 0; ref < st->size; ref++) {
+        st->index[find_slot(st, st->strings[ref])] = ref+1;
+    }
+}
+
+int string_to_ref(strings* st, char* string)
+{
+    int i = find_slot(st, string);
+    if (st->index[i]) return st->index[i]-1;
+
+    int size = st->size;
     size++;
-    if (size > ST->max) {
-        ST->max *= 2;
-        ST->strings = realloc(ST->strings, ST->max*sizeof(char*));
+    if (size > st->max) {
+        st->max *= 2;
+        st->strings = realloc(st->strings, st->max*sizeof(char*));
     }
-    ST->size = size;
-    ST->strings[size-1] = strdup(string);
+    st->size = size;
+    st->strings[size-1] = strdup(string);
+    st->index[i] = size;
+    /* at most half full */
+    if (2*size > st->index_cap) grow_index(st);
     return size-1;
 }
 
-int string_to_ref_if_exists(char* string)
+int string_to_ref_if_exists(strings* st, char* string)
 {
-    int size = ST->size;
-    for (int i = 0; i < size; i++) {
-        if (strcmp(string, ST->strings[i]) == 0) {
-            return i;
-        }
-    }
-    return -1;
+    int i = find_slot(st, string);
+    return st->index[i]-1;
 }
 
-char* ref_to_string(int ref)
+char* ref_to_string(strings* st, int ref)
 {
-    return ST->strings[ref];
+    return st->strings[ref];
 }
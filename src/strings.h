@@ -1,12 +1,21 @@
 #ifndef STRINGS_H
 #define STRINGS_H
 
-void init_strings();
+/*
+ * A table interning the names and strings of a program as integer
+ * references.
+ */
 
-int string_to_ref(char* string);
+typedef struct _strings strings;
 
-int string_to_ref_if_exists(char* string);
+strings* new_strings();
 
-char* ref_to_string(int ref);
+void free_strings(strings* st);
+
+int string_to_ref(strings* st, char* string);
+
+int string_to_ref_if_exists(strings* st, char* string);
+
+char* ref_to_string(strings* st, int ref);
 
 #endif
@@ -4,32 +4,42 @@
 #include "error.h"
 #include "code.h"
 
-static int param_number;
-static int ssp;
-static int msp;
-static BYTE* code;
-static int code_max;
-static int code_len;
-static int line;
+typedef struct {
+    error_log* errors;
+    int param_number;
+    int ssp;
+    int msp;
+    BYTE* code;
+    int code_max;
+    int code_len;
+    int line;
+    /* positions of label numbers and line numbers in code */
+    int* refs;
+    int refs_len;
+    int refs_max;
+    int* lines;
+    int lines_len;
+    int lines_max;
+} translator;
 
 typedef enum {
     MODE_VAL,
     MODE_REF
 } trans_mode;
 
-static void trans(tree* t, trans_mode mode);
-static void declnames(tree* t);
+static void trans(translator* tr, tree* t, trans_mode mode);
+static void declnames(translator* tr, tree* t);
 
 /* set line of tree */
-static void sl(tree* t) {
-    line = t->line;
+static void sl(translator* tr, tree* t) {
+    tr->line = t->line;
 }
 
-static void ensure_code(int len)
+static void ensure_code(translator* tr, int len)
 {
-    if (len >= code_max) {
-        code_max *= 2;
-        code = realloc(code, sizeof(BYTE)*code_max);
+    if (len >= tr->code_max) {
+        tr->code_max *= 2;
+        tr->code = realloc(tr->code, sizeof(BYTE)*tr->code_max);
     }
 }
 
@@ -60,132 +70,151 @@ static op type_to_op(tree_type type)
     }
 }
 
-static void up_ssp(int n)
+static void up_ssp(translator* tr, int n)
 {
-    ssp += n;
-    if (ssp > msp) msp = ssp;
+    tr->ssp += n;
+    if (tr->ssp > tr->msp) tr->msp = tr->ssp;
 }
 
-static int next_param()
+static int next_param(translator* tr)
 {
-    param_number++;
-    return param_number;
+    tr->param_number++;
+    return tr->param_number;
 }
 
-static void out_byte(BYTE byte)
+static void out_byte(translator* tr, BYTE byte)
 {
-    ensure_code(code_len+1);
-    code[code_len++] = byte;
+    ensure_code(tr, tr->code_len+1);
+    tr->code[tr->code_len++] = byte;
 }
 
-static void out_int(int i)
+static void out_int(translator* tr, int i)
 {
-    ensure_code(code_len+4);
-    encode_int(i, &code[code_len]);
-    code_len += 4;
+    ensure_code(tr, tr->code_len+4);
+    encode_int(i, &tr->code[tr->code_len]);
+    tr->code_len += 4;
 }
 
-static void out_integer(INTEGER integer)
+static void out_integer(translator* tr, INTEGER integer)
 {
-    ensure_code(code_len+8);
-    encode_integer(integer, &code[code_len]);
-    code_len += 8;
+    ensure_code(tr, tr->code_len+8);
+    encode_integer(integer, &tr->code[tr->code_len]);
+    tr->code_len += 8;
 }
 
-static void out_real(REAL real)
+static void out_real(translator* tr, REAL real)
 {
-    ensure_code(code_len+8);
-    encode_real(real, &code[code_len]);
-    code_len += 8;
+    ensure_code(tr, tr->code_len+8);
+    encode_real(real, &tr->code[tr->code_len]);
+    tr->code_len += 8;
 }
 
-static void out_op(op op)
+static void out_op(translator* tr, op op)
 {
-    out_byte(op);
-    out_int(line);
+    out_byte(tr, op);
+    if (tr->lines_len == tr->lines_max) {
+        tr->lines_max *= 2;
+        tr->lines = realloc(tr->lines, sizeof(int)*tr->lines_max);
+    }
+    tr->lines[tr->lines_len++] = tr->code_len;
+    out_int(tr, tr->line);
 }
 
-static void out_equ(int L, int N)
+/*
+ * Writes the label number L and notes its position, so that it can
+ * be relocated when the code is linked.
+ */
+static void out_ref(translator* tr, int L)
 {
-    out_op(OP_EQU);
-    out_int(L);
-    out_int(N);
+    if (tr->refs_len == tr->refs_max) {
+        tr->refs_max *= 2;
+        tr->refs = realloc(tr->refs, sizeof(int)*tr->refs_max);
+    }
+    tr->refs[tr->refs_len++] = tr->code_len;
+    out_int(tr, L);
 }
 
-static void out_param(int N)
+static void out_equ(translator* tr, int L, int N)
 {
-    out_op(OP_PARAM);
-    out_int(N);
+    out_op(tr, OP_EQU);
+    out_ref(tr, L);
+    out_int(tr, N);
 }
 
-static void out_name(char* s)
+static void out_param(translator* tr, int N)
+{
+    out_op(tr, OP_PARAM);
+    out_ref(tr, N);
+}
+
+static void out_name(translator* tr, char* s)
 {
     int len = strlen(s);
-    out_int(len);
+    out_int(tr, len);
     for (int i = 0; i < len; i++) {
-        out_byte(s[i]);
+        out_byte(tr, s[i]);
     }
 }
 
-static void out_string(char* s)
+static void out_string(translator* tr, char* s)
 {
     int len = strlen(s);
-    out_int(len);
+    out_int(tr, len);
     for (int i = 0; i < len; i++) {
-        out_byte(s[i]);
+        out_byte(tr, s[i]);
     }
 }
 
-static void out_label(int N)
+static void out_label(translator* tr, int N)
 {
-    out_op(OP_LABEL);
-    out_int(N);
+    out_op(tr, OP_LABEL);
+    out_ref(tr, N);
 }
 
-static void load_definee(tree* t)
+static void load_definee(translator* tr, tree* t)
 {
     if (!t) return;
-    sl(t);
+    sl(tr, t);
     switch (t->type) {
     case S_NAME: {
-        out_op(OP_LOADR);
-        out_name(tree_string(t));
-        up_ssp(1);
-        out_op(OP_FORMLVALUE);
+        out_op(tr, OP_LOADR);
+        out_name(tr, tree_string(t));
+        up_ssp(tr, 1);
+        out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_AND: {
         int size = tree_list_size(t);
         for (int i = size-1; i >= 0; i--) {
-            load_definee(tree_list_element(t, i));
+            load_definee(tr, tree_list_element(t, i));
         }
-        out_op(OP_TUPLE);
-        out_int(size);
-        ssp = ssp-size+1;
-        out_op(OP_FORMLVALUE);
+        out_op(tr, OP_TUPLE);
+        out_int(tr, size);
+        tr->ssp = tr->ssp-size+1;
+        out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_COMMA: {
         int size = tree_list_size(t);
         for (int i = size-1; i >= 0; i--) {
-            load_definee(tree_list_element(t, i));
+            load_definee(tr, tree_list_element(t, i));
         }
-        out_op(OP_TUPLE);
-        out_int(size);
-        ssp = ssp-size+1;
-        out_op(OP_FORMLVALUE);
+        out_op(tr, OP_TUPLE);
+        out_int(tr, size);
+        tr->ssp = tr->ssp-size+1;
+        out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_REC: {
-        load_definee(tree_operand(t));
+        load_definee(tr, tree_operand(t));
         break;
     }
     case S_VALDEF: {
-        load_definee(tree_left(t));
+        load_definee(tr, tree_left(t));
         break;
     }
     case S_WITHIN: {
-        load_definee(tree_right(t));
+        load_definee(tr, tree_right(t));
         break;
     }
     default:
@@ -193,42 +222,42 @@ static void load_definee(tree* t)
     }
 }
 
-static void declguesses(tree* t)
+static void declguesses(translator* tr, tree* t)
 {
     if (!t) return;
-    sl(t);
+    sl(tr, t);
     switch (t->type) {
     case S_NAME: {
-        out_op(OP_LOADGUESS);
-        if (ssp == msp) msp = ssp+1;
-        out_op(OP_DECLNAME);
-        out_name(tree_string(t));
+        out_op(tr, OP_LOADGUESS);
+        if (tr->ssp == tr->msp) tr->msp = tr->ssp+1;
+        out_op(tr, OP_DECLNAME);
+        out_name(tr, tree_string(t));
         break;
     }
     case S_AND: {
         int size = tree_list_size(t);
         for (int i = 0; i < size; i++) {
-            declguesses(tree_list_element(t, i));
+            declguesses(tr, tree_list_element(t, i));
         }
         break;
     }
     case S_COMMA: {
         int size = tree_list_size(t);
         for (int i = 0; i < size; i++) {
-            declguesses(tree_list_element(t, i));
+            declguesses(tr, tree_list_element(t, i));
         }
         break;
     }
     case S_REC: {
-        declguesses(tree_operand(t));
+        declguesses(tr, tree_operand(t));
         break;
     }
     case S_VALDEF: {
-        declguesses(tree_left(t));
+        declguesses(tr, tree_left(t));
         break;
     }
     case S_WITHIN: {
-        declguesses(tree_right(t));
+        declguesses(tr, tree_right(t));
         break;
     }
     default:
@@ -236,48 +265,48 @@ static void declguesses(tree* t)
     }
 }
 
-static void initnames(tree* t)
+static void initnames(translator* tr, tree* t)
 {
     if (!t) return;
-    sl(t);
+    sl(tr, t);
     switch (t->type) {
     case S_NAME: {
-        out_op(OP_INITNAME);
-        out_name(tree_string(t));
-        ssp--;
+        out_op(tr, OP_INITNAME);
+        out_name(tr, tree_string(t));
+        tr->ssp--;
         break;
     }
     case S_AND: {
         int size = tree_list_size(t);
-        out_op(OP_MEMBERS);
-        out_int(size);
-        up_ssp(size-1);
+        out_op(tr, OP_MEMBERS);
+        out_int(tr, size);
+        up_ssp(tr, size-1);
         for (int i = 0; i < size; i++) {
-            initnames(tree_list_element(t, i));
+            initnames(tr, tree_list_element(t, i));
         }
         break;
     }
     case S_COMMA: {
         int size = tree_list_size(t);
-        out_op(OP_INITNAMES);
-        out_int(size);
-        ssp--;
+        out_op(tr, OP_INITNAMES);
+        out_int(tr, size);
+        tr->ssp--;
         for (int i = 0; i < size; i++) {
             char* name = tree_string(tree_list_element(t, i));
-            out_name(name);
+            out_name(tr, name);
         }
         break;
     }
     case S_REC: {
-        initnames(tree_operand(t));
+        initnames(tr, tree_operand(t));
         break;
     }
     case S_VALDEF: {
-        initnames(tree_left(t));
+        initnames(tr, tree_left(t));
         break;
     }
     case S_WITHIN: {
-        initnames(tree_right(t));
+        initnames(tr, tree_right(t));
         break;
     }
     default:
@@ -288,97 +317,97 @@ static void initnames(tree* t)
 /*
  * Find labels in the tree and generate label numbers.
  */
-static int find_labels(tree* t)
+static int find_labels(translator* tr, tree* t)
 {
     if (!t) return 0;
-    sl(t);
+    sl(tr, t);
     switch (t->type) {
     case S_COLON: {
         /* new label number */
-        int L = next_param();
+        int L = next_param(tr);
         /* add label number to colon statement */
         tree_list_element(t, 2) = tree_make_integer(t->line, L);
-        out_op(OP_DECLLABEL);
+        out_op(tr, OP_DECLLABEL);
         char* name = tree_string(tree_list_element(t, 0));
-        out_name(name);
-        out_param(L);
-        return 1+find_labels(tree_list_element(t, 1));
+        out_name(tr, name);
+        out_param(tr, L);
+        return 1+find_labels(tr, tree_list_element(t, 1));
     }
     case S_COND: {
-        int nl1 = find_labels(tree_list_element(t, 1));
-        int nl2 = find_labels(tree_list_element(t, 2));
+        int nl1 = find_labels(tr, tree_list_element(t, 1));
+        int nl2 = find_labels(tr, tree_list_element(t, 2));
         return nl1+nl2;
     }
     case S_WHILE:
-        return find_labels(tree_right(t));
+        return find_labels(tr, tree_right(t));
     case S_SEQ:
-        return find_labels(tree_left(t))+find_labels(tree_right(t));
+        return find_labels(tr, tree_left(t))+find_labels(tr, tree_right(t));
     default:
         return 0;
     }
 }
 
-static void trans_labels(tree* t)
+static void trans_labels(translator* tr, tree* t)
 {
-    int n = find_labels(t);
+    int n = find_labels(tr, t);
     if (n != 0) {
-        sl(t);
-        out_op(OP_SETLABES);
-        out_int(n);
+        sl(tr, t);
+        out_op(tr, OP_SETLABES);
+        out_int(tr, n);
     }
 }
 
-static void trans_rhs(tree* t)
+static void trans_rhs(translator* tr, tree* t)
 {
     if (!t) return;
-    sl(t);
+    sl(tr, t);
     switch (t->type) {
     case S_AND: {
         int size = tree_list_size(t);
         for (int i = size-1; i >= 0; i--) {
-            trans_rhs(tree_list_element(t, i));
+            trans_rhs(tr, tree_list_element(t, i));
         }
-        out_op(OP_TUPLE);
-        out_int(size);
-        ssp = ssp-size+1;
-        out_op(OP_FORMLVALUE);
+        out_op(tr, OP_TUPLE);
+        out_int(tr, size);
+        tr->ssp = tr->ssp-size+1;
+        out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_VALDEF:
-        trans(tree_right(t), MODE_REF);
+        trans(tr, tree_right(t), MODE_REF);
         break;
     case S_REC: {
-        out_op(OP_LOADE);
-        up_ssp(1);
+        out_op(tr, OP_LOADE);
+        up_ssp(tr, 1);
         tree* t1 = tree_operand(t);
-        declguesses(t1);
-        trans_rhs(t1);
-        initnames(t1);
-        load_definee(t1);
-        out_op(OP_RESTOREE1);
-        ssp--;
+        declguesses(tr, t1);
+        trans_rhs(tr, t1);
+        initnames(tr, t1);
+        load_definee(tr, t1);
+        out_op(tr, OP_RESTOREE1);
+        tr->ssp--;
         break;
     }
     case S_WITHIN: {
-        int L = next_param();
-        int N = next_param();
-        trans_rhs(tree_left(t));
-        out_op(OP_BLOCKLINK);
-        out_param(L);
-        if (ssp == msp) msp = ssp+1;
-        int ssp_save = ssp;
-        int msp_save = msp;
-        ssp = 1;
-        msp = 1;
-        out_op(OP_SAVE);
-        out_param(N);
-        declnames(tree_left(t));
-        trans_rhs(tree_right(t));
-        out_op(OP_RETURN);
-        out_equ(N, msp);
-        ssp = ssp_save;
-        msp = msp_save;
-        out_label(L);
+        int L = next_param(tr);
+        int N = next_param(tr);
+        trans_rhs(tr, tree_left(t));
+        out_op(tr, OP_BLOCKLINK);
+        out_param(tr, L);
+        if (tr->ssp == tr->msp) tr->msp = tr->ssp+1;
+        int ssp_save = tr->ssp;
+        int msp_save = tr->msp;
+        tr->ssp = 1;
+        tr->msp = 1;
+        out_op(tr, OP_SAVE);
+        out_param(tr, N);
+        declnames(tr, tree_left(t));
+        trans_rhs(tr, tree_right(t));
+        out_op(tr, OP_RETURN);
+        out_equ(tr, N, tr->msp);
+        tr->ssp = ssp_save;
+        tr->msp = msp_save;
+        out_label(tr, L);
         break;
     }
     default:
@@ -386,53 +415,53 @@ static void trans_rhs(tree* t)
     }
 }
 
-static void declnames(tree* t)
+static void declnames(translator* tr, tree* t)
 {
     if (!t) return;
-    sl(t);
+    sl(tr, t);
     switch (t->type) {
     case S_NAME: {
-        out_op(OP_DECLNAME);
-        out_name(tree_string(t));
-        ssp--;
+        out_op(tr, OP_DECLNAME);
+        out_name(tr, tree_string(t));
+        tr->ssp--;
         break;
     }
     case S_COMMA: {
         int size = tree_list_size(t);
-        out_op(OP_DECLNAMES);
-        out_int(size);
-        ssp--;
+        out_op(tr, OP_DECLNAMES);
+        out_int(tr, size);
+        tr->ssp--;
         for (int i = 0; i < size; i++) {
             char* name = tree_string(tree_list_element(t, i));
-            out_name(name);
+            out_name(tr, name);
         }
         break;
     }
     case S_AND: {
         int size = tree_list_size(t);
-        out_op(OP_MEMBERS);
-        out_int(size);
-        up_ssp(size-1);
+        out_op(tr, OP_MEMBERS);
+        out_int(tr, size);
+        up_ssp(tr, size-1);
         for (int i = 0; i < size; i++) {
-            declnames(tree_list_element(t, i));
+            declnames(tr, tree_list_element(t, i));
         }
         break;
     }
     case S_REC: {
-        declnames(tree_operand(t));
+        declnames(tr, tree_operand(t));
         break;
     }
     case S_VALDEF: {
-        declnames(tree_left(t));
+        declnames(tr, tree_left(t));
         break;
     }
     case S_WITHIN: {
-        declnames(tree_right(t));
+        declnames(tr, tree_right(t));
         break;
     }
     case S_EMPTY: {
-        out_op(OP_TESTEMPTY);
-        ssp--;
+        out_op(tr, OP_TESTEMPTY);
+        tr->ssp--;
         break;
     }
     default:
@@ -440,56 +469,56 @@ static void declnames(tree* t)
     }
 }
 
-static void trans_scope(tree* decl, tree* body, int N, trans_mode mode)
+static void trans_scope(translator* tr, tree* decl, tree* body, int N, trans_mode mode)
 {
-    int ssp_save = ssp;
-    int msp_save = msp;
-    ssp = 1;
-    msp = 1;
-    sl(decl);
-    out_op(OP_SAVE);
-    out_param(N);
-    declnames(decl);
-    sl(body);
-    trans_labels(body);
-    trans(body, mode);
-    out_op(OP_RETURN);
-    out_equ(N, msp);
-    ssp = ssp_save;
-    msp = msp_save;
+    int ssp_save = tr->ssp;
+    int msp_save = tr->msp;
+    tr->ssp = 1;
+    tr->msp = 1;
+    sl(tr, decl);
+    out_op(tr, OP_SAVE);
+    out_param(tr, N);
+    declnames(tr, decl);
+    sl(tr, body);
+    trans_labels(tr, body);
+    trans(tr, body, mode);
+    out_op(tr, OP_RETURN);
+    out_equ(tr, N, tr->msp);
+    tr->ssp = ssp_save;
+    tr->msp = msp_save;
 }
 
-static void trans(tree* t, trans_mode mode)
+static void trans(translator* tr, tree* t, trans_mode mode)
 {
     if (!t) {
-        error(0, "missing expression");
-        out_op(OP_NIL);
-        up_ssp(1);
+        error(tr->errors, 0, "missing expression");
+        out_op(tr, OP_NIL);
+        up_ssp(tr, 1);
         return;
     }
 
-    sl(t);
+    sl(tr, t);
     tree_type type = t->type;
     op op = type_to_op(type);
 
     switch (type) {
     case S_LET: {
-        int L = next_param();
-        int N = next_param();
-        trans_rhs(tree_left(t));
-        out_op(OP_BLOCKLINK);
-        out_param(L);
-        if (ssp == msp) msp = ssp+1;
-        trans_scope(tree_left(t), tree_right(t), N, mode);
-        out_label(L);
+        int L = next_param(tr);
+        int N = next_param(tr);
+        trans_rhs(tr, tree_left(t));
+        out_op(tr, OP_BLOCKLINK);
+        out_param(tr, L);
+        if (tr->ssp == tr->msp) tr->msp = tr->ssp+1;
+        trans_scope(tr, tree_left(t), tree_right(t), N, mode);
+        out_label(tr, L);
         break;
     }
     case S_DEF: {
         for (int i = 0; i < tree_list_size(t); i++) {
-            trans_rhs(tree_list_element(t, i));
-            declnames(tree_list_element(t, i));
+            trans_rhs(tr, tree_list_element(t, i));
+            declnames(tr, tree_list_element(t, i));
             if (i < tree_list_size(t)-1) {
-                trans_labels(tree_list_element(t, i+1));
+                trans_labels(tr, tree_list_element(t, i+1));
             }
         }
         break;
@@ -507,260 +536,317 @@ static void trans(tree* t, trans_mode mode)
     case S_NE:
     case S_LOGAND:
     case S_LOGOR: {
-        trans(tree_right(t), MODE_VAL);
-        trans(tree_left(t), MODE_VAL);
-        out_op(op);
-        ssp--;
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        trans(tr, tree_right(t), MODE_VAL);
+        trans(tr, tree_left(t), MODE_VAL);
+        out_op(tr, op);
+        tr->ssp--;
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_AUG: {
-        trans(tree_right(t), MODE_REF);
-        trans(tree_left(t), MODE_VAL);
-        out_op(OP_AUG);
-        ssp--;
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        trans(tr, tree_right(t), MODE_REF);
+        trans(tr, tree_left(t), MODE_VAL);
+        out_op(tr, OP_AUG);
+        tr->ssp--;
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_APPLY: {
-        trans(tree_right(t), MODE_REF);
-        trans(tree_left(t), MODE_REF);
-        sl(t);
-        out_op(OP_APPLY);
-        ssp--;
-        if (mode == MODE_VAL) out_op(OP_FORMRVALUE);
+        trans(tr, tree_right(t), MODE_REF);
+        trans(tr, tree_left(t), MODE_REF);
+        sl(tr, t);
+        out_op(tr, OP_APPLY);
+        tr->ssp--;
+        if (mode == MODE_VAL) out_op(tr, OP_FORMRVALUE);
         break;
     }
     case S_POS:
     case S_NEG:
     case S_NOT: {
-        trans(tree_operand(t), MODE_VAL);
-        out_op(op);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        trans(tr, tree_operand(t), MODE_VAL);
+        out_op(tr, op);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_NOSHARE: {
-        trans(tree_operand(t), MODE_VAL);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        trans(tr, tree_operand(t), MODE_VAL);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_COMMA: {
         int size = tree_list_size(t);
         for (int i = size-1; i >= 0; i--) {
             /* compile components for tuples as ref */
-            trans(tree_list_element(t, i), MODE_REF);
+            trans(tr, tree_list_element(t, i), MODE_REF);
         }
-        out_op(OP_TUPLE);
-        out_int(size);
-        ssp = ssp-size+1;
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        out_op(tr, OP_TUPLE);
+        out_int(tr, size);
+        tr->ssp = tr->ssp-size+1;
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_LAMBDA: {
         /* label for lambda body */
-        int L = next_param();
+        int L = next_param(tr);
         /* label to jump around body */
-        int M = next_param();
-        int N = next_param();
+        int M = next_param(tr);
+        int N = next_param(tr);
 
-        out_op(OP_FORMCLOSURE);
-        out_param(L);
-        up_ssp(1);
+        out_op(tr, OP_FORMCLOSURE);
+        out_param(tr, L);
+        up_ssp(tr, 1);
 
         /* jump around lambda body */
-        out_op(OP_JUMP);
-        out_param(M);
+        out_op(tr, OP_JUMP);
+        out_param(tr, M);
 
         /* lambda body label */
-        out_label(L);
-        trans_scope(tree_left(t), tree_right(t), N, MODE_REF);
+        out_label(tr, L);
+        trans_scope(tr, tree_left(t), tree_right(t), N, MODE_REF);
 
-        out_label(M);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        out_label(tr, M);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_COLON: {
         tree* label = tree_list_element(t, 2);
         int L = 0;
         if (!label)
-            error(t->line, "label improperly used");
+            error(tr->errors, t->line, "label improperly used");
         else
             L = tree_integer(label);
-        out_label(L);
-        trans(tree_list_element(t, 1), mode);
+        out_label(tr, L);
+        trans(tr, tree_list_element(t, 1), mode);
         break;
     }
     case S_SEQ: {
-        trans(tree_left(t), MODE_VAL);
-        out_op(OP_LOSE1);
-        ssp--;
-        trans(tree_right(t), mode);
+        trans(tr, tree_left(t), MODE_VAL);
+        out_op(tr, OP_LOSE1);
+        tr->ssp--;
+        trans(tr, tree_right(t), mode);
         break;
     }
     case S_VALOF: {
-        int L = next_param();
-        int N = next_param();
-        out_op(OP_RESLINK);
-        out_param(L);
-        ssp++;
-        if (ssp >= msp) msp = ssp+1;
-        int ssp_save = ssp;
-        int msp_save = msp;
-        ssp = 0;
-        msp = 1;
-        out_op(OP_SAVE);
-        out_param(N);
-        out_op(OP_TESTEMPTY);
-        out_op(OP_JJ);
-        out_op(OP_FORMLVALUE);
-        out_op(OP_DECLNAME);
-        out_name("**res**");
-        trans_labels(tree_operand(t));
-        trans(tree_operand(t), MODE_REF);
-        out_op(OP_RETURN);
-        out_equ(N, msp);
-        ssp = ssp_save;
-        msp = msp_save;
-        out_label(L);
-        if (mode == MODE_VAL) out_op(OP_FORMRVALUE);
+        int L = next_param(tr);
+        int N = next_param(tr);
+        out_op(tr, OP_RESLINK);
+        out_param(tr, L);
+        tr->ssp++;
+        if (tr->ssp >= tr->msp) tr->msp = tr->ssp+1;
+        int ssp_save = tr->ssp;
+        int msp_save = tr->msp;
+        tr->ssp = 0;
+        tr->msp = 1;
+        out_op(tr, OP_SAVE);
+        out_param(tr, N);
+        out_op(tr, OP_TESTEMPTY);
+        out_op(tr, OP_JJ);
+        out_op(tr, OP_FORMLVALUE);
+        out_op(tr, OP_DECLNAME);
+        out_name(tr, "**res**");
+        trans_labels(tr, tree_operand(t));
+        trans(tr, tree_operand(t), MODE_REF);
+        out_op(tr, OP_RETURN);
+        out_equ(tr, N, tr->msp);
+        tr->ssp = ssp_save;
+        tr->msp = msp_save;
+        out_label(tr, L);
+        if (mode == MODE_VAL) out_op(tr, OP_FORMRVALUE);
         break;
     }
     case S_RES: {
-        trans(tree_operand(t), MODE_REF);
-        out_op(OP_RES);
+        trans(tr, tree_operand(t), MODE_REF);
+        out_op(tr, OP_RES);
         break;
     }
     case S_GOTO: {
-        trans(tree_operand(t), MODE_VAL);
-        out_op(OP_GOTO);
+        trans(tr, tree_operand(t), MODE_VAL);
+        out_op(tr, OP_GOTO);
         break;
     }
     case S_COND: {
-        int L = next_param();
-        int M = next_param();
-        trans(tree_list_element(t, 0), MODE_VAL);
-        out_op(OP_JUMPF);
-        out_param(L);
-        ssp--;
-        trans(tree_list_element(t, 1), mode);
-        out_op(OP_JUMP);
-        out_param(M);
-        out_label(L);
-        ssp--;
-        trans(tree_list_element(t, 2), mode);
-        out_label(M);
+        int L = next_param(tr);
+        int M = next_param(tr);
+        trans(tr, tree_list_element(t, 0), MODE_VAL);
+        out_op(tr, OP_JUMPF);
+        out_param(tr, L);
+        tr->ssp--;
+        trans(tr, tree_list_element(t, 1), mode);
+        out_op(tr, OP_JUMP);
+        out_param(tr, M);
+        out_label(tr, L);
+        tr->ssp--;
+        trans(tr, tree_list_element(t, 2), mode);
+        out_label(tr, M);
         break;
     }
     case S_WHILE: {
-        int L = next_param();
-        int M = next_param();
-        out_label(M);
-        trans(tree_left(t), MODE_VAL);
-        out_op(OP_JUMPF);
-        out_param(L);
-        ssp--;
-        trans(tree_right(t), MODE_VAL);
-        out_op(OP_LOSE1);
-        out_op(OP_JUMP);
-        out_param(M);
-        out_label(L);
-        out_op(OP_DUMMY);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        int L = next_param(tr);
+        int M = next_param(tr);
+        out_label(tr, M);
+        trans(tr, tree_left(t), MODE_VAL);
+        out_op(tr, OP_JUMPF);
+        out_param(tr, L);
+        tr->ssp--;
+        trans(tr, tree_right(t), MODE_VAL);
+        out_op(tr, OP_LOSE1);
+        out_op(tr, OP_JUMP);
+        out_param(tr, M);
+        out_label(tr, L);
+        out_op(tr, OP_DUMMY);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_ASS: {
         tree* left = tree_left(t);
-        trans(left, MODE_REF);
-        trans(tree_right(t), MODE_VAL);
-        out_op(OP_UPDATE);
+        trans(tr, left, MODE_REF);
+        trans(tr, tree_right(t), MODE_VAL);
+        out_op(tr, OP_UPDATE);
         int n = left->type == S_COMMA?tree_list_size(left):1;
-        out_int(n);
-        ssp--;
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        out_int(tr, n);
+        tr->ssp--;
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     }
     case S_NIL:
     case S_DUMMY:
     case S_TRUE:
     case S_FALSE:
-        out_op(op);
-        up_ssp(1);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        out_op(tr, op);
+        up_ssp(tr, 1);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     case S_NAME:
         if (mode == MODE_VAL)
-            out_op(OP_LOADR);
+            out_op(tr, OP_LOADR);
         else
-            out_op(OP_LOADL);
-        out_name(tree_string(t));
-        up_ssp(1);
+            out_op(tr, OP_LOADL);
+        out_name(tr, tree_string(t));
+        up_ssp(tr, 1);
         break;
     case S_INT:
-        out_op(OP_LOADN);
-        out_integer(tree_integer(t));
-        up_ssp(1);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        out_op(tr, OP_LOADN);
+        out_integer(tr, tree_integer(t));
+        up_ssp(tr, 1);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     case S_JJ:
-        out_op(OP_JJ);
-        up_ssp(1);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        out_op(tr, OP_JJ);
+        up_ssp(tr, 1);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     case S_REAL:
-        out_op(OP_LOADF);
-        out_real(tree_real(t));
-        up_ssp(1);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        out_op(tr, OP_LOADF);
+        out_real(tr, tree_real(t));
+        up_ssp(tr, 1);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     case S_STRING:
-        out_op(OP_LOADS);
-        out_string(tree_string(t));
-        up_ssp(1);
-        if (mode == MODE_REF) out_op(OP_FORMLVALUE);
+        out_op(tr, OP_LOADS);
+        out_string(tr, tree_string(t));
+        up_ssp(tr, 1);
+        if (mode == MODE_REF) out_op(tr, OP_FORMLVALUE);
         break;
     default:
         break;
     }
 }
 
-BYTE* translate(tree* t, int* len)
+void translate_unit(tree* t, code_unit* unit, error_log* errors)
 {
-    int n = next_param();
-    ssp = 0;
-    msp = 1;
-    sl(t);
-    out_op(OP_SETUP);
-    out_int(n);
-    trans_labels(t);
-    trans(t, MODE_VAL);
-    out_equ(n, msp);
-    *len = code_len;
-    return code;
+    translator tr;
+    tr.errors = errors;
+    tr.param_number = 0;
+    tr.ssp = 0;
+    tr.msp = 0;
+    tr.code_max = 1024;
+    tr.code_len = 0;
+    tr.code = malloc(sizeof(BYTE)*tr.code_max);
+    tr.line = 0;
+    tr.refs_max = 64;
+    tr.refs_len = 0;
+    tr.refs = malloc(sizeof(int)*tr.refs_max);
+    tr.lines_max = 256;
+    tr.lines_len = 0;
+    tr.lines = malloc(sizeof(int)*tr.lines_max);
+
+    sl(&tr, t);
+    trans_labels(&tr, t);
+    trans(&tr, t, MODE_VAL);
+
+    unit->code = tr.code;
+    unit->code_len = tr.code_len;
+    unit->params = tr.param_number;
+    unit->ssp = tr.ssp;
+    unit->msp = tr.msp;
+    unit->line = tr.line;
+    unit->refs = tr.refs;
+    unit->refs_len = tr.refs_len;
+    unit->lines = tr.lines;
+    unit->lines_len = tr.lines_len;
 }
 
-BYTE* translate_list(list* tree_list, int* len)
+void free_unit(code_unit* unit)
 {
-    int n = next_param();
-    ssp = 0;
-    msp = 1;
-    out_op(OP_SETUP);
-    out_int(n);
-    for (int i = 0; i < tree_list->len; i++) {
-        tree* t = list_element(tree_list, i);
-        sl(t);
-        trans_labels(t);
-        trans(t, MODE_VAL);
-    }
-    out_equ(n, msp);
-    *len = code_len;
-    return code;
+    free(unit->code);
+    free(unit->refs);
+    free(unit->lines);
 }
 
-void init_translator()
+void relocate_file(code_unit* unit, int filenr)
 {
-    line = 0;
-    code_max = 1024;
-    code_len = 0;
-    code = malloc(sizeof(BYTE)*code_max);
-    param_number = 0;
+    for (int i = 0; i < unit->lines_len; i++) {
+        BYTE* line = &unit->code[unit->lines[i]];
+        encode_int((decode_int(line)&0xFFFFFF)|(filenr<<24), line);
+    }
+    unit->line = (unit->line&0xFFFFFF)|(filenr<<24);
+}
+
+/*
+ * The units follow each other on the stack of the main program, and
+ * their label numbers follow the one of the program.
+ */
+BYTE* link_units(code_unit* units, int n, int* len)
+{
+    int code_len = 5+4;
+    for (int i = 0; i < n; i++) code_len += units[i].code_len;
+    code_len += 5+4+4;
+    BYTE* code = malloc(sizeof(BYTE)*code_len);
+
+    int pc = 0;
+    int L = 1;
+    code[pc++] = OP_SETUP;
+    encode_int(0, &code[pc]);
+    pc += 4;
+    encode_int(L, &code[pc]);
+    pc += 4;
+
+    int base = L;
+    int ssp = 0;
+    int msp = 1;
+    int line = 0;
+    for (int i = 0; i < n; i++) {
+        code_unit* unit = &units[i];
+        memcpy(&code[pc], unit->code, unit->code_len);
+        for (int j = 0; j < unit->refs_len; j++) {
+            BYTE* ref = &code[pc+unit->refs[j]];
+            encode_int(decode_int(ref)+base, ref);
+        }
+        pc += unit->code_len;
+        base += unit->params;
+        if (ssp+unit->msp > msp) msp = ssp+unit->msp;
+        ssp += unit->ssp;
+        line = unit->line;
+    }
+
+    code[pc++] = OP_EQU;
+    encode_int(line, &code[pc]);
+    pc += 4;
+    encode_int(L, &code[pc]);
+    pc += 4;
+    encode_int(msp, &code[pc]);
+    pc += 4;
+
+    *len = pc;
+    return code;
 }
@@ -1,23 +1,47 @@
 #ifndef TRANSLATOR_H
 #define TRANSLATOR_H
 
-#include "tree.h"
 #include "config.h"
+#include "error.h"
+#include "tree.h"
 
 /*
- * Must be called before invoking translate.
+ * The code of one top-level tree, translated on its own. Its label
+ * numbers start at 1 and its stack depth at 0, so that the trees of
+ * several files can be translated concurrently.
  */
-void init_translator();
+typedef struct {
+    BYTE* code;
+    int code_len;
+    /* the number of label numbers used */
+    int params;
+    /* the stack depth at the end and its maximum */
+    int ssp;
+    int msp;
+    /* the line of the last operation */
+    int line;
+    /* the positions of the label numbers in code */
+    int* refs;
+    int refs_len;
+    /* the positions of the line numbers in code */
+    int* lines;
+    int lines_len;
+} code_unit;
+
+void translate_unit(tree* t, code_unit* unit, error_log* errors);
+
+void free_unit(code_unit* unit);
 
 /*
- * Translates the tree and returns the byte array
- * containing, its length in code_len.
+ * Changes the source file number in the line numbers of unit.
  */
-BYTE* translate(tree* t, int* code_len);
+void relocate_file(code_unit* unit, int filenr);
 
-/**
- * Translates a list of trees.
+/*
+ * Links the units, in order, into the code of the main program and
+ * returns it, its length in code_len. The result is the same as if
+ * the trees had been translated one after the other.
  */
-BYTE* translate_list(list* tree_list, int* code_len);
+BYTE* link_units(code_unit* units, int n, int* code_len);
 
 #endif
@@ -1,4 +1,6 @@
 #include <string.h>
+#include "allocprof.h"
+#include "map.h"
 #include "strings.h"
 #include "value.h"
 #include "gc.h"
@@ -7,6 +9,7 @@ value* make_value(value_type type)
 {
     value* V = GC_NEW(value);
     V->type = type;
+    if (allocprof_on) allocprof_record(V, type, sizeof(value));
     return V;
 }
 
@@ -36,6 +39,55 @@ value* make_tuple(int size)
     value* V = make_value(V_TUPLE);
     V->v.tuple.size = size;
     V->v.tuple.values = GC_MALLOC(size*sizeof(value*));
+    if (allocprof_on) allocprof_record(V->v.tuple.values, ALLOC_ARRAY, size*sizeof(value*));
+    return V;
+}
+
+value* make_tuplemaker(int len)
+{
+    value* V = make_value(V_TUPLEMAKER);
+    V->v.tuplemaker.len = len;
+    V->v.tuplemaker.n = 0;
+    V->v.tuplemaker.values = GC_MALLOC(len*sizeof(value*));
+    if (allocprof_on) allocprof_record(V->v.tuplemaker.values, ALLOC_ARRAY, len*sizeof(value*));
+    V->v.tuplemaker.filled = GC_MALLOC_ATOMIC(sizeof(int));
+    *V->v.tuplemaker.filled = 0;
+    return V;
+}
+
+/*
+ * Adds val as the next element. All makers derived from the same
+ * Tuple n share one values array, and the one at the fill frontier
+ * appends in place. Any other maker copies its prefix first, so
+ * partial applications can still be reused.
+ */
+value* tuplemaker_add(value* maker, value* val)
+{
+    int n = maker->v.tuplemaker.n;
+    int len = maker->v.tuplemaker.len;
+    value** values = maker->v.tuplemaker.values;
+    int* filled = maker->v.tuplemaker.filled;
+    if (*filled != n) {
+        value** copy = GC_MALLOC(len*sizeof(value*));
+        if (allocprof_on) allocprof_record(copy, ALLOC_ARRAY, len*sizeof(value*));
+        memcpy(copy, values, n*sizeof(value*));
+        values = copy;
+        filled = GC_MALLOC_ATOMIC(sizeof(int));
+    }
+    values[n] = val;
+    *filled = n+1;
+    if (n+1 == len) {
+        /* the tuple takes over the array */
+        value* V = make_value(V_TUPLE);
+        V->v.tuple.size = len;
+        V->v.tuple.values = values;
+        return V;
+    }
+    value* V = make_value(V_TUPLEMAKER);
+    V->v.tuplemaker.len = len;
+    V->v.tuplemaker.n = n+1;
+    V->v.tuplemaker.values = values;
+    V->v.tuplemaker.filled = filled;
     return V;
 }
 
@@ -52,24 +104,28 @@ value* make_stack(int pc, value* env, struct _stack* stack)
     V->v.stack.pc = pc;
     V->v.stack.env = env;
     V->v.stack.stack = stack;
+    V->v.stack.memo = 0;
+    V->v.stack.key = 0;
     return V;
 }
 
-value* make_jj(int pc, value* env, struct _stack* stack)
+value* make_jj(int pc, value* env, struct _stack* stack, struct _stack* base)
 {
     value* V = make_value(V_JJ);
     V->v.jj.pc = pc;
     V->v.jj.env = env;
     V->v.jj.stack = stack;
+    V->v.jj.base = base;
     return V;
 }
 
-value* make_label(int pc, value* env, struct _stack* stack)
+value* make_label(int pc, value* env, struct _stack* stack, struct _stack* base)
 {
     value* V = make_value(V_LABEL);
     V->v.label.pc = pc;
     V->v.label.env = env;
     V->v.label.stack = stack;
+    V->v.label.base = base;
     return V;
 }
 
@@ -89,6 +145,85 @@ value* make_builtin(char* name, builtin_fn fn)
     return V;
 }
 
+value* make_map(int cap)
+{
+    value* V = make_value(V_MAP);
+    V->v.map = map_new(cap);
+    return V;
+}
+
+value* make_range(INTEGER first, int size)
+{
+    value* V = make_value(V_RANGE);
+    V->v.range.first = first;
+    V->v.range.size = size;
+    return V;
+}
+
+value* range_element(value* val, int i)
+{
+    value* V = make_lvalue(make_integer(value_range_val(val, i)));
+    V->v.element.range = val;
+    V->v.element.index = i;
+    return V;
+}
+
+value* range_tuple(value* val)
+{
+    if (!value_is_type(val, V_RANGE)) return val;
+    int size = val->v.range.size;
+    value* T = make_tuple(size);
+    for (int i = 0; i < size; i++) {
+        value_tuple_val(T, i) = range_element(val, i);
+    }
+    return T;
+}
+
+value* range_materialize(value* val)
+{
+    if (!value_is_type(val, V_RANGE)) return val;
+    INTEGER first = val->v.range.first;
+    int size = val->v.range.size;
+    value** values = GC_MALLOC(size*sizeof(value*));
+    if (allocprof_on) allocprof_record(values, ALLOC_ARRAY, size*sizeof(value*));
+    for (int i = 0; i < size; i++) {
+        values[i] = make_lvalue(make_integer(first+i));
+    }
+    val->type = V_TUPLE;
+    val->v.tuple.size = size;
+    val->v.tuple.values = values;
+    return val;
+}
+
+void update_lvalue(value* lv, value* val)
+{
+    value* range = lv->v.element.range;
+    if (range) {
+        /* writing through a range element materialises the range */
+        range_materialize(range);
+        value_rvalue(value_tuple_val(range, lv->v.element.index)) = val;
+    }
+    value_rvalue(lv) = val;
+}
+
+int value_order(value* val)
+{
+    if (value_is_type(val, V_RANGE))
+        return value_range_size(val);
+    else
+        return value_tuple_size(val);
+}
+
+char* value_type_name(value_type type)
+{
+    static char* names[] = {
+        "true", "false", "integer", "real", "string", "dummy", "tuple",
+        "lvalue", "closure", "env", "frame", "guess", "builtin", "label",
+        "tuplemaker", "jj", "map", "memo", "range", "future", "channel"
+    };
+    return names[type];
+}
+
 value* env_bind(int name, value* val, value* env)
 {
     value *E = make_value(V_ENV);
@@ -119,9 +254,9 @@ int value_equal(value* value1, value* value2)
             return 0;
     case V_FALSE:
         if (value_is_type(value2, V_FALSE))
-            return 0;
-        else
             return 1;
+        else
+            return 0;
     case V_INTEGER:
         if (value_is_type(value2, V_INTEGER))
             return value_integer(value1) == value_integer(value2);
@@ -170,6 +305,17 @@ int value_compare(value* value1, value* value2)
                 return 0;
         }
         break;
+    case V_STRING:
+        if (value_is_type(value2, V_STRING)) {
+            int c = strcmp(value_string(value1), value_string(value2));
+            if (c < 0)
+                return -1;
+            else if (c > 0)
+                return 1;
+            else
+                return 0;
+        }
+        break;
     default:
         return -2;
     }
@@ -233,16 +379,49 @@ void print_value(FILE* file, value* value)
     case V_JJ:
         fprintf(file, "JJ");
         break;
+    case V_MAP: {
+        fprintf(file, "MAP = {");
+        struct _value* key;
+        void* val;
+        int i = 0;
+        int first = 1;
+        while ((i = map_next(value->v.map, i, &key, &val)) >= 0) {
+            if (!first) fprintf(file, ", ");
+            print_value(file, key);
+            fprintf(file, ": ");
+            print_value(file, val);
+            first = 0;
+        }
+        fprintf(file, "}");
+        break;
+    }
+    case V_MEMO:
+        fprintf(file, "MEMO");
+        break;
+    case V_FUTURE:
+        fprintf(file, "FUTURE");
+        break;
+    case V_CHANNEL:
+        fprintf(file, "CHANNEL");
+        break;
+    case V_RANGE:
+        fprintf(file, "TUPLE = (");
+        for (int i = 0; i < value->v.range.size; i++) {
+            if (i > 0) fprintf(file, ", ");
+            fprintf(file, "INTEGER = %ld", value_range_val(value, i));
+        }
+        fprintf(file, ")");
+        break;
     }
 }
 
-void print_env(FILE* file, value* env)
+void print_env(FILE* file, value* env, strings* st)
 {
     while (env && value_is_type(env, V_ENV)) {
         int n = env->v.env.name;
         if (n >= 0) {
             value* value = env->v.env.value;
-            char* name = ref_to_string(n);
+            char* name = ref_to_string(st, n);
             fprintf(file, "%s: ", name);
             print_value(file, value);
             fprintf(file, "\n");
@@ -302,10 +481,9 @@ static value* copy_rec(value* val, copy_map* map)
     case V_TUPLEMAKER: {
         int n = val->v.tuplemaker.n;
         int len = val->v.tuplemaker.len;
-        new = make_value(V_TUPLEMAKER);
-        new->v.tuplemaker.len = len;
+        new = make_tuplemaker(len);
         new->v.tuplemaker.n = n;
-        new->v.tuplemaker.values = GC_MALLOC(n*sizeof(value*));
+        *new->v.tuplemaker.filled = n;
         map = copy_add(val, new, map);
         for (int i = 0; i < n; i++) {
             value* tmp = copy_rec(val->v.tuplemaker.values[i], map);
@@ -313,6 +491,22 @@ static value* copy_rec(value* val, copy_map* map)
         }
         return new;
     }
+    case V_RANGE:
+        /* ranges are materialised in place when written */
+        new = make_range(val->v.range.first, val->v.range.size);
+        return new;
+    case V_MAP: {
+        struct _map* m = val->v.map;
+        new = make_map(m->size);
+        map = copy_add(val, new, map);
+        value* key;
+        void* v;
+        int i = 0;
+        while ((i = map_next(m, i, &key, &v)) >= 0) {
+            map_put(new->v.map, key, copy_rec(v, map));
+        }
+        return new;
+    }
     default:
         return val;
     }
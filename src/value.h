@@ -20,14 +20,31 @@ typedef enum {
     V_BUILTIN,
     V_LABEL,
     V_TUPLEMAKER,
-    V_JJ
+    V_JJ,
+    V_MAP,
+    V_MEMO,
+    V_RANGE,
+    V_FUTURE,
+    V_CHANNEL
 } value_type;
 
 struct _stack;
 
+struct _pal_vm;
+
+struct _strings;
+
+struct _map;
+
+struct _memo;
+
+struct _task;
+
+struct _channel;
+
 struct _value;
 
-typedef struct _value* (*builtin_fn)(struct _value*, struct _stack*, struct _value*);
+typedef struct _value* (*builtin_fn)(struct _pal_vm*, struct _value*, struct _stack*, struct _value*);
 
 struct _value {
     value_type type;
@@ -36,6 +53,12 @@ struct _value {
         REAL real;
         char* string;
         struct _value* value;
+        /* an lvalue obtained by indexing a range */
+        struct {
+            struct _value* value;
+            struct _value* range;
+            int index;
+        } element;
         struct {
             int size;
             struct _value** values;
@@ -45,20 +68,26 @@ struct _value {
             struct _value* value;
             struct _value* next;
         } env;
+        /* the frame of a memoised closure caches its result under key */
         struct {
             int pc;
             struct _stack* stack;
             struct _value* env;
+            struct _value* memo;
+            struct _value* key;
         } stack;
+        /* base is that of the interpret creating them, see caller */
         struct {
             int pc;
             struct _stack* stack;
             struct _value* env;
+            struct _stack* base;
         } jj;
         struct {
             int pc;
             struct _stack* stack;
             struct _value* env;
+            struct _stack* base;
         } label;
         struct {
             int pc;
@@ -72,7 +101,23 @@ struct _value {
             int n;
             int len;
             struct _value** values;
+            int* filled;
         } tuplemaker;
+        struct _map* map;
+        struct _memo* memo;
+        struct {
+            INTEGER first;
+            int size;
+        } range;
+        /* the result of Spawn, set when the task has finished */
+        struct {
+            struct _task* task;
+            struct _pal_vm* vm;
+            struct _value* fn;
+            struct _value* arg;
+            struct _value* result;
+        } future;
+        struct _channel* channel;
     } v;
 };
 
@@ -96,6 +141,12 @@ typedef struct _value value;
 
 #define value_tuple_val(_v, _i) ((_v)->v.tuple.values[_i])
 
+#define value_is_tuple(_v) ((_v)->type == V_TUPLE || (_v)->type == V_RANGE)
+
+#define value_range_size(_v) ((_v)->v.range.size)
+
+#define value_range_val(_v, _i) ((_v)->v.range.first+(_i))
+
 value* make_value(value_type type);
 
 value* make_integer(INTEGER integer);
@@ -106,18 +157,61 @@ value* make_string(char* string);
 
 value* make_tuple(int size);
 
+value* make_tuplemaker(int len);
+
+value* tuplemaker_add(value* maker, value* val);
+
 value* make_lvalue(value* value);
 
 value* make_stack(int pc, value* env, struct _stack* stack);
 
-value* make_jj(int pc, value* env, struct _stack* stack);
+value* make_jj(int pc, value* env, struct _stack* stack, struct _stack* base);
 
-value* make_label(int pc, value* env, struct _stack* stack);
+value* make_label(int pc, value* env, struct _stack* stack, struct _stack* base);
 
 value* make_closure(int pc, value* env);
 
 value* make_builtin(char* name,builtin_fn fn);
 
+value* make_map(int cap);
+
+value* make_range(INTEGER first, int size);
+
+/*
+ * Returns a new lvalue for the element with index i (starting at 0)
+ * of the range val. Indexing the same element twice gives two
+ * lvalues, which are not shared and do not see the writes through
+ * each other, until a write turns the range into a tuple.
+ */
+value* range_element(value* val, int i);
+
+/*
+ * Returns a new tuple of the elements of the range val, as returned by
+ * range_element. Other values are returned unchanged.
+ */
+value* range_tuple(value* val);
+
+/*
+ * Turns the range val into a tuple in place and returns it, for an
+ * update through its elements. Other values are returned unchanged.
+ */
+value* range_materialize(value* val);
+
+/*
+ * Assigns val to the lvalue lv, which may be an element of a range.
+ */
+void update_lvalue(value* lv, value* val);
+
+/*
+ * Returns the size of a tuple or range.
+ */
+int value_order(value* val);
+
+/*
+ * Returns the name of the value type, in lower case.
+ */
+char* value_type_name(value_type type);
+
 value* env_bind(int name, value* val, value* env);
 
 value* env_lookup(int name, value* env);
@@ -128,7 +222,7 @@ int value_compare(value* value1, value* value2);
 
 void print_value(FILE* file, value* value);
 
-void print_env(FILE* file, value* env);
+void print_env(FILE* file, value* env, struct _strings* st);
 
 value* copy_value(value* val);
 
@@ -0,0 +1,130 @@
+#ifndef VM_H
+#define VM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include "code.h"
+#include "config.h"
+#include "strings.h"
+#include "value.h"
+
+typedef struct {
+    op op;
+    union {
+        INTEGER integer;
+        REAL real;
+        int ref;
+        int n;
+        int* refs;
+    } args;
+    int line;
+    char* file;
+} operation;
+
+/*
+ * The code of a function body in a lazily decoded program, from after
+ * its LABEL up to the LABEL following it. Its operations are decoded
+ * from first_op on when its OP_ENTER is first executed.
+ */
+typedef struct {
+    int start;
+    int end;
+    int first_op;
+    atomic_int decoded;
+} lazy_body;
+
+/*
+ * A decoded program. Apart from the lazily decoded bodies, it is not
+ * modified once loaded, so any number of VMs may run it concurrently.
+ * The loader and every VM running it hold a reference; it is freed
+ * when the last one is released.
+ */
+typedef struct _pal_program {
+    operation* ops;
+    int len;
+    strings* strings;
+    /* source file names, referenced by the operations */
+    char** files;
+    int files_len;
+    atomic_int refs;
+    /* the pocode and label values, if decoded lazily */
+    BYTE* code;
+    int code_owned;
+    int* labels;
+    lazy_body* bodies;
+    int bodies_len;
+    pthread_mutex_t lock;
+} pal_program;
+
+struct _coro_state;
+
+/*
+ * The application of a builtin that applied a closure through
+ * call_closure: the pc it returns to and the stack at the time. The
+ * profiler follows these from one interpret to the one that called it.
+ * base, the stack cell of the argument, identifies the interpret of
+ * the closure: labels and res and J targets record the base of the
+ * interpret they were created in, as they cannot leave or enter another.
+ */
+typedef struct _caller {
+    int pc;
+    struct _stack* S;
+    struct _stack* base;
+    /* the number of callers, this one included */
+    int depth;
+    struct _caller* next;
+} caller;
+
+struct _io_state;
+
+/*
+ * The state of one execution of a program. The registers of the
+ * interpreter are local to interpret, so a VM is only used by one
+ * thread at a time; tasks on other threads run on a fork_vm copy.
+ */
+typedef struct _pal_vm {
+    pal_program* program;
+    /* the initial environment with the builtins */
+    value* env;
+    /* the rvalue the main program ended with */
+    value* result;
+    value* guess_rvalue;
+    value* true_rvalue;
+    value* false_rvalue;
+    value* dummy_rvalue;
+    value* nil_rvalue;
+    int resname;
+    /* the operation being executed, for runtime errors */
+    operation* loc;
+    /* the instructions executed, not counting forks */
+    long instructions;
+    /* the closures and builtins applied, not counting forks */
+    long closure_calls;
+    long builtin_calls;
+    /* the counts added to the totals of the metrics so far */
+    struct {
+        long instructions;
+        long closure_calls;
+        long builtin_calls;
+    } added;
+    FILE* err;
+    /* the runtime errors of the run, shared with the forks that run
+       its tasks on other threads */
+    atomic_int* errors;
+    /* set by a builtin that suspended the running coroutine */
+    int coro_switch;
+    /* true if builtins may suspend the running coroutine */
+    int coro_allowed;
+    struct _coro_state* coro;
+    struct _io_state* io;
+    /* the last application of a builtin, and the callers of closures
+       applied by builtins, innermost first */
+    int apply_pc;
+    struct _stack* apply_S;
+    caller* callers;
+    /* the activations of the call profiler */
+    struct _call_stack* calls;
+} pal_vm;
+
+#endif
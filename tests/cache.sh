@@ -0,0 +1,25 @@
+#!/bin/bash
+# The pocode cache of pal70 FILE.pal: running unchanged sources again
+# uses the cached pocode, editing a source compiles it again.
+PAL70=`realpath ${1:-../src/pal70}`
+dir=`mktemp -d`
+trap 'rm -rf $dir' EXIT
+export PAL70_CACHE=$dir/cache
+
+echo "Print 'one*n'" > $dir/prog.pal
+
+run() {
+    $PAL70 -v $dir/prog.pal > $dir/log || exit 1
+    grep -v '^\(Parsing\|Translating\|Executing\|Terminated\)' $dir/log |
+        sed 's/^Writing code to .*/miss/; s/^Using .*/hit/'
+}
+
+echo "first run"
+run
+echo "second run"
+run
+echo "after editing the source"
+echo "Print 'two*n'" > $dir/prog.pal
+run
+echo "second run"
+run
@@ -0,0 +1,95 @@
+/*
+ * Runs one pocode program on n VMs at once, each on its own thread.
+ * The output of a VM is what it prints, its runtime errors and the
+ * value it ends with. If the outputs of all VMs are the same, it is
+ * printed once, to be compared with the expected output; otherwise
+ * the differing ones are reported.
+ *
+ * Print is replaced to write to the output of the VM of the calling
+ * thread, so the program must not print from ParMap or Spawn tasks.
+ *
+ * Usage: concurrent FILE.pocode [N]
+ */
+#define GC_THREADS
+#include <gc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libpal70.h"
+
+typedef struct {
+    pal_program* program;
+    char* output;
+    size_t len;
+} run;
+
+static _Thread_local FILE* output;
+
+static pal_value* print(pal_vm* vm, pal_value* arg, struct _stack* S, pal_value* E)
+{
+    pal_print(output ? output : stderr, pal_rvalue(arg));
+    return pal_lvalue(pal_tuple(0));
+}
+
+static void* run_vm(void* arg)
+{
+    run* r = arg;
+    output = open_memstream(&r->output, &r->len);
+    pal_vm* vm = pal_new_vm(r->program, output);
+    pal_value* res = pal_run(vm);
+    fprintf(output, "result: ");
+    pal_print(output, res);
+    fprintf(output, "\n%d runtime errors\n", pal_errors(vm));
+    pal_free_vm(vm);
+    fclose(output);
+    output = 0;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s FILE.pocode [N]\n", argv[0]);
+        return 1;
+    }
+    char* file_name = argv[1];
+    int n = argc > 2 ? atoi(argv[2]) : 64;
+    if (n < 1) n = 1;
+
+    pal_init();
+    pal_register_builtin("Print", print);
+    pal_program* program = pal_load_file(file_name);
+    if (!program) {
+        fprintf(stderr, "%s: error reading %s\n", argv[0], file_name);
+        return 1;
+    }
+
+    run* runs = calloc(n, sizeof(run));
+    pthread_t* threads = malloc(n*sizeof(pthread_t));
+    for (int i = 0; i < n; i++) {
+        runs[i].program = program;
+        if (pthread_create(&threads[i], 0, run_vm, &runs[i]) != 0) {
+            perror(argv[0]);
+            return 1;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_join(threads[i], 0);
+    }
+
+    int failed = 0;
+    for (int i = 1; i < n; i++) {
+        if (strcmp(runs[i].output, runs[0].output) != 0) {
+            fprintf(stderr, "VM %d differs from VM 0:\n%s", i, runs[i].output);
+            failed++;
+        }
+    }
+    if (failed) {
+        fprintf(stderr, "%d of %d VMs differ from VM 0:\n%s", failed, n, runs[0].output);
+        return 1;
+    }
+    fputs(runs[0].output, stdout);
+    pal_free_program(program);
+    return 0;
+}
@@ -0,0 +1,32 @@
+/*
+ * Runs FILE.pocode through libpal70 and prints the value it ended with
+ * and the number of runtime errors reported by pal_errors. The error
+ * messages are discarded, as tasks on other threads report them in
+ * any order.
+ *
+ * Usage: host FILE.pocode
+ */
+#include <stdio.h>
+#include "libpal70.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s FILE.pocode\n", argv[0]);
+        return 1;
+    }
+    pal_init();
+    pal_program* program = pal_load_file(argv[1]);
+    if (!program) {
+        fprintf(stderr, "%s: error reading %s\n", argv[0], argv[1]);
+        return 1;
+    }
+    FILE* err = fopen("/dev/null", "w");
+    pal_vm* vm = pal_new_vm(program, err);
+    pal_value* res = pal_run(vm);
+    pal_print(stdout, res);
+    printf("\n%d runtime errors\n", pal_errors(vm));
+    pal_free_vm(vm);
+    pal_free_program(program);
+    return 0;
+}
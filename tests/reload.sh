@@ -0,0 +1,43 @@
+#!/bin/bash
+# Hot reload of pal70 --serve. A request runs the pocode file as it is,
+# if its modification time changed; a file replaced with the same
+# modification time is only picked up after pal70 --reload.
+PAL70=`realpath ${1:-../src/pal70}`
+dir=`mktemp -d`
+trap 'kill $server 2>/dev/null; wait; rm -rf $dir' EXIT
+
+for v in one two three; do
+    echo "Print '$v*n'" > $dir/$v.pal
+    $PAL70 -c -o $dir/$v.pocode $dir/$v.pal || exit 1
+done
+prog=$dir/prog.pocode
+cp $dir/one.pocode $prog
+
+$PAL70 --workers 1 --serve $dir/sock &
+server=$!
+for i in `seq 50`; do [ -S $dir/sock ] && break; sleep 0.1; done
+
+run() {
+    $PAL70 --client $dir/sock $prog
+}
+
+echo "first request"
+run
+echo "after replacing the file"
+sleep 0.01
+cp $dir/two.pocode $prog
+run
+echo "after replacing it with the same modification time"
+touch -r $prog $dir/stamp
+cp $dir/three.pocode $prog
+touch -r $dir/stamp $prog
+run
+echo "after --reload"
+$PAL70 --reload $dir/sock
+# the workers reload when the server has passed the signal on
+for i in `seq 50`; do
+    out=`run`
+    [ "$out" != two ] && break
+    sleep 0.1
+done
+echo "$out"